@@ -10,7 +10,29 @@ LOCAL_LDLIBS     := -L$(SYSROOT)/usr/lib    # libraries to link against
 LOCAL_SRC_FILES := \
 	shared/utils.c \
 	solver/api.c \
-	solver/cpu_st/solver_cpu_st.c
+	solver/cpu_st/solver_cpu_st.c \
+	shared/thread.c \
+	shared/workers.c \
+	solver/cpu_mt/solver_cpu_mt.c \
+	solver/cross_check.c \
+	solver/cpu_st/air_cpu_st.c \
+	solver/cpu_st/compact_cpu_st.c \
+	solver/cpu_st/chunks_cpu_st.c \
+	shared/cpu.c \
+	solver/cpu_st/heat_cpu_st.c \
+	solver/cpu_st/planes_cpu_st.c \
+	solver/cpu_st/distance_cpu_st.c \
+	solver/snapshot.c \
+	solver/history.c \
+	solver/cpu_st/changes_cpu_st.c \
+	solver/cpu_st/render_cpu_st.c \
+	solver/cpu_st/positions_cpu_st.c \
+	shared/timer.c \
+	solver/stats.c \
+	solver/trace.c \
+	solver/stepping.c \
+	solver/publish.c \
+	solver/async.c
 
 # LOCAL_C_INCLUDES := 
 
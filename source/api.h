@@ -15,11 +15,92 @@ extern const struct PPConfiguration * pp_get_configuration( );
 //! Get physic constants (read/write).
 extern struct PPConstants * pp_get_constants( );
 
-//! Update frame.
+//! Update frame. Runs one solver step of 'dt', or several ones with PPConfiguration::cfl or fixed_step.
 extern void pp_update( pp_time_t dt );
+//! Update frame in slices within 'budget_us' microseconds of wall clock time per call, 0 for no limit. A frame, which
+//! doesn't fit, is continued by the next calls and their 'dt' is accumulated with fixed step or dropped otherwise, so
+//! simulation slows down rather than the caller. Returns 1 when the frame is complete and published, see pp_get_frame.
+//! Streams, render and other getters show the frame in progress. Particle updates, history record and copy of the frame
+//! for publication are split between calls. Not split are air and heat of a step, collecting awake particles, deferred
+//! particles of SOLVER_CPU_MT, bands of SOLVER_CPU_MT run by one thread each, end of step with sleeping chunks and
+//! automatic compaction, each of them is done within one call. Spawns are allowed between calls during steps, after the
+//! steps they complete the frame first, as other edits, pp_update, compaction, snapshots and rewind always do.
+extern int pp_update_budgeted( pp_time_t dt, int budget_us );
+//! Start update of frame like pp_update on engine thread and return at once. Frame is published when pp_poll or pp_wait
+//! sees it complete, until then pp_get_frame keeps the previous frame, so it may be read while the update runs. The same
+//! way pp_render and pp_export_positions read the published frame instead of waiting. Any other call waits for the update
+//! first. Returns 0 if engine thread can't be started.
+extern int pp_update_async( pp_time_t dt );
+//! Check if update of pp_update_async is complete without blocking and publish its frame. Returns 1 if no update runs.
+extern int pp_poll( );
+//! Wait for update of pp_update_async and publish its frame. Returns at once if no update runs.
+extern void pp_wait( );
+//! Get the last frame completed by pp_update_budgeted or pp_update_async. It stays the same until the next frame is
+//! published, valid until the second next one. Returns NULL if no frame is published yet.
+extern const struct PPFrame * pp_get_frame( );
+//! Pack alive particles to the front of particle streams and order them by position. Indices of particles change.
+//! Returns 0 on failure. Is done automatically if PPConfiguration::compact_threshold is set.
+extern int pp_compact( );
+//! Get rectangle [x0, x1) x [y0, y1) of the world, which could be changed by the last update. Everything else is
+//! asleep and stays the same. Returns 0 if nothing has changed. Without sleeping chunks it is the whole world.
+extern int pp_get_dirty_rect( int * x0, int * y0, int * x1, int * y1 );
+//! Get changes of the world since the previous update returned: edits done before the last update and changes made by
+//! the update itself. Particle changes are listed in order they happened, so replaying them keeps a copy of the world in
+//! sync at O(changes) cost. Lists are read only and valid until the next update or edit. Returns NULL unless
+//! PPConfiguration::change_lists is set.
+extern const struct PPChanges * pp_get_changes( );
+//! Render viewport [x, x + width) x [y, y + height) of the world into buffer in one of PPRenderFormat. The first pixel of
+//! buffer is (x, y), rows are 'stride' bytes apart. Pixels of viewport outside of the world are left untouched. While
+//! update of pp_update_async runs, the frame of pp_get_frame is rendered on the calling thread. Returns 0 on invalid
+//! arguments.
+extern int pp_render( int format, void * buffer, int stride, int x, int y, int width, int height );
+//! Write positions of alive particles blended between the previous and the current update, 'alpha' 0 is the previous
+//! state and 1 is the current one. Record k is particle pp_get_alive_particles( )[ k ] in one of PPPositionFormat, records
+//! are 'stride' bytes apart, so they may be interleaved with other vertex data. Buffer must hold
+//! pp_get_alive_particles_count( ) records. While update of pp_update_async runs, particles of pp_get_frame are written
+//! instead, record k is its index[ k ] and buffer must hold its count records. Returns number of written records or -1
+//! on invalid arguments.
+extern int pp_export_positions( float alpha, int format, void * buffer, int stride );
+//! Save world snapshot to file: configuration of world size, constants and the whole solver state. Returns 0 on failure.
+extern int pp_save( const char * path );
+//! Load world snapshot from file. If world size differs, the library is reinitialized with the size from snapshot and
+//! the rest of the current configuration. Pointers to streams must be requested again. Returns 0 on failure.
+extern int pp_load( const char * path );
+//! Get size of world snapshot in bytes.
+extern int pp_get_snapshot_size( );
+//! Save world snapshot to buffer of pp_get_snapshot_size bytes. Returns 0 on failure.
+extern int pp_save_memory( void * buffer, int size );
+//! Load world snapshot from memory, e.g. memory mapped snapshot file. Returns 0 on failure.
+extern int pp_load_memory( const void * buffer, int size );
+//! Restore world state of 'frames' updates ago from rewind history, see PPConfiguration::history_memory. Updates after
+//! it are forgotten. Returns number of frames actually rewound, which is limited by pp_get_history_frames.
+extern int pp_rewind( int frames );
+//! Get number of frames rewind history can restore.
+extern int pp_get_history_frames( );
+//! Get cross-check results. Returns NULL if cross-check mode is disabled.
+extern const struct PPCrossCheckReport * pp_get_cross_check_report( );
+//! Enable or disable collection of update statistics. Enabled by default, collection costs a few timer reads per update.
+extern void pp_enable_stats( int enable );
+//! Get statistics of the last update. Returns NULL if statistics are disabled or compiled out with POWDER_NO_STATS.
+extern const struct PPStats * pp_get_stats( );
+//! Start recording timeline of updates: phases of pp_update and jobs of worker threads. Events are kept in ring buffers
+//! of 'memory' bytes in total, the oldest ones are overwritten. Returns 0 on failure.
+extern int pp_trace_start( int memory );
+//! Stop recording timeline, recorded events are kept until the next pp_trace_start.
+extern void pp_trace_stop( );
+//! Save recorded timeline in Chrome trace JSON format, which chrome://tracing and Perfetto open. Returns 0 on failure.
+extern int pp_trace_save( const char * path );
+
+//! Get fraction of PPConfiguration::fixed_step accumulated by pp_update, but not simulated yet. Rendering can use it as
+//! alpha of pp_export_positions to move smoothly between steps. Returns 1 without fixed step.
+extern float pp_get_step_alpha( );
 
 //! Get alive particles count.
 extern int pp_get_alive_particles_count( );
+//! Get indices of alive particles, pp_get_alive_particles_count entries in no particular order (read only). Iterating it
+//! visits exactly the alive particles of streams without scanning dead slots. Valid until the next update, edit or
+//! compaction.
+extern const int * pp_get_alive_particles( );
 //! Get raw particles info stream (read only).
 extern const struct PPParticleInfo * pp_get_particles_info_stream( );
 //! Get raw particles current physical info stream (read only).
@@ -42,9 +123,22 @@ extern int pp_find_particle_type( const char * name );
 
 //! Spawn particle at specific position.
 extern void pp_particle_spawn_at( int x, int y, unsigned int type );
+//! Spawn particles of type into empty cells of rectangle [x, x + width) x [y, y + height). Bulk spawns skip the world
+//! border, where particles are killed, and stop when particle storage is full. Returns number of spawned particles.
+extern int pp_particle_spawn_rect( int x, int y, int width, int height, unsigned int type );
+//! Spawn particles of type into empty cells of circle. Returns number of spawned particles.
+extern int pp_particle_spawn_circle( int x, int y, int radius, unsigned int type );
+//! Spawn particles from width x height mask placed at (x, y). Mask holds particle types with given row stride in bytes,
+//! 0 is empty. Returns number of spawned particles.
+extern int pp_particle_spawn_mask( int x, int y, int width, int height, const unsigned char * types, int stride );
+//! Spawn particles from array of records. Returns number of spawned particles.
+extern int pp_particle_spawn_records( const struct PPSpawnRecord * records, int count );
 
 //! Insert collision at specific position.
 extern void pp_collision_set( int x, int y, unsigned int collision_type );
+//! Set collisions of width x height rectangle at (x, y) from bitmap of collision types with given row stride in bytes.
+//! 0 removes collision. Cells occupied by particles are left alone. Returns number of changed cells.
+extern int pp_collision_import( int x, int y, int width, int height, const unsigned char * types, int stride );
 
 
 
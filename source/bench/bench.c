@@ -0,0 +1,486 @@
+#include "api.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#endif
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+
+
+// Benchmark of canonical scenarios. Every case is a scenario at one world size and air grid size. The world is
+// simulated for warm-up frames first, then measured frames are timed one by one. Phase times come from pp_get_stats, if
+// statistics are compiled out, air phase is estimated by running the same world without particles and the rest of a step
+// is particle phase. Results are printed as a table, CSV or JSON lines, one object per case, to be collected by
+// regression tracking.
+
+#define BENCH_DT 166				//!< Step time, 60 steps per second.
+#define BENCH_MAX_SIZES 8
+#define BENCH_TRACE_MEMORY ( 16 << 20 )	//!< Ring buffers of --trace.
+
+
+
+enum PPBenchFormat
+{
+	BENCH_TEXT,
+	BENCH_CSV,
+	BENCH_JSON,
+};
+
+//! Scenario of benchmark. Setup and step functions skip spawning particles when 'particles' is 0.
+struct PPBenchScenario
+{
+	const char * name;
+	int warmup;		//!< Frames simulated before measurement.
+	void ( * setup )( const struct PPConfiguration * c, int particles );
+	void ( * step )( const struct PPConfiguration * c, int frame, int particles );	//!< Input of every frame, may be NULL.
+};
+
+//! Benchmark options.
+struct PPBenchOptions
+{
+	int format;
+	int frames;
+	int solver;
+	int threads;
+	int chunk_size;
+	int heat_grid;
+	float cfl;
+	int fixed_step;
+	const char * scenario;				//!< Run only scenario with this name if not NULL.
+	const char * trace;					//!< Save timeline of measured frames here if not NULL.
+	int sizes[ BENCH_MAX_SIZES ];
+	int sizes_count;
+	int grids[ BENCH_MAX_SIZES ];
+	int grids_count;
+};
+
+//! Measurements of one case.
+struct PPBenchResult
+{
+	double step_ms;			//!< Average time of step.
+	double air_ms;			//!< Average time of air phase.
+	double heat_ms;			//!< Average time of heat grid phase.
+	double particle_ms;		//!< Average time of particles phase.
+	double finish_ms;		//!< Average time of sleeping chunks, compaction and change lists.
+	int stats;				//!< Phase times were measured by pp_get_stats.
+	double particles;		//!< Average number of alive particles.
+	double ns_per_particle;	//!< Step time per alive particle.
+	long long memory;		//!< Resident memory taken by the world, -1 if unknown.
+};
+
+
+
+static int sWater;
+static int sSteam;
+static int sWall;
+static unsigned int sBenchRandom;
+
+
+
+
+
+static double now_ms( )
+{
+#ifdef _WIN32
+	LARGE_INTEGER counter, frequency;
+
+	QueryPerformanceCounter( &counter );
+	QueryPerformanceFrequency( &frequency );
+	return ( double ) counter.QuadPart * 1000.0 / ( double ) frequency.QuadPart;
+#else
+	struct timespec t;
+
+	clock_gettime( CLOCK_MONOTONIC, &t );
+	return t.tv_sec * 1000.0 + t.tv_nsec / 1000000.0;
+#endif
+}
+
+static long long resident_memory( )
+{
+#ifdef __linux__
+	FILE * file = fopen( "/proc/self/statm", "r" );
+	long pages = -1, resident = -1;
+
+	if( !file )
+		return -1;
+	if( fscanf( file, "%ld %ld", &pages, &resident ) != 2 )
+		resident = -1;
+	fclose( file );
+
+	return resident < 0 ? -1 : ( long long ) resident * sysconf( _SC_PAGESIZE );
+#else
+	return -1;
+#endif
+}
+
+static unsigned int bench_rand( )
+{
+	sBenchRandom = sBenchRandom * 1664525u + 1013904223u;
+	return sBenchRandom >> 8;
+}
+
+// Fill rectangle with collision type.
+static void wall_rect( int x, int y, int width, int height )
+{
+	unsigned char * types = malloc( width * height );
+
+	if( !types )
+		return;
+
+	memset( types, sWall, width * height );
+	pp_collision_import( x, y, width, height, types, width );
+	free( types );
+}
+
+// Walls along the world border, particles leaving the world are killed.
+static void border_walls( const struct PPConfiguration * c )
+{
+	wall_rect( 4, 4, c->xres - 8, 1 );
+	wall_rect( 4, c->yres - 5, c->xres - 8, 1 );
+	wall_rect( 4, 4, 1, c->yres - 8 );
+	wall_rect( c->xres - 5, 4, 1, c->yres - 8 );
+}
+
+
+
+//
+// scenarios
+//
+
+// Block of water collapsing in a closed box.
+static void dam_setup( const struct PPConfiguration * c, int particles )
+{
+	border_walls( c );
+	if( particles )
+		pp_particle_spawn_rect( 5, c->yres / 5, c->xres * 2 / 5, c->yres - 5 - c->yres / 5, sWater );
+}
+
+// Tall column of steam rising and spreading under the ceiling.
+static void steam_setup( const struct PPConfiguration * c, int particles )
+{
+	border_walls( c );
+	if( particles )
+		pp_particle_spawn_rect( c->xres * 7 / 16, c->yres / 3, c->xres / 8, c->yres - 5 - c->yres / 3, sSteam );
+}
+
+// Water at rest filling the bottom of the box, measures the cost of calm particles.
+static void pool_setup( const struct PPConfiguration * c, int particles )
+{
+	border_walls( c );
+	if( particles )
+		pp_particle_spawn_rect( 5, c->yres * 3 / 5, c->xres - 10, c->yres * 2 / 5 - 5, sWater );
+}
+
+// Shelves with gaps every 16 rows and posts hanging below them, water falls through the maze.
+static void maze_setup( const struct PPConfiguration * c, int particles )
+{
+	int x, y, gap;
+
+	border_walls( c );
+	for( y = 32; y < c->yres - 16; y += 16 )
+	{
+		gap = ( y / 16 * 37 ) % ( c->xres - 32 ) + 8;
+		wall_rect( 5, y, gap - 5, 1 );
+		wall_rect( gap + 6, y, c->xres - 5 - gap - 6, 1 );
+		for( x = 12 + ( y / 16 % 2 ) * 4; x < c->xres - 8; x += 8 )
+			if( x < gap || x > gap + 6 )
+				wall_rect( x, y + 1, 1, 4 );
+	}
+
+	if( particles )
+		pp_particle_spawn_rect( 5, 5, c->xres - 10, 27, sWater );
+}
+
+// Empty world with a few droplets sprayed every frame, they fall out of the world and are killed.
+static void spray_setup( const struct PPConfiguration * c, int particles )
+{
+	( void ) c;
+	( void ) particles;
+
+	sBenchRandom = 12345;
+}
+
+static void spray_step( const struct PPConfiguration * c, int frame, int particles )
+{
+	struct PPSpawnRecord records[ 256 ];
+	int i, count = c->xres / 4 < 256 ? c->xres / 4 : 256;
+	int radius = c->xres / 16;
+
+	( void ) frame;
+
+	if( !particles )
+		return;
+
+	for( i = 0; i < count; i++ )
+	{
+		records[ i ].x = c->xres / 2 + ( int )( bench_rand( ) % ( 2 * radius ) ) - radius;
+		records[ i ].y = c->yres / 8 + ( int )( bench_rand( ) % radius );
+		records[ i ].type = sWater;
+	}
+	pp_particle_spawn_records( records, count );
+}
+
+static const struct PPBenchScenario sScenarios[ ] =
+{
+	{ "dam", 10, dam_setup, NULL },
+	{ "steam", 10, steam_setup, NULL },
+	{ "pool", 60, pool_setup, NULL },
+	{ "maze", 30, maze_setup, NULL },
+	{ "spray", 60, spray_setup, spray_step },
+};
+
+
+
+
+
+// Run scenario for warm-up and measured frames, timeline of measured frames is saved to 'trace' if it's not NULL.
+// Returns average step time or negative value on failure.
+static double run( const struct PPBenchScenario * scenario, const struct PPConfiguration * configuration, int frames,
+	int particles, const char * trace, struct PPBenchResult * result )
+{
+	double total = 0.0, alive = 0.0, air = 0.0, heat = 0.0, part = 0.0, finish = 0.0, start;
+	long long memory = resident_memory( );
+	const struct PPStats * stats = NULL;
+	int f;
+
+	if( !pp_init( configuration ) )
+		return -1.0;
+
+	sWater = pp_find_particle_type( "water" );
+	sSteam = pp_find_particle_type( "steam" );
+	sWall = pp_find_particle_type( "collision" );
+	scenario->setup( configuration, particles );
+
+	for( f = 0; f < scenario->warmup + frames; f++ )
+	{
+		if( scenario->step )
+			scenario->step( configuration, f, particles );
+		if( trace && f == scenario->warmup && !pp_trace_start( BENCH_TRACE_MEMORY ) )
+			trace = NULL;
+
+		start = now_ms( );
+		pp_update( BENCH_DT );
+		if( f >= scenario->warmup )
+		{
+			total += now_ms( ) - start;
+			alive += pp_get_alive_particles_count( );
+
+			stats = pp_get_stats( );
+			if( stats )
+			{
+				air += stats->air_ms;
+				heat += stats->heat_ms;
+				part += stats->particles_ms;
+				finish += stats->finish_ms;
+			}
+		}
+	}
+
+	if( trace && !pp_trace_save( trace ) )
+		fprintf( stderr, "powder-bench: can't save trace to %s\n", trace );
+
+	if( result )
+	{
+		result->stats = stats != NULL;
+		result->air_ms = air / frames;
+		result->heat_ms = heat / frames;
+		result->particle_ms = part / frames;
+		result->finish_ms = finish / frames;
+		result->particles = alive / frames;
+		result->memory = memory < 0 ? -1 : resident_memory( ) - memory;
+	}
+
+	pp_deinit( );
+	return total / frames;
+}
+
+static void print_header( const struct PPBenchOptions * options )
+{
+	if( options->format == BENCH_CSV )
+		printf( "scenario,xres,yres,grid,solver,threads,frames,particles,step_ms,ns_per_particle,air_ms,heat_ms,particle_ms,finish_ms,memory_bytes\n" );
+	else if( options->format == BENCH_TEXT )
+		printf( "%-8s %5s %5s %4s %7s %12s %10s %10s %10s %10s %8s\n",
+			"scenario", "xres", "yres", "grid", "frames", "particles", "step ms", "ns/p/step", "air ms", "part ms", "mem MB" );
+}
+
+static void print_result( const struct PPBenchOptions * options, const char * name, const struct PPConfiguration * c,
+	const struct PPBenchResult * r )
+{
+	switch( options->format )
+	{
+	case BENCH_CSV:
+		printf( "%s,%d,%d,%d,%d,%d,%d,%.0f,%.4f,%.3f,%.4f,%.4f,%.4f,%.4f,%lld\n", name, c->xres, c->yres, c->grid_size,
+			c->solver, c->threads, options->frames, r->particles, r->step_ms, r->ns_per_particle, r->air_ms, r->heat_ms,
+			r->particle_ms, r->finish_ms, r->memory );
+		break;
+	case BENCH_JSON:
+		printf( "{\"scenario\":\"%s\",\"xres\":%d,\"yres\":%d,\"grid\":%d,\"solver\":%d,\"threads\":%d,\"frames\":%d,"
+			"\"particles\":%.0f,\"step_ms\":%.4f,\"ns_per_particle\":%.3f,\"air_ms\":%.4f,\"heat_ms\":%.4f,"
+			"\"particle_ms\":%.4f,\"finish_ms\":%.4f,\"memory_bytes\":%lld}\n",
+			name, c->xres, c->yres, c->grid_size, c->solver, c->threads, options->frames, r->particles, r->step_ms,
+			r->ns_per_particle, r->air_ms, r->heat_ms, r->particle_ms, r->finish_ms, r->memory );
+		break;
+	default:
+		printf( "%-8s %5d %5d %4d %7d %12.0f %10.3f %10.2f %10.3f %10.3f %8.1f\n", name, c->xres, c->yres, c->grid_size,
+			options->frames, r->particles, r->step_ms, r->ns_per_particle, r->air_ms, r->particle_ms, r->memory / ( 1024.0 * 1024.0 ) );
+		break;
+	}
+	fflush( stdout );
+}
+
+static int parse_list( const char * text, int * values, int max_count )
+{
+	int count = 0;
+
+	while( *text && count < max_count )
+	{
+		values[ count++ ] = atoi( text );
+		while( *text && *text != ',' )
+			text++;
+		if( *text == ',' )
+			text++;
+	}
+
+	return count;
+}
+
+static void usage( )
+{
+	printf( "Usage: powder-bench [options]\n"
+		"  --format text|csv|json  output format, json prints one object per line (default text)\n"
+		"  --scenario NAME         run only one of dam, steam, pool, maze, spray\n"
+		"  --sizes N,N,...         square world sizes (default 256,512,1024)\n"
+		"  --grids N,N,...         air grid sizes (default 4,8)\n"
+		"  --frames N              measured frames per case (default 100)\n"
+		"  --quick                 sizes 256,512 and 30 frames\n"
+		"  --solver N              one of PPSolverType (default 0, auto)\n"
+		"  --threads N             particle threads, negative uses all hardware threads (default 1)\n"
+		"  --chunk N               size of sleeping chunks, 0 disables sleeping (default 0)\n"
+		"  --heat-grid             enable heat grid\n"
+		"  --cfl X                 split steps into substeps moving particles by at most X pixels (default 0, off)\n"
+		"  --fixed-step N          simulate in fixed steps of N time units (default 0, off)\n"
+		"  --trace PATH            save Chrome trace of measured frames, the last case overwrites previous ones\n" );
+}
+
+int main( int argc, char ** argv )
+{
+	struct PPBenchOptions options;
+	struct PPConfiguration configuration;
+	struct PPBenchResult result;
+	const struct PPBenchScenario * scenario;
+	int i, s, g, k, failed = 0;
+
+	memset( &options, 0, sizeof( options ) );
+	options.format = BENCH_TEXT;
+	options.frames = 100;
+	options.threads = 1;
+	options.sizes_count = parse_list( "256,512,1024", options.sizes, BENCH_MAX_SIZES );
+	options.grids_count = parse_list( "4,8", options.grids, BENCH_MAX_SIZES );
+
+	for( i = 1; i < argc; i++ )
+	{
+		if( !strcmp( argv[ i ], "--quick" ) )
+		{
+			options.sizes_count = parse_list( "256,512", options.sizes, BENCH_MAX_SIZES );
+			options.frames = 30;
+		}
+		else if( !strcmp( argv[ i ], "--heat-grid" ) )
+			options.heat_grid = 1;
+		else if( i + 1 < argc && !strcmp( argv[ i ], "--format" ) )
+		{
+			i++;
+			options.format = !strcmp( argv[ i ], "csv" ) ? BENCH_CSV : !strcmp( argv[ i ], "json" ) ? BENCH_JSON : BENCH_TEXT;
+		}
+		else if( i + 1 < argc && !strcmp( argv[ i ], "--scenario" ) )
+			options.scenario = argv[ ++i ];
+		else if( i + 1 < argc && !strcmp( argv[ i ], "--trace" ) )
+			options.trace = argv[ ++i ];
+		else if( i + 1 < argc && !strcmp( argv[ i ], "--sizes" ) )
+			options.sizes_count = parse_list( argv[ ++i ], options.sizes, BENCH_MAX_SIZES );
+		else if( i + 1 < argc && !strcmp( argv[ i ], "--grids" ) )
+			options.grids_count = parse_list( argv[ ++i ], options.grids, BENCH_MAX_SIZES );
+		else if( i + 1 < argc && !strcmp( argv[ i ], "--frames" ) )
+			options.frames = atoi( argv[ ++i ] );
+		else if( i + 1 < argc && !strcmp( argv[ i ], "--solver" ) )
+			options.solver = atoi( argv[ ++i ] );
+		else if( i + 1 < argc && !strcmp( argv[ i ], "--threads" ) )
+			options.threads = atoi( argv[ ++i ] );
+		else if( i + 1 < argc && !strcmp( argv[ i ], "--chunk" ) )
+			options.chunk_size = atoi( argv[ ++i ] );
+		else if( i + 1 < argc && !strcmp( argv[ i ], "--cfl" ) )
+			options.cfl = ( float ) atof( argv[ ++i ] );
+		else if( i + 1 < argc && !strcmp( argv[ i ], "--fixed-step" ) )
+			options.fixed_step = atoi( argv[ ++i ] );
+		else
+		{
+			usage( );
+			return !strcmp( argv[ i ], "--help" ) ? 0 : 1;
+		}
+	}
+
+	if( options.frames < 1 )
+		options.frames = 1;
+
+#ifdef __GLIBC__
+	// large buffers are always mapped and returned on free, so resident memory of a case is not reused by the next one
+	mallopt( M_MMAP_THRESHOLD, 64 * 1024 );
+#endif
+
+	print_header( &options );
+
+	for( k = 0; k < ( int )( sizeof( sScenarios ) / sizeof( sScenarios[ 0 ] ) ); k++ )
+	{
+		scenario = sScenarios + k;
+		if( options.scenario && strcmp( options.scenario, scenario->name ) )
+			continue;
+
+		for( s = 0; s < options.sizes_count; s++ )
+			for( g = 0; g < options.grids_count; g++ )
+			{
+				memset( &configuration, 0, sizeof( configuration ) );
+				configuration.xres = options.sizes[ s ];
+				configuration.yres = options.sizes[ s ];
+				configuration.grid_size = options.grids[ g ];
+				configuration.solver = options.solver;
+				configuration.threads = options.threads;
+				configuration.chunk_size = options.chunk_size;
+				configuration.heat_grid = options.heat_grid;
+				configuration.cfl = options.cfl;
+				configuration.fixed_step = options.fixed_step;
+
+				if( configuration.grid_size <= 0 || configuration.xres % configuration.grid_size )
+					continue;
+
+				memset( &result, 0, sizeof( result ) );
+				result.step_ms = run( scenario, &configuration, options.frames, 1, options.trace, &result );
+				if( result.step_ms >= 0.0 && !result.stats )
+				{
+					result.air_ms = run( scenario, &configuration, options.frames, 0, NULL, NULL );
+					result.particle_ms = result.step_ms > result.air_ms ? result.step_ms - result.air_ms : 0.0;
+				}
+				if( result.air_ms < 0.0 || result.step_ms < 0.0 )
+				{
+					fprintf( stderr, "powder-bench: %s %dx%d grid %d failed to initialize\n", scenario->name,
+						configuration.xres, configuration.yres, configuration.grid_size );
+					failed = 1;
+					continue;
+				}
+
+				result.ns_per_particle = result.particles > 0.0 ? result.step_ms * 1000000.0 / result.particles : 0.0;
+				print_result( &options, scenario->name, &configuration, &result );
+			}
+	}
+
+	return failed;
+}
@@ -12,5 +12,6 @@ spParticleTypes[i].move_type = MT_LIQUID;
 spParticleTypes[i].collision = 0.0f;
 spParticleTypes[i].initial_temp = 20.0;
 spParticleTypes[i].diffusion = 0.0;
+spParticleTypes[i].color = 0xffd08020;
 
 i++;
\ No newline at end of file
@@ -12,5 +12,6 @@ spParticleTypes[i].move_type = MT_NORMAL;
 spParticleTypes[i].collision = -0.9f;
 spParticleTypes[i].initial_temp = 120.0f;
 spParticleTypes[i].diffusion = 100.0f;
+spParticleTypes[i].color = 0xc0e0e0e0;
 
 i++;
\ No newline at end of file
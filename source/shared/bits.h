@@ -0,0 +1,47 @@
+#ifndef __POWDER_BITS_H__
+#define __POWDER_BITS_H__
+
+
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+
+
+//! Index of the lowest set bit. 'x' must not be zero.
+static __inline int bits_ctz( unsigned int x )
+{
+#ifdef _MSC_VER
+	unsigned long i;
+
+	_BitScanForward( &i, x );
+	return ( int ) i;
+#else
+	return __builtin_ctz( x );
+#endif
+}
+
+//! Index of the highest set bit. 'x' must not be zero.
+static __inline int bits_highest( unsigned int x )
+{
+#ifdef _MSC_VER
+	unsigned long i;
+
+	_BitScanReverse( &i, x );
+	return ( int ) i;
+#else
+	return 31 - __builtin_clz( x );
+#endif
+}
+
+//! Number of set bits.
+static __inline int bits_count( unsigned int x )
+{
+	x = x - ( ( x >> 1 ) & 0x55555555u );
+	x = ( x & 0x33333333u ) + ( ( x >> 2 ) & 0x33333333u );
+	return ( int ) ( ( ( ( x + ( x >> 4 ) ) & 0x0F0F0F0Fu ) * 0x01010101u ) >> 24 );
+}
+
+
+#endif // __POWDER_BITS_H__
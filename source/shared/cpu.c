@@ -0,0 +1,50 @@
+#include "pch.h"
+#include "cpu.h"
+
+#ifdef CPU_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+
+
+int cpu_has_sse2( )
+{
+#if defined( _M_X64 ) || defined( __x86_64__ )
+	return 1;
+#elif defined( _MSC_VER )
+	int info[ 4 ];
+
+	__cpuid( info, 1 );
+	return ( info[ 3 ] & ( 1 << 26 ) ) != 0;
+#else
+	__builtin_cpu_init( );
+	return __builtin_cpu_supports( "sse2" );
+#endif
+}
+
+int cpu_has_avx2( )
+{
+#ifdef _MSC_VER
+	int info[ 4 ];
+
+	__cpuid( info, 0 );
+	if( info[ 0 ] < 7 )
+		return 0;
+
+	// AVX and OSXSAVE, then OS support of YMM state
+	__cpuid( info, 1 );
+	if( ( info[ 2 ] & ( 1 << 27 ) ) == 0 || ( info[ 2 ] & ( 1 << 28 ) ) == 0 )
+		return 0;
+	if( ( _xgetbv( 0 ) & 6 ) != 6 )
+		return 0;
+
+	__cpuidex( info, 7, 0 );
+	return ( info[ 1 ] & ( 1 << 5 ) ) != 0;
+#else
+	__builtin_cpu_init( );
+	return __builtin_cpu_supports( "avx2" );
+#endif
+}
+
+#endif // CPU_X86
\ No newline at end of file
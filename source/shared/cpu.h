@@ -0,0 +1,32 @@
+#ifndef __POWDER_CPU_H__
+#define __POWDER_CPU_H__
+
+
+
+// Kernels for instruction sets above the compiler baseline are compiled with
+// CPU_TARGET_* attributes and selected at run time by cpu_has_* checks.
+
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __x86_64__ ) || defined( __i386__ )
+#define CPU_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define CPU_TARGET_SSE2
+#define CPU_TARGET_AVX2
+#else
+#define CPU_TARGET_SSE2 __attribute__(( target( "sse2" ) ))
+#define CPU_TARGET_AVX2 __attribute__(( target( "avx2" ) ))
+#endif
+#endif
+
+
+
+#ifdef CPU_X86
+//! Does CPU support SSE2?
+int cpu_has_sse2( );
+//! Does CPU and OS support AVX2?
+int cpu_has_avx2( );
+#endif
+
+
+#endif // __POWDER_CPU_H__
@@ -0,0 +1,63 @@
+#ifndef __POWDER_RANDOM_H__
+#define __POWDER_RANDOM_H__
+
+
+
+// Counter based random generator (Philox4x32-10). Every call maps a key and a counter
+// to four independent random words, so there is no generator state to share or lock:
+// any thread may draw numbers for any particle in any order and get the same results.
+// The function has no branches or table lookups and vectorizes when called in a loop.
+
+
+
+#ifdef _MSC_VER
+typedef unsigned __int64 pp_uint64_t;
+#else
+typedef unsigned long long pp_uint64_t;
+#endif
+
+
+
+static __inline void random_philox_round( unsigned int * c, const unsigned int * k )
+{
+	pp_uint64_t p0 = ( pp_uint64_t ) 0xD2511F53u * c[ 0 ];
+	pp_uint64_t p1 = ( pp_uint64_t ) 0xCD9E8D57u * c[ 2 ];
+	unsigned int c0, c2;
+
+	c0 = ( unsigned int ) ( p1 >> 32 ) ^ c[ 1 ] ^ k[ 0 ];
+	c2 = ( unsigned int ) ( p0 >> 32 ) ^ c[ 3 ] ^ k[ 1 ];
+	c[ 1 ] = ( unsigned int ) p1;
+	c[ 3 ] = ( unsigned int ) p0;
+	c[ 0 ] = c0;
+	c[ 2 ] = c2;
+}
+
+//! Generate four random words 'out' for 'counter' and 'key'.
+static __inline void random_philox( const unsigned int * counter, const unsigned int * key, unsigned int * out )
+{
+	unsigned int k[ 2 ];
+	int i;
+
+	out[ 0 ] = counter[ 0 ];
+	out[ 1 ] = counter[ 1 ];
+	out[ 2 ] = counter[ 2 ];
+	out[ 3 ] = counter[ 3 ];
+	k[ 0 ] = key[ 0 ];
+	k[ 1 ] = key[ 1 ];
+
+	for( i = 0; i < 10; i++ )
+	{
+		random_philox_round( out, k );
+		k[ 0 ] += 0x9E3779B9u;
+		k[ 1 ] += 0xBB67AE85u;
+	}
+}
+
+//! Convert random word to float in [0, 1].
+static __inline float random_to_float( unsigned int r )
+{
+	return ( float ) ( r >> 8 ) / ( float ) 0xffffff;
+}
+
+
+#endif // __POWDER_RANDOM_H__
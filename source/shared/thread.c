@@ -0,0 +1,194 @@
+#include "pch.h"
+#include "thread.h"
+#include "utils.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+
+
+//! Thread start parameters, owned by started thread.
+struct PPThreadStart
+{
+	PPThreadFn fn;
+	void * user;
+};
+
+
+
+#ifdef _WIN32
+
+static DWORD WINAPI thread_entry( LPVOID param )
+{
+	struct PPThreadStart start = *( struct PPThreadStart * ) param;
+
+	free( param );
+	start.fn( start.user );
+	return 0;
+}
+
+int thread_create( pp_thread_t * thread, PPThreadFn fn, void * user )
+{
+	struct PPThreadStart * start = malloc_log( sizeof( struct PPThreadStart ) );
+	if( !start )
+		return 0;
+
+	start->fn = fn;
+	start->user = user;
+
+	*thread = CreateThread( NULL, 0, thread_entry, start, 0, NULL );
+	if( !*thread )
+	{
+		free( start );
+		return 0;
+	}
+
+	return 1;
+}
+
+void thread_join( pp_thread_t thread )
+{
+	WaitForSingleObject( thread, INFINITE );
+	CloseHandle( thread );
+}
+
+int thread_hardware_concurrency( )
+{
+	SYSTEM_INFO info;
+
+	GetSystemInfo( &info );
+	return ( int ) info.dwNumberOfProcessors;
+}
+
+void mutex_init( pp_mutex_t * mutex )
+{
+	InitializeCriticalSection( mutex );
+}
+
+void mutex_destroy( pp_mutex_t * mutex )
+{
+	DeleteCriticalSection( mutex );
+}
+
+void mutex_lock( pp_mutex_t * mutex )
+{
+	EnterCriticalSection( mutex );
+}
+
+void mutex_unlock( pp_mutex_t * mutex )
+{
+	LeaveCriticalSection( mutex );
+}
+
+void cond_init( pp_cond_t * cond )
+{
+	InitializeConditionVariable( cond );
+}
+
+void cond_destroy( pp_cond_t * cond )
+{
+	cond;
+}
+
+void cond_wait( pp_cond_t * cond, pp_mutex_t * mutex )
+{
+	SleepConditionVariableCS( cond, mutex, INFINITE );
+}
+
+void cond_signal( pp_cond_t * cond )
+{
+	WakeConditionVariable( cond );
+}
+
+void cond_broadcast( pp_cond_t * cond )
+{
+	WakeAllConditionVariable( cond );
+}
+
+#else
+
+static void * thread_entry( void * param )
+{
+	struct PPThreadStart start = *( struct PPThreadStart * ) param;
+
+	free( param );
+	start.fn( start.user );
+	return NULL;
+}
+
+int thread_create( pp_thread_t * thread, PPThreadFn fn, void * user )
+{
+	struct PPThreadStart * start = malloc_log( sizeof( struct PPThreadStart ) );
+	if( !start )
+		return 0;
+
+	start->fn = fn;
+	start->user = user;
+
+	if( pthread_create( thread, NULL, thread_entry, start ) != 0 )
+	{
+		free( start );
+		return 0;
+	}
+
+	return 1;
+}
+
+void thread_join( pp_thread_t thread )
+{
+	pthread_join( thread, NULL );
+}
+
+int thread_hardware_concurrency( )
+{
+	long res = sysconf( _SC_NPROCESSORS_ONLN );
+	return res > 0 ? ( int ) res : 1;
+}
+
+void mutex_init( pp_mutex_t * mutex )
+{
+	pthread_mutex_init( mutex, NULL );
+}
+
+void mutex_destroy( pp_mutex_t * mutex )
+{
+	pthread_mutex_destroy( mutex );
+}
+
+void mutex_lock( pp_mutex_t * mutex )
+{
+	pthread_mutex_lock( mutex );
+}
+
+void mutex_unlock( pp_mutex_t * mutex )
+{
+	pthread_mutex_unlock( mutex );
+}
+
+void cond_init( pp_cond_t * cond )
+{
+	pthread_cond_init( cond, NULL );
+}
+
+void cond_destroy( pp_cond_t * cond )
+{
+	pthread_cond_destroy( cond );
+}
+
+void cond_wait( pp_cond_t * cond, pp_mutex_t * mutex )
+{
+	pthread_cond_wait( cond, mutex );
+}
+
+void cond_signal( pp_cond_t * cond )
+{
+	pthread_cond_signal( cond );
+}
+
+void cond_broadcast( pp_cond_t * cond )
+{
+	pthread_cond_broadcast( cond );
+}
+
+#endif
\ No newline at end of file
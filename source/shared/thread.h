@@ -0,0 +1,50 @@
+#ifndef __POWDER_THREAD_H__
+#define __POWDER_THREAD_H__
+
+
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+
+typedef HANDLE pp_thread_t;
+typedef CRITICAL_SECTION pp_mutex_t;
+typedef CONDITION_VARIABLE pp_cond_t;
+#else
+#include <pthread.h>
+
+typedef pthread_t pp_thread_t;
+typedef pthread_mutex_t pp_mutex_t;
+typedef pthread_cond_t pp_cond_t;
+#endif
+
+
+
+//! Thread entry point.
+typedef void (* PPThreadFn) ( void * user );
+
+
+
+//! Start new thread. Returns 0 on failure.
+int thread_create( pp_thread_t * thread, PPThreadFn fn, void * user );
+//! Wait for thread to finish.
+void thread_join( pp_thread_t thread );
+//! Number of hardware threads available to the process.
+int thread_hardware_concurrency( );
+
+void mutex_init( pp_mutex_t * mutex );
+void mutex_destroy( pp_mutex_t * mutex );
+void mutex_lock( pp_mutex_t * mutex );
+void mutex_unlock( pp_mutex_t * mutex );
+
+void cond_init( pp_cond_t * cond );
+void cond_destroy( pp_cond_t * cond );
+//! Wait for condition, mutex must be locked by caller.
+void cond_wait( pp_cond_t * cond, pp_mutex_t * mutex );
+void cond_signal( pp_cond_t * cond );
+void cond_broadcast( pp_cond_t * cond );
+
+
+#endif // __POWDER_THREAD_H__
\ No newline at end of file
@@ -0,0 +1,43 @@
+#include "pch.h"
+#include "timer.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+
+
+#ifdef _WIN32
+
+double timer_ms( )
+{
+	static double ms_per_tick = 0.0;
+	LARGE_INTEGER counter, frequency;
+
+	// frequency is fixed at boot, it is queried once
+	if( ms_per_tick == 0.0 )
+	{
+		QueryPerformanceFrequency( &frequency );
+		ms_per_tick = 1000.0 / ( double ) frequency.QuadPart;
+	}
+
+	QueryPerformanceCounter( &counter );
+	return ( double ) counter.QuadPart * ms_per_tick;
+}
+
+#else
+
+double timer_ms( )
+{
+	struct timespec t;
+
+	clock_gettime( CLOCK_MONOTONIC, &t );
+	return ( double ) t.tv_sec * 1000.0 + ( double ) t.tv_nsec / 1000000.0;
+}
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef __POWDER_TIMER_H__
+#define __POWDER_TIMER_H__
+
+
+
+
+//! Monotonic wall clock time in milliseconds from an arbitrary point.
+double timer_ms( );
+
+
+#endif // __POWDER_TIMER_H__
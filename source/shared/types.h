@@ -27,18 +27,75 @@ typedef int pp_time_t;
 
 
 
+//! Solver backends
+enum PPSolverType
+{
+	SOLVER_AUTO,		//!< Selected by number of threads.
+	SOLVER_CPU_ST,		//!< Single threaded CPU solver.
+	SOLVER_CPU_MT,		//!< Multithreaded CPU solver.
+};
+
+//! Raster formats of pp_render
+enum PPRenderFormat
+{
+	RENDER_RGBA8,			//!< 4 bytes per pixel: PPParticleType::color of cell type, empty cells are transparent black.
+	RENDER_TYPE8,			//!< 1 byte per pixel: particle or collision type, 0 for empty cells.
+	RENDER_TEMPERATURE16F,	//!< 2 bytes per pixel: temperature as half float, 0 for empty cells.
+	RENDER_PRESSURE16F,		//!< 2 bytes per pixel: pressure of air cell as half float.
+};
+
+//! Record formats of pp_export_positions
+enum PPPositionFormat
+{
+	POSITION_FLOAT2,		//!< 8 bytes: x, y as floats.
+	POSITION_FLOAT3,		//!< 12 bytes: x, y and temperature as floats.
+	POSITION_FIXED16,		//!< 4 bytes: x, y as unsigned 12.4 fixed point, i.e. 1/16 of pixel.
+};
+
+
+
 //! Configuration of the World
 struct PPConfiguration
 {
 	int xres;		//!< X resolution. Total number of particles is xres * yres.
 	int yres;		//!< Y resolution. Total number of particles is xres * yres.
 	int grid_size;	//!< Size of one cell. Actual grid resolution is (xres / grid_size) x (yres / grid_size).
+	int threads;	//!< Number of threads for particles update. With SOLVER_AUTO, 0 or 1 selects single threaded solver. Negative value uses all hardware threads.
+	int solver;		//!< Solver backend, one of PPSolverType.
+	int reference_solver;	//!< If not SOLVER_AUTO, every frame is cross-checked against this solver. Slow, for validation only. States are compared byte by byte, which only solvers processing particles in the same order pass: cpu_mt resolves moves band by band and sums air in a different order, so it differs from cpu_st at the first frame. Such pairs need cross_check_tolerance.
+	int air_threads;	//!< Number of threads for air update. 0 uses the same number as for particles. Negative value uses all hardware threads.
+	int air_tile_size;	//!< Size of air update tile in air cells. 0 selects default size.
+	int chunk_size;		//!< Size of sleeping chunk in pixels. Particles of chunks where nothing happens are not updated. 0 disables sleeping.
+	int heat_grid;		//!< Keep temperature in a dense grid updated by a separate stencil pass instead of gathering it from neighbour particles. Faster for heat conducting scenes.
+	unsigned int seed;	//!< Seed of random generator. Runs with the same seed, configuration and inputs are reproducible.
+	float compact_threshold;	//!< Particles are compacted automatically when fragmentation of particle streams grows by this value since the last compaction. Fragmentation is a fraction of neighbour slots, which are dead or far from each other in space, from 0 to 1. 0 disables automatic compaction.
+	int history_memory;	//!< Memory budget of rewind history in bytes. Every frame is recorded as a compressed difference with the previous one, so pp_rewind can restore recent frames. Budget includes a copy of state and scratch of about state size, and must leave room for at least one frame with all of state changed, otherwise pp_init fails. 0 disables history.
+	int history_keyframe;	//!< Number of frames between full keyframes of rewind history. Keyframes make rewinding far back cheaper at cost of memory. 0 disables keyframes.
+	int change_lists;	//!< Record lists of particles and map cells changed by every frame, see pp_get_changes.
+	float cfl;			//!< Adaptive substepping: pp_update splits its time into substeps, so the fastest particle or air cell of the previous substep would move at most this many pixels in one substep. 1 is a reasonable value. 0 disables substepping.
+	pp_time_t fixed_step;	//!< If not 0, pp_update accumulates its time and simulates it in steps of exactly this length, the rest is carried over to the next call, see pp_get_step_alpha.
+	int max_substeps;	//!< Maximal number of steps of one pp_update with cfl or fixed_step. Time, which doesn't fit, is dropped, so an update after a stall costs a bounded time. 0 selects the default of 8.
+	float cross_check_tolerance;	//!< If not 0, cross-check compares equivalence instead of bytes. Within this fraction must match: counts of alive particles of every type, particles in every 16x16 pixels block, sums of positions of every type relative to distance moved in the frame, and totals of temperatures, air and heat relative to their magnitude. In bench scenes cpu_mt against cpu_st stays below 0.22 for positions and 0.05 for the rest, so 0.3 is enough; a skipped move pass exceeds it at the first frame with moving particles.
 
 	PPLogFn	log_fn;	//!< Log function. If NULL, logging is disabled.
 };
 
 
 
+//! Result of cross-check mode.
+struct PPCrossCheckReport
+{
+	int frames;				//!< Number of cross-checked frames.
+	int diverged;			//!< Non zero if solvers have diverged.
+	int frame;				//!< Frame of the first divergence.
+	const char * section;	//!< Name of state section where the first divergence was found, or name of total with cross_check_tolerance.
+	int index;				//!< Index of the first different element in section, particle type of "type_count" and "position" totals, the most different block of "occupancy" total.
+	int x;					//!< X coordinate of the element for grid sections or of the block corner for "occupancy" total, -1 otherwise.
+	int y;					//!< Y coordinate of the element for grid sections or of the block corner for "occupancy" total, -1 otherwise.
+};
+
+
+
 //! Physic constants
 struct PPConstants
 {
@@ -46,6 +103,10 @@ struct PPConstants
 	float v_loss;			//!< Velocity loss per second. Default is 0.999f.
 	float p_hstep;			//!< Pressure half dependency of velocity gradient per second. Default is 0.15f.
 	float v_hstep;			//!< Velocity half dependency of velocity gradient per second. Default is 0.2f.
+	float sleep_temp;		//!< Temperature change per second, below which particle is in heat equilibrium. Default is 0.5f.
+	float sleep_delay;		//!< Time in seconds chunk has to stay calm to fall asleep. Default is 0.5f.
+	float wake_pressure;	//!< Air pressure change per second, which wakes sleeping chunk. Default is 5.0f.
+	float wake_air_velocity;	//!< Air velocity change per second, which wakes sleeping chunk. Default is 5.0f.
 };
 
 
@@ -74,6 +135,80 @@ struct PPParticlePhysInfo
 	float temp;				//!< Temperature.
 };
 
+//! Particle to spawn, see pp_particle_spawn_records.
+struct PPSpawnRecord
+{
+	int x;
+	int y;
+	unsigned int type;
+};
+
+//! Particle change, see pp_get_changes.
+struct PPParticleChange
+{
+	unsigned int index;		//!< Particle index.
+	int x0;					//!< Old map cell, -1 for spawned particle.
+	int y0;
+	int x1;					//!< New map cell, -1 for killed particle.
+	int y1;
+};
+
+//! Map cell change, see pp_get_changes.
+struct PPCellChange
+{
+	int x;
+	int y;
+	unsigned int type;		//!< Current type of particle or collision in cell, 0 if cell is empty.
+	int index;				//!< Current index of particle in cell, -1 if cell is empty or holds collision.
+};
+
+//! Changes of the world since the previous update.
+struct PPChanges
+{
+	const struct PPParticleChange * particles;	//!< Particles spawned, killed and moved to another cell, in order of changes.
+	int particles_count;
+	const struct PPCellChange * cells;			//!< Distinct map cells touched by particle changes and collision edits.
+	int cells_count;
+	int overflow;		//!< Particle list is incomplete, consumer has to rescan the world.
+	int compacted;		//!< Particles were compacted: indices of particles list are not valid anymore, cells have the current ones.
+	int reloaded;		//!< World state was replaced, e.g. by pp_load or pp_rewind, consumer has to rescan the world.
+};
+
+//! Instrumentation of the last update, see pp_get_stats. Times are wall clock milliseconds.
+struct PPStats
+{
+	int frame;				//!< Number of updates measured since statistics were enabled.
+	int steps;				//!< Solver steps run by the update, see PPConfiguration::cfl and fixed_step.
+	float update_ms;		//!< The whole pp_update, or all calls of pp_update_budgeted, which made the frame.
+	float air_ms;			//!< Air velocity and pressure update.
+	float heat_ms;			//!< Heat grid update.
+	float particles_ms;		//!< Particles update.
+	float finish_ms;		//!< Sleeping chunks, compaction and change lists.
+	float history_ms;		//!< Recording of rewind history.
+	int particles;			//!< Particles updated, i.e. not sleeping.
+	int blocked;			//!< Particles blocked by 8 neighbours, only their heat was updated.
+	int stagnant;			//!< Particles stagnant after position update, blocked ones are not included.
+	int trace_steps;		//!< Steps of particle movement traced cell by cell.
+	int liquid_search;		//!< Iterations of liquid spreading search.
+	int moves;				//!< Attempts to move particle aside when its way is blocked.
+	int moves_failed;		//!< Attempts to move aside, which found no free cell.
+	int spawned;			//!< Particles spawned, including spawns since the previous update.
+	int killed;				//!< Particles killed, including kills since the previous update.
+};
+
+//! Completed frame published by pp_update_budgeted or pp_update_async, see pp_get_frame. Particle streams are copied up to
+//! the highest alive index, so alive particle k of the frame is index[ k ] in them, e.g. phys[ index[ k ] ].
+struct PPFrame
+{
+	int frame;			//!< Number of frames published since initialization.
+	int count;			//!< Number of alive particles.
+	const int * index;	//!< Indices of alive particles in the order of pp_get_alive_particles at the time of publication.
+	const struct PPParticleInfo * info;
+	const struct PPParticlePhysInfo * phys;			//!< Current physical info.
+	const struct PPParticlePhysInfo * phys_last;	//!< Previous physical info, for blending like pp_export_positions.
+	const struct PPAirParticle * air;				//!< Current air grid like pp_get_air_particle_stream.
+};
+
 
 
 enum PPMoveType
@@ -101,6 +236,7 @@ struct PPParticleType
 	float initial_temp;				//!< Initital temperature.
 	float diffusion;				//!< Chaotic part of velocity calculation.
 	unsigned int move_type : 2;		//!< Particle move behavior (one of PPMoveType).
+	unsigned int color;				//!< Color for RENDER_RGBA8 as 0xAABBGGRR, i.e. R, G, B, A bytes in little-endian memory.
 };
 
 
@@ -0,0 +1,192 @@
+#include "pch.h"
+#include "workers.h"
+#include "thread.h"
+#include "utils.h"
+
+
+
+struct PPWorkers;
+
+//! Start parameters of one worker thread.
+struct PPWorkerThread
+{
+	struct PPWorkers * workers;	//!< Owning pool.
+	int index;					//!< Worker index, 1 based. Index 0 is reserved for the thread calling workers_run.
+	pp_thread_t thread;			//!< Thread handle.
+};
+
+struct PPWorkers
+{
+	int count;						//!< Total number of threads including caller.
+	struct PPWorkerThread * threads;	//!< count - 1 background threads.
+
+	pp_mutex_t lock;
+	pp_cond_t wake;					//!< Signaled when new jobs are posted or pool is stopped.
+	pp_cond_t done;					//!< Signaled when the last job is complete.
+
+	PPJobFn fn;						//!< Current job function.
+	void * user;					//!< Current job user data.
+	int jobs;						//!< Total number of current jobs.
+	int limit;						//!< Workers with index below limit take current jobs.
+	int next_job;					//!< Next job to be taken.
+	int pending;					//!< Number of jobs not yet complete.
+	unsigned int generation;		//!< Incremented on each run.
+	int quit;						//!< Set when threads have to stop.
+};
+
+
+
+// Take and execute jobs until none left. Lock must be held on entry and is held on exit.
+static void workers_drain( struct PPWorkers * workers, int worker )
+{
+	PPJobFn fn;
+	void * user;
+	int job;
+
+	while( workers->next_job < workers->jobs )
+	{
+		job = workers->next_job++;
+		fn = workers->fn;
+		user = workers->user;
+
+		mutex_unlock( &workers->lock );
+		fn( user, job, worker );
+		mutex_lock( &workers->lock );
+
+		if( --workers->pending == 0 )
+			cond_broadcast( &workers->done );
+	}
+}
+
+static void workers_thread( void * param )
+{
+	struct PPWorkerThread * self = ( struct PPWorkerThread * ) param;
+	struct PPWorkers * workers = self->workers;
+	unsigned int generation;
+
+	mutex_lock( &workers->lock );
+	generation = workers->generation;
+	for( ;; )
+	{
+		while( !workers->quit && workers->generation == generation )
+			cond_wait( &workers->wake, &workers->lock );
+
+		if( workers->quit )
+			break;
+
+		generation = workers->generation;
+		if( self->index < workers->limit )
+			workers_drain( workers, self->index );
+	}
+	mutex_unlock( &workers->lock );
+}
+
+struct PPWorkers * workers_create( int count )
+{
+	struct PPWorkers * workers;
+	int i;
+
+	if( count < 1 )
+		count = 1;
+
+	workers = malloc_log( sizeof( struct PPWorkers ) );
+	if( !workers )
+		return NULL;
+
+	memset( workers, 0, sizeof( struct PPWorkers ) );
+	workers->count = 1;
+
+	mutex_init( &workers->lock );
+	cond_init( &workers->wake );
+	cond_init( &workers->done );
+
+	if( count > 1 )
+	{
+		workers->threads = malloc_log( sizeof( struct PPWorkerThread ) * ( count - 1 ) );
+		if( !workers->threads )
+		{
+			workers_destroy( workers );
+			return NULL;
+		}
+
+		for( i = 0; i < count - 1; i++ )
+		{
+			workers->threads[ i ].workers = workers;
+			workers->threads[ i ].index = i + 1;
+			if( !thread_create( &workers->threads[ i ].thread, workers_thread, workers->threads + i ) )
+			{
+				workers_destroy( workers );
+				return NULL;
+			}
+			workers->count++;
+		}
+	}
+
+	return workers;
+}
+
+void workers_destroy( struct PPWorkers * workers )
+{
+	int i;
+
+	if( !workers )
+		return;
+
+	mutex_lock( &workers->lock );
+	workers->quit = 1;
+	cond_broadcast( &workers->wake );
+	mutex_unlock( &workers->lock );
+
+	for( i = 0; i < workers->count - 1; i++ )
+		thread_join( workers->threads[ i ].thread );
+
+	cond_destroy( &workers->done );
+	cond_destroy( &workers->wake );
+	mutex_destroy( &workers->lock );
+
+	free( workers->threads );
+	free( workers );
+}
+
+int workers_count( const struct PPWorkers * workers )
+{
+	return workers ? workers->count : 1;
+}
+
+void workers_run( struct PPWorkers * workers, PPJobFn fn, void * user, int jobs )
+{
+	workers_run_limited( workers, fn, user, jobs, workers_count( workers ) );
+}
+
+void workers_run_limited( struct PPWorkers * workers, PPJobFn fn, void * user, int jobs, int threads )
+{
+	int i;
+
+	if( jobs <= 0 )
+		return;
+
+	if( !workers || workers->count == 1 || jobs == 1 || threads <= 1 )
+	{
+		for( i = 0; i < jobs; i++ )
+			fn( user, i, 0 );
+		return;
+	}
+
+	mutex_lock( &workers->lock );
+
+	workers->fn = fn;
+	workers->user = user;
+	workers->jobs = jobs;
+	workers->limit = threads;
+	workers->next_job = 0;
+	workers->pending = jobs;
+	workers->generation++;
+	cond_broadcast( &workers->wake );
+
+	workers_drain( workers, 0 );
+
+	while( workers->pending > 0 )
+		cond_wait( &workers->done, &workers->lock );
+
+	mutex_unlock( &workers->lock );
+}
\ No newline at end of file
@@ -0,0 +1,27 @@
+#ifndef __POWDER_WORKERS_H__
+#define __POWDER_WORKERS_H__
+
+
+
+
+//! Job function. 'job' is in range [0, jobs), 'worker' is index of executing thread in range [0, workers_count).
+typedef void (* PPJobFn) ( void * user, int job, int worker );
+
+//! Persistent pool of worker threads.
+struct PPWorkers;
+
+
+
+//! Create pool of 'count' threads in total, including the thread calling workers_run. Returns NULL on failure.
+struct PPWorkers * workers_create( int count );
+//! Stop and destroy worker threads.
+void workers_destroy( struct PPWorkers * workers );
+//! Number of threads, including the calling one.
+int workers_count( const struct PPWorkers * workers );
+//! Run 'jobs' jobs on the pool and wait until all of them are complete. Calling thread participates as worker 0.
+void workers_run( struct PPWorkers * workers, PPJobFn fn, void * user, int jobs );
+//! Same as workers_run, but only workers with index below 'threads' take jobs.
+void workers_run_limited( struct PPWorkers * workers, PPJobFn fn, void * user, int jobs, int threads );
+
+
+#endif // __POWDER_WORKERS_H__
\ No newline at end of file
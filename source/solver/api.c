@@ -1,18 +1,65 @@
 #include "pch.h"
 #include "api.h"
-#include "cpu_st/solver_cpu_st.h"
+#include "solver.h"
+#include "cross_check.h"
+#include "snapshot.h"
+#include "history.h"
+#include "stats.h"
+#include "trace.h"
+#include "stepping.h"
+#include "publish.h"
+#include "async.h"
 #include "shared/version.h"
 #include "shared/utils.h"
+#include "shared/thread.h"
+#include "shared/timer.h"
+#include "shared/workers.h"
 #include "particles/common.h"
 #include <assert.h>
 #include <string.h>
 
 
 
+#define DEFAULT_AIR_TILE_SIZE 128
+
+//! Stage of frame of pp_update_budgeted.
+enum PPBudgetStage
+{
+	BUDGET_IDLE,			//!< No frame in progress.
+	BUDGET_STEPS,			//!< Steps are being updated.
+	BUDGET_HISTORY,			//!< Steps are done, history record is being encoded.
+	BUDGET_PUBLISH,			//!< History is recorded, frame is being copied for publication.
+};
+
+
 
 struct PPConfiguration sConfiguration;
 struct PPConstants sConstants;
 struct PPParticleType * spParticleTypes = NULL;
+const struct PPSolver * spSolver = NULL;
+int sCrossCheck = 0;
+struct PPWorkers * spWorkers = NULL;	//!< Worker threads shared by all parallel passes.
+int sBudgetStage = BUDGET_IDLE;			//!< Stage of frame of pp_update_budgeted in progress.
+int sBudgetStep = 0;					//!< Step of sBudgetDt is taken from stepping, but isn't complete.
+pp_time_t sBudgetDt;					//!< Time of the step in progress.
+int sBudgetSteps;						//!< Steps completed by the frame in progress.
+
+
+
+static const struct PPSolver * find_solver( int type )
+{
+	switch( type )
+	{
+	case SOLVER_CPU_ST:
+		return &sSolverCpuSt;
+
+	case SOLVER_CPU_MT:
+		return &sSolverCpuMt;
+
+	default:
+		return sConfiguration.threads > 1 || sConfiguration.threads < 0 ? &sSolverCpuMt : &sSolverCpuSt;
+	}
+}
 
 
 
@@ -43,6 +90,10 @@ int pp_init( const struct PPConfiguration * configuration )
 	sConstants.v_loss = 0.95f;
 	sConstants.p_hstep = 4.5f;
 	sConstants.v_hstep = 6.0f;
+	sConstants.sleep_temp = 0.5f;
+	sConstants.sleep_delay = 0.5f;
+	sConstants.wake_pressure = 5.0f;
+	sConstants.wake_air_velocity = 5.0f;
 
 	spParticleTypes = ( struct PPParticleType * ) malloc_log( sizeof( struct PPParticleType ) * ( PARTICLE_TYPES + 1 ) );
 	if( !spParticleTypes )
@@ -52,13 +103,88 @@ int pp_init( const struct PPConfiguration * configuration )
 #include "particles/register.inl"
 	assert( i == PARTICLE_TYPES + 1 );
 
-	return solver_cpu_st_init( );
+	spSolver = find_solver( sConfiguration.solver );
+	stats_reset( );
+	stepping_reset( );
+	publish_reset( );
+	sBudgetStage = BUDGET_IDLE;
+	sBudgetStep = 0;
+
+	// resolve number of threads, multithreaded solver uses all hardware threads by default
+	if( sConfiguration.threads < 0 ||
+		( sConfiguration.threads == 0 && ( spSolver == &sSolverCpuMt || sConfiguration.reference_solver == SOLVER_CPU_MT ) ) )
+		sConfiguration.threads = thread_hardware_concurrency( );
+	if( sConfiguration.threads < 1 )
+		sConfiguration.threads = 1;
+
+	if( sConfiguration.air_threads == 0 )
+		sConfiguration.air_threads = sConfiguration.threads;
+	else if( sConfiguration.air_threads < 0 )
+		sConfiguration.air_threads = thread_hardware_concurrency( );
+
+	if( sConfiguration.air_tile_size <= 0 )
+		sConfiguration.air_tile_size = DEFAULT_AIR_TILE_SIZE;
+
+	spWorkers = workers_create( sConfiguration.threads > sConfiguration.air_threads ? sConfiguration.threads : sConfiguration.air_threads );
+	if( !spWorkers )
+		return 0;
+
+	if( !spSolver->init( ) )
+	{
+		workers_destroy( spWorkers );
+		spWorkers = NULL;
+		return 0;
+	}
+
+	sCrossCheck = 0;
+	if( sConfiguration.reference_solver != SOLVER_AUTO )
+	{
+		if( !cross_check_init( find_solver( sConfiguration.reference_solver ), spSolver ) )
+		{
+			spSolver->deinit( );
+			workers_destroy( spWorkers );
+			spWorkers = NULL;
+			return 0;
+		}
+
+		sCrossCheck = 1;
+	}
+
+	if( !history_init( ) )
+	{
+		if( sCrossCheck )
+			cross_check_deinit( );
+		sCrossCheck = 0;
+		spSolver->deinit( );
+		workers_destroy( spWorkers );
+		spWorkers = NULL;
+		return 0;
+	}
+
+	return 1;
 }
 
 int pp_deinit( )
 {
+	int res;
+
+	async_deinit( );
 	free( spParticleTypes );
-	return solver_cpu_st_deinit( );
+
+	history_deinit( );
+	trace_deinit( );
+	publish_deinit( );
+
+	if( sCrossCheck )
+		cross_check_deinit( );
+	sCrossCheck = 0;
+
+	res = spSolver->deinit( );
+
+	workers_destroy( spWorkers );
+	spWorkers = NULL;
+
+	return res;
 }
 
 const struct PPConfiguration * pp_get_configuration( )
@@ -68,52 +194,522 @@ const struct PPConfiguration * pp_get_configuration( )
 
 extern struct PPConstants * pp_get_constants( )
 {
+	pp_wait( );
 	return &sConstants;
 }
 
+static void update_step( pp_time_t dt )
+{
+	if( sCrossCheck )
+		cross_check_update( dt );
+	else
+		spSolver->update( dt );
+}
+
+// Complete frame of pp_update_budgeted, which is in progress.
+static void finish_budget_frame( )
+{
+	if( sBudgetStage != BUDGET_IDLE )
+		pp_update_budgeted( 0, 0 );
+}
+
+// Complete recording and publication of pp_update_budgeted frame, whose steps are done, before state changes.
+static void finish_budget_output( )
+{
+	if( sBudgetStage > BUDGET_STEPS )
+		pp_update_budgeted( 0, 0 );
+}
+
+// Record history of frame until deadline of timer_ms, 0 for no deadline. Returns 1 if recording is complete.
+static int record_history( double deadline )
+{
+	double t, trace;
+	int done;
+
+	t = stats_begin( );
+	trace = TRACE_BEGIN( );
+	done = history_record( deadline );
+	TRACE_END( "history", 0, -1, trace );
+	stats_lap( &sStatsNext.history_ms, t );
+	return done;
+}
+
+static void end_frame( int steps )
+{
+	spSolver->end_frame( );
+	record_history( 0.0 );
+	sStatsNext.steps = steps;
+}
+
+static void update_frame( pp_time_t dt )
+{
+	double start, trace;
+	int steps;
+
+	start = stats_begin( );
+	trace = TRACE_BEGIN( );
+	steps = stepping_update( dt, update_step );
+	end_frame( steps );
+	stats_lap( &sStatsNext.update_ms, start );
+	stats_end_frame( );
+	TRACE_END( "pp_update", 0, -1, trace );
+}
+
+// Update frame on engine thread and copy it for publication, which is done by the calling thread.
+static void update_frame_async( pp_time_t dt )
+{
+	update_frame( dt );
+	publish_copy( 0.0 );
+}
+
 void pp_update( pp_time_t dt )
 {
-	solver_cpu_st_update( dt );
+	pp_wait( );
+	finish_budget_frame( );
+	update_frame( dt );
+}
+
+int pp_update_async( pp_time_t dt )
+{
+	pp_wait( );
+	finish_budget_frame( );
+	return async_run( dt, update_frame_async );
+}
+
+int pp_poll( )
+{
+	if( !async_poll( ) )
+		return 0;
+
+	publish_swap( );
+	return 1;
+}
+
+void pp_wait( )
+{
+	if( async_wait( ) )
+		publish_swap( );
+}
+
+// Is time of pp_update_budgeted call spent? Call, which hasn't done anything yet, always makes progress.
+static int budget_spent( int progress, double deadline )
+{
+	return progress && deadline > 0.0 && timer_ms( ) >= deadline;
+}
+
+int pp_update_budgeted( pp_time_t dt, int budget_us )
+{
+	double start, deadline, trace;
+	int progress = 0;
+
+	pp_wait( );
+	start = timer_ms( );
+	deadline = budget_us > 0 ? start + budget_us * 0.001 : 0.0;
+	trace = TRACE_BEGIN( );
+
+	if( sBudgetStage == BUDGET_IDLE )
+	{
+		stepping_begin( dt );
+		sBudgetStage = BUDGET_STEPS;
+		sBudgetStep = 0;
+		sBudgetSteps = 0;
+	}
+	else
+		stepping_accumulate( dt );
+
+	while( sBudgetStage == BUDGET_STEPS )
+	{
+		// the next step starts on the next call if the budget is spent
+		if( !sBudgetStep )
+		{
+			if( !stepping_next( &sBudgetDt ) )
+			{
+				spSolver->end_frame( );
+				sStatsNext.steps = sBudgetSteps;
+				sBudgetStage = BUDGET_HISTORY;
+				break;
+			}
+			sBudgetStep = 1;
+			if( budget_spent( progress, deadline ) )
+				break;
+		}
+
+		// cross-check compares whole steps
+		progress = 1;
+		if( sCrossCheck )
+			cross_check_update( sBudgetDt );
+		else if( !spSolver->update_slice( sBudgetDt, deadline ) )
+			break;
+
+		sBudgetStep = 0;
+		sBudgetSteps++;
+	}
+
+	// history and publication of the frame are sliced too, state doesn't change until they are complete
+	if( sBudgetStage == BUDGET_HISTORY && !budget_spent( progress, deadline ) )
+	{
+		progress = 1;
+		if( record_history( deadline ) )
+			sBudgetStage = BUDGET_PUBLISH;
+	}
+
+	if( sBudgetStage == BUDGET_PUBLISH && !budget_spent( progress, deadline ) && publish_copy( deadline ) )
+		sBudgetStage = BUDGET_IDLE;
+
+	stats_lap( &sStatsNext.update_ms, start );
+	if( sBudgetStage != BUDGET_IDLE )
+	{
+		TRACE_END( "pp_update_budgeted", 0, -1, trace );
+		return 0;
+	}
+
+	publish_swap( );
+	stats_end_frame( );
+	TRACE_END( "pp_update_budgeted", 0, -1, trace );
+	return 1;
+}
+
+const struct PPFrame * pp_get_frame( )
+{
+	return publish_get_frame( );
 }
 
 int pp_get_alive_particles_count( )
 {
-	return solver_cpu_st_get_alive_particles_count( );
+	pp_wait( );
+	return spSolver->get_alive_particles_count( );
+}
+
+const int * pp_get_alive_particles( )
+{
+	pp_wait( );
+	return spSolver->get_alive_particles( );
 }
 
 const struct PPParticleInfo * pp_get_particles_info_stream( )
 {
-	return solver_cpu_st_get_particles_info_stream( );
+	pp_wait( );
+	return spSolver->get_particles_info_stream( );
 }
 
 const struct PPParticlePhysInfo * pp_get_particles_phys_info_stream( )
 {
-	return solver_cpu_st_get_particles_phys_info_stream( );
+	pp_wait( );
+	return spSolver->get_particles_phys_info_stream( );
 }
 
 const struct PPParticlePhysInfo * pp_get_particles_phys_info_stream_last( )
 {
-	return solver_cpu_st_get_particles_phys_info_stream_last( );
+	pp_wait( );
+	return spSolver->get_particles_phys_info_stream_last( );
 }
 
 struct PPAirParticle * pp_get_air_particle_stream( )
 {
-	return solver_cpu_st_get_air_particle_stream( );
+	pp_wait( );
+	return spSolver->get_air_particle_stream( );
 }
 
 const struct PPAirParticle * pp_get_air_particle_stream_last( )
 {
-	return solver_cpu_st_get_air_particle_stream_last( );
+	pp_wait( );
+	return spSolver->get_air_particle_stream_last( );
 }
 
 void pp_particle_spawn_at( int x, int y, unsigned int type )
 {
-	solver_cpu_st_spawn_at( x, y, type );
+	pp_wait( );
+	finish_budget_output( );
+	spSolver->spawn_at( x, y, type );
+}
+
+// Clip span [start, start + size) to [begin, end). End of span is compared before it's added, as it may be out of int
+// range. Returns 0 if nothing is left.
+static int clip_span( int * start, int * size, int begin, int end )
+{
+	if( *size <= 0 )
+		return 0;
+
+	if( *start <= end - *size )
+		end = *start + *size;
+	if( *start < begin )
+		*start = begin;
+
+	*size = end - *start;
+	return *size > 0;
+}
+
+// Clip rectangle to the world without its border cells, where particles are killed. Returns 0 if nothing is left.
+static int clip_spawn_rect( int * x, int * y, int * width, int * height )
+{
+	return clip_span( x, width, 1, sConfiguration.xres - 1 ) && clip_span( y, height, 1, sConfiguration.yres - 1 );
+}
+
+// Spawn row [x - dx, x + dx] of circle. Row and its ends may be out of int range, so they are clipped in doubles.
+static int spawn_circle_row( int x, double y, int dx, unsigned int type )
+{
+	double x0 = ( double ) x - dx;
+	double x1 = ( double ) x + dx + 1.0;
+
+	if( y < 1.0 || y > sConfiguration.yres - 2 )
+		return 0;
+	if( x0 < 1.0 )
+		x0 = 1.0;
+	if( x1 > sConfiguration.xres - 1 )
+		x1 = sConfiguration.xres - 1;
+	if( x1 <= x0 )
+		return 0;
+
+	return spSolver->spawn_rect( ( int ) x0, ( int ) y, ( int ) ( x1 - x0 ), 1, type, NULL, 0 );
+}
+
+int pp_particle_spawn_rect( int x, int y, int width, int height, unsigned int type )
+{
+	pp_wait( );
+	finish_budget_output( );
+	if( !type || ( int ) type >= pp_get_particle_types_count( ) )
+		return 0;
+	if( !clip_spawn_rect( &x, &y, &width, &height ) )
+		return 0;
+
+	return spSolver->spawn_rect( x, y, width, height, type, NULL, 0 );
+}
+
+int pp_particle_spawn_circle( int x, int y, int radius, unsigned int type )
+{
+	double r2 = ( double ) radius * radius;
+	double first, last;
+	int spawned = 0;
+	int dy, dx, end;
+
+	pp_wait( );
+	finish_budget_output( );
+	if( !type || ( int ) type >= pp_get_particle_types_count( ) || radius < 0 )
+		return 0;
+
+	// only rows, where y + dy or y - dy is inside the world, are visited
+	first = ( double ) y < 1.0 ? 1.0 - y : ( double ) y > sConfiguration.yres - 2 ? ( double ) y - ( sConfiguration.yres - 2 ) : 0.0;
+	last = ( double ) y - 1.0 > sConfiguration.yres - 2 - ( double ) y ? ( double ) y - 1.0 : sConfiguration.yres - 2 - ( double ) y;
+	if( last > radius )
+		last = radius;
+	if( first > last )
+		return 0;
+
+	// rows from the middle outwards, half width is the largest one inside of the circle
+	end = ( int ) last;
+	for( dy = ( int ) first; ; dy++ )
+	{
+		dx = ( int ) sqrt( r2 - ( double ) dy * dy );
+		while( dx > 0 && ( double ) dx * dx + ( double ) dy * dy > r2 )
+			dx--;
+		while( dx < radius && ( ( double ) dx + 1.0 ) * ( ( double ) dx + 1.0 ) + ( double ) dy * dy <= r2 )
+			dx++;
+
+		spawned += spawn_circle_row( x, ( double ) y + dy, dx, type );
+		if( dy )
+			spawned += spawn_circle_row( x, ( double ) y - dy, dx, type );
+
+		// the last row may be INT_MAX
+		if( dy == end )
+			break;
+	}
+
+	return spawned;
+}
+
+int pp_particle_spawn_mask( int x, int y, int width, int height, const unsigned char * types, int stride )
+{
+	int x0 = x, y0 = y;
+
+	pp_wait( );
+	finish_budget_output( );
+	if( !types || !clip_spawn_rect( &x0, &y0, &width, &height ) )
+		return 0;
+
+	return spSolver->spawn_rect( x0, y0, width, height, 0, types + ( y0 - y ) * stride + x0 - x, stride );
+}
+
+int pp_particle_spawn_records( const struct PPSpawnRecord * records, int count )
+{
+	pp_wait( );
+	finish_budget_output( );
+	if( !records || count <= 0 )
+		return 0;
+
+	return spSolver->spawn_records( records, count );
 }
 
 void pp_collision_set( int x, int y, unsigned int collision_type )
 {
-	solver_cpu_st_collision_set( x, y, collision_type );
+	pp_wait( );
+	finish_budget_frame( );
+	spSolver->collision_set( x, y, collision_type );
+}
+
+int pp_collision_import( int x, int y, int width, int height, const unsigned char * types, int stride )
+{
+	int x0 = x, y0 = y;
+
+	pp_wait( );
+	if( !types || !clip_span( &x0, &width, 0, sConfiguration.xres ) || !clip_span( &y0, &height, 0, sConfiguration.yres ) )
+		return 0;
+
+	finish_budget_frame( );
+	return spSolver->collision_import( x0, y0, width, height, types + ( y0 - y ) * stride + x0 - x, stride );
+}
+
+int pp_get_snapshot_size( )
+{
+	pp_wait( );
+	return snapshot_get_size( );
+}
+
+int pp_save( const char * path )
+{
+	pp_wait( );
+	finish_budget_frame( );
+	return snapshot_save_file( path );
+}
+
+int pp_load( const char * path )
+{
+	pp_wait( );
+	finish_budget_frame( );
+	if( !snapshot_load_file( path ) )
+		return 0;
+	history_reset( );
+	return 1;
+}
+
+int pp_save_memory( void * buffer, int size )
+{
+	pp_wait( );
+	finish_budget_frame( );
+	return snapshot_save_memory( buffer, size );
+}
+
+int pp_load_memory( const void * buffer, int size )
+{
+	pp_wait( );
+	finish_budget_frame( );
+	if( !snapshot_load_memory( buffer, size ) )
+		return 0;
+	history_reset( );
+	return 1;
+}
+
+int pp_rewind( int frames )
+{
+	pp_wait( );
+	finish_budget_frame( );
+	return history_rewind( frames );
+}
+
+int pp_get_history_frames( )
+{
+	pp_wait( );
+	return history_get_frames( );
+}
+
+int pp_compact( )
+{
+	pp_wait( );
+	finish_budget_frame( );
+	return spSolver->compact( );
+}
+
+int pp_get_dirty_rect( int * x0, int * y0, int * x1, int * y1 )
+{
+	pp_wait( );
+	return spSolver->get_dirty_rect( x0, y0, x1, y1 );
+}
+
+const struct PPChanges * pp_get_changes( )
+{
+	pp_wait( );
+	return spSolver->get_changes( );
+}
+
+// Running asynchronous update isn't waited for if a frame is published, its inputs are read instead of solver state.
+static const struct PPRenderSource * render_source( )
+{
+	const struct PPRenderSource * source;
+
+	if( pp_poll( ) )
+		return NULL;
+
+	source = publish_get_source( );
+	if( !source )
+		pp_wait( );
+	return source;
+}
+
+int pp_render( int format, void * buffer, int stride, int x, int y, int width, int height )
+{
+	static const int pixel_size[ ] = { 4, 1, 2, 2 };
+	int x0 = x, y0 = y;
+	const struct PPRenderSource * source = render_source( );
+
+	if( !buffer || format < RENDER_RGBA8 || format > RENDER_PRESSURE16F )
+		return 0;
+	if( !clip_span( &x0, &width, 0, sConfiguration.xres ) || !clip_span( &y0, &height, 0, sConfiguration.yres ) )
+		return 1;
+
+	buffer = ( unsigned char * ) buffer + ( y0 - y ) * stride + ( x0 - x ) * pixel_size[ format ];
+	return spSolver->render( source, format, buffer, stride, x0, y0, width, height );
+}
+
+int pp_export_positions( float alpha, int format, void * buffer, int stride )
+{
+	static const int record_size[ ] = { 8, 12, 4 };
+	const struct PPRenderSource * source = render_source( );
+
+	if( !buffer || format < POSITION_FLOAT2 || format > POSITION_FIXED16 || stride < record_size[ format ] )
+		return -1;
+
+	return spSolver->export_positions( source, alpha, format, buffer, stride );
+}
+
+const struct PPCrossCheckReport * pp_get_cross_check_report( )
+{
+	pp_wait( );
+	return sCrossCheck ? cross_check_get_report( ) : NULL;
+}
+
+void pp_enable_stats( int enable )
+{
+	pp_wait( );
+	stats_enable( enable );
+}
+
+float pp_get_step_alpha( )
+{
+	pp_wait( );
+	return stepping_get_alpha( );
+}
+
+const struct PPStats * pp_get_stats( )
+{
+	pp_wait( );
+	return stats_get( );
+}
+
+int pp_trace_start( int memory )
+{
+	pp_wait( );
+	return trace_start( memory, workers_count( spWorkers ) );
+}
+
+void pp_trace_stop( )
+{
+	pp_wait( );
+	trace_stop( );
+}
+
+int pp_trace_save( const char * path )
+{
+	pp_wait( );
+	return trace_save_file( path );
 }
 
 int pp_get_particle_types_count( )
@@ -0,0 +1,136 @@
+#include "pch.h"
+#include "async.h"
+#include "shared/thread.h"
+
+
+
+extern struct PPConfiguration sConfiguration;
+
+pp_thread_t sAsyncThread;
+int sAsyncStarted = 0;		//!< Engine thread is running.
+pp_mutex_t sAsyncLock;
+pp_cond_t sAsyncWake;		//!< Signaled when update is posted or thread has to stop.
+pp_cond_t sAsyncDone;		//!< Signaled when update is complete.
+PPStepFn sAsyncFn;
+pp_time_t sAsyncDt;
+int sAsyncPending = 0;		//!< Update is posted and not complete yet, guarded by sAsyncLock.
+int sAsyncQuit = 0;			//!< Guarded by sAsyncLock.
+int sAsyncBusy = 0;			//!< Update is posted and not waited for, used by calling thread only.
+
+
+
+
+
+static void async_thread( void * user )
+{
+	( void ) user;
+
+	mutex_lock( &sAsyncLock );
+	for( ;; )
+	{
+		while( !sAsyncQuit && !sAsyncPending )
+			cond_wait( &sAsyncWake, &sAsyncLock );
+
+		if( sAsyncQuit )
+			break;
+
+		mutex_unlock( &sAsyncLock );
+		sAsyncFn( sAsyncDt );
+		mutex_lock( &sAsyncLock );
+
+		sAsyncPending = 0;
+		cond_broadcast( &sAsyncDone );
+	}
+	mutex_unlock( &sAsyncLock );
+}
+
+static int async_start( )
+{
+	mutex_init( &sAsyncLock );
+	cond_init( &sAsyncWake );
+	cond_init( &sAsyncDone );
+	sAsyncPending = 0;
+	sAsyncQuit = 0;
+
+	if( !thread_create( &sAsyncThread, async_thread, NULL ) )
+	{
+		if( sConfiguration.log_fn )
+			sConfiguration.log_fn( LOG_ERROR, "Can't start engine thread of asynchronous update." );
+		cond_destroy( &sAsyncDone );
+		cond_destroy( &sAsyncWake );
+		mutex_destroy( &sAsyncLock );
+		return 0;
+	}
+
+	sAsyncStarted = 1;
+	return 1;
+}
+
+void async_deinit( )
+{
+	if( !sAsyncStarted )
+		return;
+
+	async_wait( );
+
+	mutex_lock( &sAsyncLock );
+	sAsyncQuit = 1;
+	cond_broadcast( &sAsyncWake );
+	mutex_unlock( &sAsyncLock );
+	thread_join( sAsyncThread );
+
+	cond_destroy( &sAsyncDone );
+	cond_destroy( &sAsyncWake );
+	mutex_destroy( &sAsyncLock );
+	sAsyncStarted = 0;
+}
+
+int async_run( pp_time_t dt, PPStepFn fn )
+{
+	if( sAsyncBusy || ( !sAsyncStarted && !async_start( ) ) )
+		return 0;
+
+	mutex_lock( &sAsyncLock );
+	sAsyncFn = fn;
+	sAsyncDt = dt;
+	sAsyncPending = 1;
+	cond_signal( &sAsyncWake );
+	mutex_unlock( &sAsyncLock );
+
+	sAsyncBusy = 1;
+	return 1;
+}
+
+int async_busy( )
+{
+	return sAsyncBusy;
+}
+
+int async_poll( )
+{
+	int pending;
+
+	if( !sAsyncBusy )
+		return 1;
+
+	mutex_lock( &sAsyncLock );
+	pending = sAsyncPending;
+	mutex_unlock( &sAsyncLock );
+
+	sAsyncBusy = pending;
+	return !pending;
+}
+
+int async_wait( )
+{
+	if( !sAsyncBusy )
+		return 0;
+
+	mutex_lock( &sAsyncLock );
+	while( sAsyncPending )
+		cond_wait( &sAsyncDone, &sAsyncLock );
+	mutex_unlock( &sAsyncLock );
+
+	sAsyncBusy = 0;
+	return 1;
+}
@@ -0,0 +1,25 @@
+#ifndef __POWDER_ASYNC_H__
+#define __POWDER_ASYNC_H__
+
+
+#include "solver/stepping.h"
+
+
+
+// Background updates run on one engine thread, which is started by the first update and lives until async_deinit.
+// Only the calling thread posts updates and waits for them, so the thread runs at most one update at a time.
+
+
+
+void async_deinit( );
+//! Run 'fn' with 'dt' on engine thread. Previous update must be complete. Returns 0 on failure.
+int async_run( pp_time_t dt, PPStepFn fn );
+//! Is there an update, which isn't waited for or polled as complete yet?
+int async_busy( );
+//! Check if update is complete without blocking. Returns 1 if there is no update running.
+int async_poll( );
+//! Wait for update to complete. Returns 1 if there was an update, 0 if nothing was running.
+int async_wait( );
+
+
+#endif // __POWDER_ASYNC_H__
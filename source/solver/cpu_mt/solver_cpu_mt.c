@@ -0,0 +1,531 @@
+#include "pch.h"
+#include "solver_cpu_mt.h"
+#include "solver/cpu_st/solver_cpu_st.h"
+#include "solver/cpu_st/compact_cpu_st.h"
+#include "solver/cpu_st/chunks_cpu_st.h"
+#include "solver/cpu_st/heat_cpu_st.h"
+#include "solver/cpu_st/distance_cpu_st.h"
+#include "solver/cpu_st/changes_cpu_st.h"
+#include "solver/cpu_st/render_cpu_st.h"
+#include "solver/cpu_st/positions_cpu_st.h"
+#include "solver/solver.h"
+#include "solver/stats.h"
+#include "solver/trace.h"
+#include "shared/timer.h"
+#include "shared/utils.h"
+#include "shared/workers.h"
+#include <assert.h>
+#include <string.h>
+
+
+
+extern struct PPConfiguration sConfiguration;
+extern struct PPParticleMap * spParticleMap;
+extern struct PPWorkers * spWorkers;
+extern float sMaxSpeed;
+extern struct PPParticlePhysInfo * spParticlesPhysInfoLast;
+extern int sParticleAliveCount;
+extern int * spAliveList;
+
+
+
+// Particles are processed in horizontal bands. Even bands are updated in parallel first,
+// then odd ones. A band may touch rows of its neighbours up to a half of band height,
+// so bands running at the same time never touch the same map rows or air cells.
+// Particles which try to move further are deferred and moved serially in the end.
+// Particles of a band are updated in order of alive list like in single threaded solver.
+// Updating them in map order, from top to bottom, lets fluids spread noticeably faster.
+
+#define MT_MIN_BAND_ROWS 16
+
+//! Stage of step in progress of sliced update.
+enum PPMtStage
+{
+	MT_STAGE_IDLE,			//!< No step in progress.
+	MT_STAGE_EVEN,			//!< Air and heat are updated, even bands are being updated.
+	MT_STAGE_ODD,			//!< Even bands are updated, odd bands are being updated.
+	MT_STAGE_FINISH,		//!< Particles are updated, chunks and compaction are left.
+};
+
+//! Horizontal band of the world.
+struct PPBand
+{
+	int row_start;			//!< First row of band.
+	int row_end;			//!< Row after the last row of band.
+	int count;				//!< Number of particles collected in band. After update, number of deferred particles.
+	int killed_count;		//!< Number of particles killed in band during last update.
+	int max_index;			//!< Maximal index of particle collected from chunks of band, -1 if there are none.
+	int changes_count;		//!< Number of particle changes recorded in band during last update.
+	struct PPStepStats stats;	//!< Counters of band update.
+	float max_move;			//!< Longest particle move of band update along one axis in pixels.
+};
+
+struct PPBand * spMtBands = NULL;
+int sMtThreads;
+int sMtBandCount;
+int sMtBandHalo;
+int * spMtParticles = NULL;	//!< Indices of particles, band segment starts at row_start * xres.
+int * spMtKilled = NULL;	//!< Indices of killed particles, same layout as spMtParticles.
+int * spMtSegments = NULL;	//!< Particles of every band in every segment of alive list followed by span of segment, sMtBandCount + 1 entries per thread.
+int sMtBandRows;			//!< Rows of band, the last band takes the rest of the world.
+int sMtSpan;				//!< Maximal index of collected particles + 1.
+struct PPParticleChange * spMtChanges = NULL;	//!< Particle changes, same layout as spMtParticles. NULL if changes are not recorded.
+pp_time_t sMtDt;
+unsigned int sMtRandomKey[ 2 ];
+int sMtPhase;
+int sMtJobOffset;			//!< Band pair of the first job, updates of a phase may be split into groups by deadline.
+int sMtStage = MT_STAGE_IDLE;
+int sMtNextBand;			//!< Band pair where update of the current phase continues.
+struct PPStepContext sMtCtx;	//!< Context of step in progress.
+
+
+
+
+
+int solver_cpu_mt_init( )
+{
+	sMtStage = MT_STAGE_IDLE;
+	if( !solver_cpu_st_init( ) )
+		return 0;
+
+	if( !solver_cpu_mt_attach( ) )
+	{
+		solver_cpu_st_deinit( );
+		return 0;
+	}
+
+	return 1;
+}
+
+int solver_cpu_mt_deinit( )
+{
+	solver_cpu_mt_detach( );
+	return solver_cpu_st_deinit( );
+}
+
+int solver_cpu_mt_attach( )
+{
+	int num_parts;
+	int rows, min_rows;
+	int i;
+
+	// worker threads are owned by engine, pool may be larger if air update uses more threads
+	sMtThreads = sConfiguration.threads < workers_count( spWorkers ) ? sConfiguration.threads : workers_count( spWorkers );
+
+	if( sConfiguration.log_fn )
+		sConfiguration.log_fn( LOG_INFO, "Multithreading CPU solver is being initialized: threads=%d.", sMtThreads );
+
+	num_parts = sConfiguration.xres * sConfiguration.yres;
+
+	spMtParticles = malloc_log( sizeof( int ) * num_parts );
+	if( !spMtParticles )
+	{
+		solver_cpu_mt_detach( );
+		return 0;
+	}
+
+	spMtKilled = malloc_log( sizeof( int ) * num_parts );
+	if( !spMtKilled )
+	{
+		solver_cpu_mt_detach( );
+		return 0;
+	}
+
+	if( changes_cpu_st_enabled( ) )
+	{
+		spMtChanges = malloc_log( sizeof( struct PPParticleChange ) * num_parts );
+		if( !spMtChanges )
+		{
+			solver_cpu_mt_detach( );
+			return 0;
+		}
+	}
+
+	// band height is a multiple of air cell, so hot air of a band never reaches the next band of the same phase
+	min_rows = MT_MIN_BAND_ROWS > 2 * sConfiguration.grid_size ? MT_MIN_BAND_ROWS : 2 * sConfiguration.grid_size;
+	min_rows = ( min_rows + sConfiguration.grid_size - 1 ) / sConfiguration.grid_size * sConfiguration.grid_size;
+	rows = sConfiguration.yres / ( sMtThreads * 4 );
+	rows -= rows % sConfiguration.grid_size;
+	if( rows < min_rows )
+		rows = min_rows;
+
+	sMtBandCount = sConfiguration.yres / rows;
+	if( sMtBandCount < 1 )
+		sMtBandCount = 1;
+	sMtBandHalo = rows / 2;
+
+	sMtBandRows = rows;
+
+	spMtBands = malloc_log( sizeof( struct PPBand ) * sMtBandCount );
+	if( !spMtBands )
+	{
+		solver_cpu_mt_detach( );
+		return 0;
+	}
+
+	spMtSegments = malloc_log( sizeof( int ) * sMtThreads * ( sMtBandCount + 1 ) );
+	if( !spMtSegments )
+	{
+		solver_cpu_mt_detach( );
+		return 0;
+	}
+
+	for( i = 0; i < sMtBandCount; i++ )
+	{
+		spMtBands[ i ].row_start = i * rows;
+		spMtBands[ i ].row_end = i == sMtBandCount - 1 ? sConfiguration.yres : ( i + 1 ) * rows;
+		spMtBands[ i ].count = 0;
+		spMtBands[ i ].killed_count = 0;
+		spMtBands[ i ].max_index = -1;
+		spMtBands[ i ].changes_count = 0;
+	}
+
+	return 1;
+}
+
+int solver_cpu_mt_detach( )
+{
+	free( spMtBands );
+	free( spMtParticles );
+	free( spMtKilled );
+	free( spMtChanges );
+	free( spMtSegments );
+	spMtBands = NULL;
+	spMtParticles = NULL;
+	spMtKilled = NULL;
+	spMtChanges = NULL;
+	spMtSegments = NULL;
+
+	return 1;
+}
+
+// Particles of awake chunks are collected in map order by single threaded solver as well.
+static void collect_chunks_job( void * user, int job, int worker )
+{
+	struct PPBand * band = spMtBands + job;
+
+	( void ) user;
+	( void ) worker;
+
+	band->count = chunks_cpu_st_collect( band->row_start, band->row_end,
+		spMtParticles + band->row_start * sConfiguration.xres, &band->max_index );
+}
+
+static __inline int particle_band( int index )
+{
+	int band = ( int ) spParticlesPhysInfoLast[ index ].y / sMtBandRows;
+
+	return band < sMtBandCount ? band : sMtBandCount - 1;
+}
+
+// Count particles of every band in segment 'job' of alive list.
+static void count_job( void * user, int job, int worker )
+{
+	int * counts = spMtSegments + job * ( sMtBandCount + 1 );
+	int i, index, end, span = 0;
+
+	( void ) user;
+	( void ) worker;
+
+	memset( counts, 0, sizeof( int ) * sMtBandCount );
+	end = ( int )( ( long long ) sParticleAliveCount * ( job + 1 ) / sMtThreads );
+	for( i = ( int )( ( long long ) sParticleAliveCount * job / sMtThreads ); i < end; i++ )
+	{
+		index = spAliveList[ i ];
+		counts[ particle_band( index ) ]++;
+		if( index >= span )
+			span = index + 1;
+	}
+	counts[ sMtBandCount ] = span;
+}
+
+// Copy particles of segment 'job' of alive list to lists of bands, counters of segment are turned into positions.
+static void scatter_job( void * user, int job, int worker )
+{
+	int * positions = spMtSegments + job * ( sMtBandCount + 1 );
+	int i, index, end;
+
+	( void ) user;
+	( void ) worker;
+
+	end = ( int )( ( long long ) sParticleAliveCount * ( job + 1 ) / sMtThreads );
+	for( i = ( int )( ( long long ) sParticleAliveCount * job / sMtThreads ); i < end; i++ )
+	{
+		index = spAliveList[ i ];
+		spMtParticles[ positions[ particle_band( index ) ]++ ] = index;
+	}
+}
+
+// Fill lists of bands and sMtSpan.
+static void collect( )
+{
+	struct PPBand * band;
+	int * segment;
+	int i, j, position, count;
+
+	sMtSpan = 0;
+
+	if( chunks_cpu_st_enabled( ) )
+	{
+		workers_run_limited( spWorkers, collect_chunks_job, NULL, sMtBandCount, sMtThreads );
+		for( i = 0, band = spMtBands; i < sMtBandCount; i++, band++ )
+			if( band->max_index >= sMtSpan )
+				sMtSpan = band->max_index + 1;
+		return;
+	}
+
+	// alive list is sorted by band keeping its order, segments of it are counted and copied in parallel
+	workers_run_limited( spWorkers, count_job, NULL, sMtThreads, sMtThreads );
+	for( i = 0, band = spMtBands; i < sMtBandCount; i++, band++ )
+	{
+		position = band->row_start * sConfiguration.xres;
+		for( j = 0, segment = spMtSegments + i; j < sMtThreads; j++, segment += sMtBandCount + 1 )
+		{
+			count = *segment;
+			*segment = position;
+			position += count;
+		}
+		band->count = position - band->row_start * sConfiguration.xres;
+	}
+	for( j = 0, segment = spMtSegments + sMtBandCount; j < sMtThreads; j++, segment += sMtBandCount + 1 )
+		if( *segment > sMtSpan )
+			sMtSpan = *segment;
+
+	workers_run_limited( spWorkers, scatter_job, NULL, sMtThreads, sMtThreads );
+}
+
+static void update_job( void * user, int job, int worker )
+{
+	struct PPBand * band = spMtBands + ( sMtJobOffset + job ) * 2 + sMtPhase;
+	struct PPStepContext ctx;
+	int * list = spMtParticles + band->row_start * sConfiguration.xres;
+	unsigned char * touch = chunks_cpu_st_get_touch( worker );
+	int i, count, deferred, res;
+	double trace = TRACE_BEGIN( );
+
+	( void ) user;
+
+	ctx.dt = sMtDt;
+	ctx.sdt = FLT_SECOND * sMtDt;
+	ctx.row_min = band->row_start - sMtBandHalo;
+	ctx.row_max = band->row_end + sMtBandHalo;
+	if( ctx.row_min < 0 )
+		ctx.row_min = 0;
+	if( ctx.row_max > sConfiguration.yres )
+		ctx.row_max = sConfiguration.yres;
+	ctx.rnd_key[ 0 ] = sMtRandomKey[ 0 ];
+	ctx.rnd_key[ 1 ] = sMtRandomKey[ 1 ];
+	ctx.killed = spMtKilled + band->row_start * sConfiguration.xres;
+	ctx.killed_count = 0;
+	ctx.defer = 0;
+	ctx.changes = spMtChanges ? spMtChanges + band->row_start * sConfiguration.xres : NULL;
+	ctx.changes_count = 0;
+	memset( &ctx.stats, 0, sizeof( ctx.stats ) );
+	ctx.max_move = 0.0f;
+
+	count = band->count;
+	deferred = 0;
+	for( i = 0; i < count; i++ )
+	{
+		res = solver_cpu_st_update_particle_state( &ctx, list[ i ] );
+		if( res == STEP_CONTINUE )
+			res = solver_cpu_st_update_particle_position( &ctx, list[ i ] );
+
+		if( res == STEP_DEFERRED )
+			list[ deferred++ ] = list[ i ];
+		else
+			chunks_cpu_st_track( touch, list[ i ], res, ctx.sdt );
+	}
+
+	band->count = deferred;
+	band->killed_count = ctx.killed_count;
+	band->changes_count = ctx.changes_count;
+	band->stats = ctx.stats;
+	band->max_move = ctx.max_move;
+	TRACE_END( "band", worker, ( sMtJobOffset + job ) * 2 + sMtPhase, trace );
+}
+
+// Finish step of sliced update after its particles.
+static int finish_slice( pp_time_t dt )
+{
+	double t = stats_begin( );
+	double trace = TRACE_BEGIN( );
+
+	chunks_cpu_st_end_frame( dt );
+	compact_cpu_st_auto( sMtSpan );
+	stats_lap( &sStatsNext.finish_ms, t );
+	TRACE_END( "finish", 0, -1, trace );
+
+	sMtStage = MT_STAGE_IDLE;
+	return 1;
+}
+
+int solver_cpu_mt_update_slice( pp_time_t dt, double deadline )
+{
+	struct PPStepContext * ctx = &sMtCtx;
+	struct PPBand * band;
+	unsigned char * touch = chunks_cpu_st_get_touch( 0 );
+	int i, j, res, jobs, group;
+	int * list;
+	double t, trace, trace_deferred;
+
+	if( sMtStage == MT_STAGE_FINISH )
+		return finish_slice( dt );
+
+	if( sMtStage == MT_STAGE_IDLE )
+	{
+		t = stats_begin( );
+		trace = TRACE_BEGIN( );
+		changes_cpu_st_begin( );
+		solver_cpu_st_update_air( dt );
+		t = stats_lap( &sStatsNext.air_ms, t );
+		TRACE_END( "air", 0, -1, trace );
+
+		trace = TRACE_BEGIN( );
+		solver_cpu_st_swap_streams( );
+		solver_cpu_st_prepare_types( dt );
+		distance_cpu_st_flush( );
+		heat_cpu_st_update( spWorkers, sMtThreads, dt );
+		stats_lap( &sStatsNext.heat_ms, t );
+		TRACE_END( "heat", 0, -1, trace );
+
+		sMtDt = dt;
+		solver_cpu_st_begin_frame( ctx );
+		sMtRandomKey[ 0 ] = ctx->rnd_key[ 0 ];
+		sMtRandomKey[ 1 ] = ctx->rnd_key[ 1 ];
+
+		collect( );
+
+		sMtStage = MT_STAGE_EVEN;
+		sMtNextBand = 0;
+		if( deadline > 0.0 && timer_ms( ) >= deadline )
+			return 0;
+	}
+
+	t = stats_begin( );
+	trace = TRACE_BEGIN( );
+
+	// with deadline bands of a phase run in groups of one band per thread, deadline is checked between groups
+	while( sMtStage != MT_STAGE_IDLE )
+	{
+		sMtPhase = sMtStage == MT_STAGE_EVEN ? 0 : 1;
+		jobs = ( sMtBandCount + 1 - sMtPhase ) / 2;
+		group = deadline > 0.0 ? sMtThreads : jobs;
+		while( sMtNextBand < jobs )
+		{
+			sMtJobOffset = sMtNextBand;
+			group = group < jobs - sMtNextBand ? group : jobs - sMtNextBand;
+			workers_run_limited( spWorkers, update_job, NULL, group, sMtThreads );
+			sMtNextBand += group;
+			if( sMtNextBand < jobs && deadline > 0.0 && timer_ms( ) >= deadline )
+				break;
+		}
+
+		if( sMtNextBand < jobs )
+		{
+			sMtJobOffset = 0;
+			stats_lap( &sStatsNext.particles_ms, t );
+			TRACE_END( "particles", 0, -1, trace );
+			return 0;
+		}
+
+		sMtStage = sMtStage == MT_STAGE_EVEN ? MT_STAGE_ODD : MT_STAGE_IDLE;
+		sMtNextBand = 0;
+	}
+	sMtJobOffset = 0;
+
+	// return killed particles to free list
+	for( i = 0, band = spMtBands; i < sMtBandCount; i++, band++ )
+	{
+		list = spMtKilled + band->row_start * sConfiguration.xres;
+		for( j = 0; j < band->killed_count; j++ )
+			free_part( list[ j ] );
+	}
+
+	// changes of bands are appended in order they were made, even bands first
+	if( spMtChanges )
+		for( j = 0; j < 2; j++ )
+			for( i = j; i < sMtBandCount; i += 2 )
+				changes_cpu_st_append( spMtChanges + spMtBands[ i ].row_start * sConfiguration.xres, spMtBands[ i ].changes_count );
+
+	// finish deferred particles on the whole map
+	trace_deferred = TRACE_BEGIN( );
+	ctx->dt = dt;
+	ctx->sdt = FLT_SECOND * dt;
+	ctx->row_min = 0;
+	ctx->row_max = sConfiguration.yres;
+	ctx->killed = NULL;
+	ctx->killed_count = 0;
+	ctx->defer = 0;
+	ctx->changes = NULL;
+	ctx->changes_count = 0;
+	memset( &ctx->stats, 0, sizeof( ctx->stats ) );
+	ctx->max_move = 0.0f;
+
+	for( i = 0, band = spMtBands; i < sMtBandCount; i++, band++ )
+	{
+		stats_add_step( &band->stats );
+		if( band->max_move > ctx->max_move )
+			ctx->max_move = band->max_move;
+		list = spMtParticles + band->row_start * sConfiguration.xres;
+		for( j = 0; j < band->count; j++ )
+		{
+			res = solver_cpu_st_update_particle_position( ctx, list[ j ] );
+			chunks_cpu_st_track( touch, list[ j ], res, ctx->sdt );
+		}
+	}
+
+	TRACE_END( "deferred", 0, -1, trace_deferred );
+	sMaxSpeed = dt > 0 ? ctx->max_move / ctx->sdt : 0.0f;
+	stats_add_step( &ctx->stats );
+	stats_lap( &sStatsNext.particles_ms, t );
+	TRACE_END( "particles", 0, -1, trace );
+
+	sMtStage = MT_STAGE_FINISH;
+	if( deadline > 0.0 && timer_ms( ) >= deadline )
+		return 0;
+
+	return finish_slice( dt );
+}
+
+void solver_cpu_mt_update( pp_time_t dt )
+{
+	solver_cpu_mt_update_slice( dt, 0.0 );
+}
+
+
+
+const struct PPSolver sSolverCpuMt =
+{
+	"cpu_mt",
+	solver_cpu_mt_init,
+	solver_cpu_mt_deinit,
+	solver_cpu_mt_attach,
+	solver_cpu_mt_detach,
+	solver_cpu_mt_update,
+	solver_cpu_mt_update_slice,
+	solver_cpu_st_end_frame,
+	solver_cpu_st_get_max_speed,
+	solver_cpu_st_get_alive_particles_count,
+	solver_cpu_st_get_alive_particles,
+	solver_cpu_st_get_particles_info_stream,
+	solver_cpu_st_get_particles_phys_info_stream,
+	solver_cpu_st_get_particles_phys_info_stream_last,
+	solver_cpu_st_get_air_particle_stream,
+	solver_cpu_st_get_air_particle_stream_last,
+	solver_cpu_st_pack_air,
+	solver_cpu_st_spawn_at,
+	solver_cpu_st_spawn_rect,
+	solver_cpu_st_spawn_records,
+	solver_cpu_st_collision_set,
+	solver_cpu_st_collision_import,
+	compact_cpu_st_run,
+	chunks_cpu_st_get_dirty_rect,
+	changes_cpu_st_get,
+	render_cpu_st_run,
+	positions_cpu_st_export,
+	solver_cpu_st_get_state_sections,
+	solver_cpu_st_check_state,
+	solver_cpu_st_state_loaded,
+	solver_cpu_st_get_derived_sections,
+};
\ No newline at end of file
@@ -0,0 +1,27 @@
+#ifndef __POWDER_SOLVER_CPU_MT_H__
+#define __POWDER_SOLVER_CPU_MT_H__
+
+
+#include "shared/types.h"
+
+
+
+// Multithreaded CPU solver shares particles storage with single threaded one
+// and only replaces the particles update, so the rest of solver interface
+// is provided by solver_cpu_st_* functions.
+//
+// Bands keep order of alive list, but particles moving out of reach of their band are moved
+// after all bands, and the lower bands are, the more results drift from single threaded solver. In bench dam
+// scene with 4 threads centroid x after 240 frames is 101.3 against 98.4 at 256x256 and
+// 140.8 against 134.5 at 512x512. With one thread and so taller bands it's 98.4 and 136.1.
+
+int solver_cpu_mt_init( );
+int solver_cpu_mt_deinit( );
+int solver_cpu_mt_attach( );
+int solver_cpu_mt_detach( );
+void solver_cpu_mt_update( pp_time_t dt );
+//! Run step until 'deadline' of timer_ms, 0 for no deadline. Returns 1 if the step is complete, otherwise the next call continues it.
+int solver_cpu_mt_update_slice( pp_time_t dt, double deadline );
+
+
+#endif // __POWDER_SOLVER_CPU_MT_H__
\ No newline at end of file
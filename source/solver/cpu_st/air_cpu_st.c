@@ -0,0 +1,404 @@
+#include "pch.h"
+#include "air_cpu_st.h"
+#include "shared/workers.h"
+#include "shared/cpu.h"
+#include "solver/trace.h"
+#include <math.h>
+
+
+
+extern struct PPConstants sConstants;
+
+extern float * spAirVx;
+extern float * spAirVy;
+extern float * spAirP;
+extern float * spAirVxLast;
+extern float * spAirVyLast;
+extern float * spAirPLast;
+extern float * spAirOpen;
+extern int sAirStride;
+extern int sGridX;
+extern int sGridY;
+
+
+
+//! Arguments of air kernel for cells of one row. Pointers point to the first cell of block.
+struct PPAirSpan
+{
+	const float * hvx[ 3 ];		//!< Horizontally blurred vx of rows y - 1, y and y + 1.
+	const float * hvy[ 3 ];		//!< Horizontally blurred vy of rows y - 1, y and y + 1.
+	const float * hp[ 3 ];		//!< Horizontally blurred pressure of rows y - 1, y and y + 1.
+	const float * vx;			//!< Previous vx of row y.
+	const float * p;			//!< Previous pressure of row y.
+	const float * vy_up;		//!< Previous vy of row y - 1. Row y for the first and the last rows, so the difference is zero.
+	const float * vy_down;		//!< Previous vy of row y + 1. Row y for the first and the last rows.
+	const float * p_up;			//!< Previous pressure of row y - 1. Row y for the first and the last rows.
+	const float * p_down;		//!< Previous pressure of row y + 1. Row y for the first and the last rows.
+	const float * open;			//!< 1 for open cells, 0 for collision cells.
+	float * out_vx;
+	float * out_vy;
+	float * out_p;
+};
+
+//! Per frame coefficients.
+struct PPAirCoefficients
+{
+	float g0;		//!< Center weight of separated gaussian.
+	float g1;		//!< Side weight of separated gaussian.
+	float v_loss;	//!< Velocity loss factor.
+	float p_loss;	//!< Pressure loss factor.
+	float kv;		//!< Velocity dependency of pressure gradient.
+	float kp;		//!< Pressure dependency of velocity gradient.
+};
+
+//! Tiles of one parallel air update.
+struct PPAirTiles
+{
+	int size;			//!< Tile size in cells.
+	int columns;		//!< Number of tiles in a row.
+	float * scratch;	//!< Scratch memory of all threads.
+	int scratch_size;	//!< Scratch size of one thread.
+};
+
+typedef void (* PPAirBlurFn) ( const float * src, float * dst, int count );
+typedef void (* PPAirSpanFn) ( const struct PPAirSpan * s, int begin, int end );
+
+struct PPAirCoefficients sAirCoefficients;
+PPAirBlurFn sAirBlurFn = NULL;
+PPAirSpanFn sAirSpanFn = NULL;
+const char * sAirKernelsName = "";
+
+
+
+
+
+//
+// scalar kernels
+//
+
+static void air_blur_scalar( const float * src, float * dst, int count )
+{
+	float g0 = sAirCoefficients.g0;
+	float g1 = sAirCoefficients.g1;
+	int i;
+
+	for( i = 0; i < count; i++ )
+		dst[ i ] = g1 * ( src[ i - 1 ] + src[ i + 1 ] ) + g0 * src[ i ];
+}
+
+static void air_span_scalar( const struct PPAirSpan * s, int begin, int end )
+{
+	const struct PPAirCoefficients * c = &sAirCoefficients;
+	float avgx, avgy, avgp, dx, dy, dp;
+	int i;
+
+	for( i = begin; i < end; i++ )
+	{
+		avgx = c->g1 * ( s->hvx[ 0 ][ i ] + s->hvx[ 2 ][ i ] ) + c->g0 * s->hvx[ 1 ][ i ];
+		avgy = c->g1 * ( s->hvy[ 0 ][ i ] + s->hvy[ 2 ][ i ] ) + c->g0 * s->hvy[ 1 ][ i ];
+		avgp = c->g1 * ( s->hp[ 0 ][ i ] + s->hp[ 2 ][ i ] ) + c->g0 * s->hp[ 1 ][ i ];
+
+		dx = s->p[ i + 1 ] - s->p[ i - 1 ];
+		dy = s->p_down[ i ] - s->p_up[ i ];
+		dp = ( s->vy_down[ i ] - s->vy_up[ i ] ) + ( s->vx[ i + 1 ] - s->vx[ i - 1 ] );
+
+		s->out_vx[ i ] = s->open[ i ] * ( avgx * c->v_loss - dx * c->kv );
+		s->out_vy[ i ] = s->open[ i ] * ( avgy * c->v_loss - dy * c->kv );
+		s->out_p[ i ] = s->open[ i ] * ( avgp * c->p_loss - dp * c->kp );
+	}
+}
+
+// First and last columns have no horizontal differences.
+static void air_edge_cell( const struct PPAirSpan * s, int i )
+{
+	const struct PPAirCoefficients * c = &sAirCoefficients;
+	float avgx, avgy, avgp, dy, dp;
+
+	avgx = c->g1 * ( s->hvx[ 0 ][ i ] + s->hvx[ 2 ][ i ] ) + c->g0 * s->hvx[ 1 ][ i ];
+	avgy = c->g1 * ( s->hvy[ 0 ][ i ] + s->hvy[ 2 ][ i ] ) + c->g0 * s->hvy[ 1 ][ i ];
+	avgp = c->g1 * ( s->hp[ 0 ][ i ] + s->hp[ 2 ][ i ] ) + c->g0 * s->hp[ 1 ][ i ];
+
+	dy = s->p_down[ i ] - s->p_up[ i ];
+	dp = s->vy_down[ i ] - s->vy_up[ i ];
+
+	s->out_vx[ i ] = s->open[ i ] * ( avgx * c->v_loss );
+	s->out_vy[ i ] = s->open[ i ] * ( avgy * c->v_loss - dy * c->kv );
+	s->out_p[ i ] = s->open[ i ] * ( avgp * c->p_loss - dp * c->kp );
+}
+
+
+
+#ifdef CPU_X86
+
+//
+// SSE2 kernels
+//
+
+static CPU_TARGET_SSE2 void air_blur_sse2( const float * src, float * dst, int count )
+{
+	__m128 g0 = _mm_set1_ps( sAirCoefficients.g0 );
+	__m128 g1 = _mm_set1_ps( sAirCoefficients.g1 );
+	int i;
+
+	for( i = 0; i + 4 <= count; i += 4 )
+		_mm_storeu_ps( dst + i, _mm_add_ps(
+			_mm_mul_ps( g1, _mm_add_ps( _mm_loadu_ps( src + i - 1 ), _mm_loadu_ps( src + i + 1 ) ) ),
+			_mm_mul_ps( g0, _mm_loadu_ps( src + i ) ) ) );
+
+	for( ; i < count; i++ )
+		dst[ i ] = sAirCoefficients.g1 * ( src[ i - 1 ] + src[ i + 1 ] ) + sAirCoefficients.g0 * src[ i ];
+}
+
+#define AIR_SSE2_BLUR3( h, i ) _mm_add_ps( \
+	_mm_mul_ps( g1, _mm_add_ps( _mm_loadu_ps( h[ 0 ] + i ), _mm_loadu_ps( h[ 2 ] + i ) ) ), \
+	_mm_mul_ps( g0, _mm_loadu_ps( h[ 1 ] + i ) ) )
+
+static CPU_TARGET_SSE2 void air_span_sse2( const struct PPAirSpan * s, int begin, int end )
+{
+	__m128 g0 = _mm_set1_ps( sAirCoefficients.g0 );
+	__m128 g1 = _mm_set1_ps( sAirCoefficients.g1 );
+	__m128 v_loss = _mm_set1_ps( sAirCoefficients.v_loss );
+	__m128 p_loss = _mm_set1_ps( sAirCoefficients.p_loss );
+	__m128 kv = _mm_set1_ps( sAirCoefficients.kv );
+	__m128 kp = _mm_set1_ps( sAirCoefficients.kp );
+	__m128 open, dx, dy, dp;
+	int i;
+
+	for( i = begin; i + 4 <= end; i += 4 )
+	{
+		open = _mm_loadu_ps( s->open + i );
+
+		dx = _mm_sub_ps( _mm_loadu_ps( s->p + i + 1 ), _mm_loadu_ps( s->p + i - 1 ) );
+		dy = _mm_sub_ps( _mm_loadu_ps( s->p_down + i ), _mm_loadu_ps( s->p_up + i ) );
+		dp = _mm_add_ps( _mm_sub_ps( _mm_loadu_ps( s->vy_down + i ), _mm_loadu_ps( s->vy_up + i ) ),
+			_mm_sub_ps( _mm_loadu_ps( s->vx + i + 1 ), _mm_loadu_ps( s->vx + i - 1 ) ) );
+
+		_mm_storeu_ps( s->out_vx + i, _mm_mul_ps( open, _mm_sub_ps( _mm_mul_ps( AIR_SSE2_BLUR3( s->hvx, i ), v_loss ), _mm_mul_ps( dx, kv ) ) ) );
+		_mm_storeu_ps( s->out_vy + i, _mm_mul_ps( open, _mm_sub_ps( _mm_mul_ps( AIR_SSE2_BLUR3( s->hvy, i ), v_loss ), _mm_mul_ps( dy, kv ) ) ) );
+		_mm_storeu_ps( s->out_p + i, _mm_mul_ps( open, _mm_sub_ps( _mm_mul_ps( AIR_SSE2_BLUR3( s->hp, i ), p_loss ), _mm_mul_ps( dp, kp ) ) ) );
+	}
+
+	air_span_scalar( s, i, end );
+}
+
+
+
+//
+// AVX2 kernels
+//
+
+static CPU_TARGET_AVX2 void air_blur_avx2( const float * src, float * dst, int count )
+{
+	__m256 g0 = _mm256_set1_ps( sAirCoefficients.g0 );
+	__m256 g1 = _mm256_set1_ps( sAirCoefficients.g1 );
+	int i;
+
+	for( i = 0; i + 8 <= count; i += 8 )
+		_mm256_storeu_ps( dst + i, _mm256_add_ps(
+			_mm256_mul_ps( g1, _mm256_add_ps( _mm256_loadu_ps( src + i - 1 ), _mm256_loadu_ps( src + i + 1 ) ) ),
+			_mm256_mul_ps( g0, _mm256_loadu_ps( src + i ) ) ) );
+
+	for( ; i < count; i++ )
+		dst[ i ] = sAirCoefficients.g1 * ( src[ i - 1 ] + src[ i + 1 ] ) + sAirCoefficients.g0 * src[ i ];
+}
+
+#define AIR_AVX2_BLUR3( h, i ) _mm256_add_ps( \
+	_mm256_mul_ps( g1, _mm256_add_ps( _mm256_loadu_ps( h[ 0 ] + i ), _mm256_loadu_ps( h[ 2 ] + i ) ) ), \
+	_mm256_mul_ps( g0, _mm256_loadu_ps( h[ 1 ] + i ) ) )
+
+static CPU_TARGET_AVX2 void air_span_avx2( const struct PPAirSpan * s, int begin, int end )
+{
+	__m256 g0 = _mm256_set1_ps( sAirCoefficients.g0 );
+	__m256 g1 = _mm256_set1_ps( sAirCoefficients.g1 );
+	__m256 v_loss = _mm256_set1_ps( sAirCoefficients.v_loss );
+	__m256 p_loss = _mm256_set1_ps( sAirCoefficients.p_loss );
+	__m256 kv = _mm256_set1_ps( sAirCoefficients.kv );
+	__m256 kp = _mm256_set1_ps( sAirCoefficients.kp );
+	__m256 open, dx, dy, dp;
+	int i;
+
+	for( i = begin; i + 8 <= end; i += 8 )
+	{
+		open = _mm256_loadu_ps( s->open + i );
+
+		dx = _mm256_sub_ps( _mm256_loadu_ps( s->p + i + 1 ), _mm256_loadu_ps( s->p + i - 1 ) );
+		dy = _mm256_sub_ps( _mm256_loadu_ps( s->p_down + i ), _mm256_loadu_ps( s->p_up + i ) );
+		dp = _mm256_add_ps( _mm256_sub_ps( _mm256_loadu_ps( s->vy_down + i ), _mm256_loadu_ps( s->vy_up + i ) ),
+			_mm256_sub_ps( _mm256_loadu_ps( s->vx + i + 1 ), _mm256_loadu_ps( s->vx + i - 1 ) ) );
+
+		_mm256_storeu_ps( s->out_vx + i, _mm256_mul_ps( open, _mm256_sub_ps( _mm256_mul_ps( AIR_AVX2_BLUR3( s->hvx, i ), v_loss ), _mm256_mul_ps( dx, kv ) ) ) );
+		_mm256_storeu_ps( s->out_vy + i, _mm256_mul_ps( open, _mm256_sub_ps( _mm256_mul_ps( AIR_AVX2_BLUR3( s->hvy, i ), v_loss ), _mm256_mul_ps( dy, kv ) ) ) );
+		_mm256_storeu_ps( s->out_p + i, _mm256_mul_ps( open, _mm256_sub_ps( _mm256_mul_ps( AIR_AVX2_BLUR3( s->hp, i ), p_loss ), _mm256_mul_ps( dp, kp ) ) ) );
+	}
+
+	air_span_scalar( s, i, end );
+}
+
+#endif // CPU_X86
+
+
+
+
+
+void air_cpu_st_init_kernels( )
+{
+	float g1 = expf( -2.0f );
+
+	// 3x3 gaussian exp(-2(i*i + j*j)) is a product of two 1D kernels
+	sAirCoefficients.g0 = 1.0f / ( 1.0f + 2.0f * g1 );
+	sAirCoefficients.g1 = g1 / ( 1.0f + 2.0f * g1 );
+
+	sAirBlurFn = air_blur_scalar;
+	sAirSpanFn = air_span_scalar;
+	sAirKernelsName = "scalar";
+
+#ifdef CPU_X86
+	if( cpu_has_avx2( ) )
+	{
+		sAirBlurFn = air_blur_avx2;
+		sAirSpanFn = air_span_avx2;
+		sAirKernelsName = "avx2";
+	}
+	else if( cpu_has_sse2( ) )
+	{
+		sAirBlurFn = air_blur_sse2;
+		sAirSpanFn = air_span_sse2;
+		sAirKernelsName = "sse2";
+	}
+#endif
+}
+
+const char * air_cpu_st_get_kernels_name( )
+{
+	return sAirKernelsName;
+}
+
+int air_cpu_st_get_scratch_size( int width )
+{
+	return 9 * width;
+}
+
+void air_cpu_st_begin( pp_time_t dt )
+{
+	float sdt = FLT_SECOND * dt;
+
+	sAirCoefficients.p_loss = ( float ) pow( sConstants.p_loss, ( float ) dt * FLT_SECOND );
+	sAirCoefficients.v_loss = ( float ) pow( sConstants.v_loss, ( float ) dt * FLT_SECOND );
+	sAirCoefficients.kv = sConstants.v_hstep * sdt;
+	sAirCoefficients.kp = sConstants.p_hstep * sdt;
+}
+
+static void air_blur_row( int x0, int y, int width, float * dst )
+{
+	sAirBlurFn( spAirVxLast + AIR_INDEX( x0, y ), dst, width );
+	sAirBlurFn( spAirVyLast + AIR_INDEX( x0, y ), dst + width, width );
+	sAirBlurFn( spAirPLast + AIR_INDEX( x0, y ), dst + 2 * width, width );
+}
+
+void air_cpu_st_update_block( int x0, int y0, int x1, int y1, float * scratch )
+{
+	struct PPAirSpan s;
+	float * rows[ 3 ];
+	int width = x1 - x0;
+	int ix0, ix1;
+	int y, k, row, up, down;
+
+	// ring of three horizontally blurred rows, row y is kept in rows[ y % 3 ]
+	for( k = 0; k < 3; k++ )
+		rows[ k ] = scratch + k * 3 * width;
+
+	// rows outside of the grid are zero border, they are blurred to zero too
+	air_blur_row( x0, y0 - 1, width, rows[ ( y0 + 2 ) % 3 ] );
+	air_blur_row( x0, y0, width, rows[ y0 % 3 ] );
+
+	// interior columns
+	ix0 = x0 > 1 ? x0 : 1;
+	ix1 = x1 < sGridX - 1 ? x1 : sGridX - 1;
+
+	for( y = y0; y < y1; y++ )
+	{
+		air_blur_row( x0, y + 1, width, rows[ ( y + 1 ) % 3 ] );
+
+		for( k = 0; k < 3; k++ )
+		{
+			row = ( y + 2 + k ) % 3;
+			s.hvx[ k ] = rows[ row ];
+			s.hvy[ k ] = rows[ row ] + width;
+			s.hp[ k ] = rows[ row ] + 2 * width;
+		}
+
+		// first and last rows have no vertical differences
+		up = down = y;
+		if( y > 0 && y < sGridY - 1 )
+		{
+			up = y - 1;
+			down = y + 1;
+		}
+
+		s.vx = spAirVxLast + AIR_INDEX( x0, y );
+		s.p = spAirPLast + AIR_INDEX( x0, y );
+		s.vy_up = spAirVyLast + AIR_INDEX( x0, up );
+		s.vy_down = spAirVyLast + AIR_INDEX( x0, down );
+		s.p_up = spAirPLast + AIR_INDEX( x0, up );
+		s.p_down = spAirPLast + AIR_INDEX( x0, down );
+		s.open = spAirOpen + AIR_INDEX( x0, y );
+		s.out_vx = spAirVx + AIR_INDEX( x0, y );
+		s.out_vy = spAirVy + AIR_INDEX( x0, y );
+		s.out_p = spAirP + AIR_INDEX( x0, y );
+
+		if( x0 == 0 )
+			air_edge_cell( &s, 0 );
+
+		if( ix1 > ix0 )
+			sAirSpanFn( &s, ix0 - x0, ix1 - x0 );
+
+		if( x1 == sGridX && sGridX - 1 > 0 )
+			air_edge_cell( &s, sGridX - 1 - x0 );
+	}
+}
+
+static void air_tile_job( void * user, int job, int worker )
+{
+	const struct PPAirTiles * tiles = ( const struct PPAirTiles * ) user;
+	int x0 = ( job % tiles->columns ) * tiles->size;
+	int y0 = ( job / tiles->columns ) * tiles->size;
+	int x1 = x0 + tiles->size < sGridX ? x0 + tiles->size : sGridX;
+	int y1 = y0 + tiles->size < sGridY ? y0 + tiles->size : sGridY;
+	double trace = TRACE_BEGIN( );
+
+	air_cpu_st_update_block( x0, y0, x1, y1, tiles->scratch + worker * tiles->scratch_size );
+	TRACE_END( "air tile", worker, job, trace );
+}
+
+void air_cpu_st_update_tiles( struct PPWorkers * workers, int threads, int tile_size, float * scratch )
+{
+	struct PPAirTiles tiles;
+	int rows;
+
+	tiles.size = tile_size;
+	tiles.columns = ( sGridX + tile_size - 1 ) / tile_size;
+	tiles.scratch = scratch;
+	tiles.scratch_size = air_cpu_st_get_scratch_size( tile_size < sGridX ? tile_size : sGridX );
+	rows = ( sGridY + tile_size - 1 ) / tile_size;
+
+	workers_run_limited( workers, air_tile_job, &tiles, tiles.columns * rows, threads );
+}
+
+float air_cpu_st_get_max_velocity( )
+{
+	int i, count = sAirStride * ( sGridY + 2 );
+	float v, max = 0.0f;
+
+	// border cells are always zero
+	for( i = 0; i < count; i++ )
+	{
+		v = fabsf( spAirVx[ i ] );
+		if( v > max )
+			max = v;
+		v = fabsf( spAirVy[ i ] );
+		if( v > max )
+			max = v;
+	}
+
+	return max;
+}
\ No newline at end of file
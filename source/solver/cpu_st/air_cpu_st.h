@@ -0,0 +1,38 @@
+#ifndef __POWDER_AIR_CPU_ST_H__
+#define __POWDER_AIR_CPU_ST_H__
+
+
+#include "shared/types.h"
+
+
+
+// Air grid is stored as structure of arrays. Every array has one cell of zero border
+// around the grid, so interior cells are processed without bounds checks.
+// Cell (x, y) is at AIR_INDEX( x, y ).
+
+#define AIR_INDEX( x, y ) ( ( ( y ) + 1 ) * sAirStride + ( x ) + 1 )
+
+
+
+struct PPWorkers;
+
+
+
+//! Select air kernels for current CPU.
+void air_cpu_st_init_kernels( );
+//! Name of selected kernels set.
+const char * air_cpu_st_get_kernels_name( );
+//! Number of floats of scratch memory needed to update block of given width.
+int air_cpu_st_get_scratch_size( int width );
+//! Prepare coefficients for frame.
+void air_cpu_st_begin( pp_time_t dt );
+//! Update block [x0, x1) x [y0, y1) of air grid from previous air arrays.
+void air_cpu_st_update_block( int x0, int y0, int x1, int y1, float * scratch );
+//! Update the whole air grid by square tiles on worker threads. Every thread needs scratch of tile width, placed one after another.
+//! Result is bit-identical to a single block update.
+void air_cpu_st_update_tiles( struct PPWorkers * workers, int threads, int tile_size, float * scratch );
+//! Largest velocity component of air grid.
+float air_cpu_st_get_max_velocity( );
+
+
+#endif // __POWDER_AIR_CPU_ST_H__
\ No newline at end of file
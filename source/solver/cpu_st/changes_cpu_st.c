@@ -0,0 +1,199 @@
+#include "pch.h"
+#include "changes_cpu_st.h"
+#include "solver_cpu_st.h"
+#include "shared/utils.h"
+#include <string.h>
+
+
+
+extern struct PPConfiguration sConfiguration;
+extern struct PPParticleMap * spParticleMap;
+
+struct PPParticleChange * spChanges = NULL;		//!< Particle changes, xres * yres records. NULL if recording is disabled.
+int sChangesCount;
+struct PPCellChange * spChangedCells = NULL;	//!< Distinct changed cells, xres * yres records.
+int sChangedCellsCount;
+int sChangesCollected;							//!< Number of particle changes, whose cells are collected already.
+unsigned char * spChangedMarks = NULL;			//!< Cell is in spChangedCells.
+int sChangesFinished;							//!< Frame is over, next change of the world starts new lists.
+struct PPChanges sChanges;
+
+
+
+
+
+int changes_cpu_st_init( )
+{
+	int num_parts = sConfiguration.xres * sConfiguration.yres;
+
+	if( !sConfiguration.change_lists )
+		return 1;
+
+	spChanges = malloc_log( sizeof( struct PPParticleChange ) * num_parts );
+	if( !spChanges )
+	{
+		changes_cpu_st_deinit( );
+		return 0;
+	}
+
+	spChangedCells = malloc_log( sizeof( struct PPCellChange ) * num_parts );
+	if( !spChangedCells )
+	{
+		changes_cpu_st_deinit( );
+		return 0;
+	}
+
+	spChangedMarks = malloc_log( num_parts );
+	if( !spChangedMarks )
+	{
+		changes_cpu_st_deinit( );
+		return 0;
+	}
+
+	memset( spChangedMarks, 0, num_parts );
+	memset( &sChanges, 0, sizeof( sChanges ) );
+	sChangesCount = 0;
+	sChangedCellsCount = 0;
+	sChangesCollected = 0;
+	sChangesFinished = 0;
+
+	return 1;
+}
+
+void changes_cpu_st_deinit( )
+{
+	free( spChanges );
+	free( spChangedCells );
+	free( spChangedMarks );
+	spChanges = NULL;
+	spChangedCells = NULL;
+	spChangedMarks = NULL;
+}
+
+int changes_cpu_st_enabled( )
+{
+	return spChanges != NULL;
+}
+
+void changes_cpu_st_begin( )
+{
+	int i;
+
+	if( !spChanges || !sChangesFinished )
+		return;
+
+	for( i = 0; i < sChangedCellsCount; i++ )
+		spChangedMarks[ spChangedCells[ i ].y * sConfiguration.xres + spChangedCells[ i ].x ] = 0;
+
+	sChangesCount = 0;
+	sChangedCellsCount = 0;
+	sChangesCollected = 0;
+	sChanges.overflow = 0;
+	sChanges.compacted = 0;
+	sChanges.reloaded = 0;
+	sChangesFinished = 0;
+}
+
+void changes_cpu_st_add( int index, int x0, int y0, int x1, int y1 )
+{
+	struct PPParticleChange * change;
+
+	if( sChangesCount == sConfiguration.xres * sConfiguration.yres )
+	{
+		sChanges.overflow = 1;
+		return;
+	}
+
+	change = spChanges + sChangesCount++;
+	change->index = index;
+	change->x0 = x0;
+	change->y0 = y0;
+	change->x1 = x1;
+	change->y1 = y1;
+}
+
+void changes_cpu_st_append( const struct PPParticleChange * changes, int count )
+{
+	int num_parts = sConfiguration.xres * sConfiguration.yres;
+
+	if( count > num_parts - sChangesCount )
+	{
+		count = num_parts - sChangesCount;
+		sChanges.overflow = 1;
+	}
+
+	memcpy( spChanges + sChangesCount, changes, sizeof( struct PPParticleChange ) * count );
+	sChangesCount += count;
+}
+
+void changes_cpu_st_cell( int x, int y )
+{
+	struct PPCellChange * cell;
+
+	if( x < 0 || y < 0 || x >= sConfiguration.xres || y >= sConfiguration.yres )
+		return;
+
+	if( spChangedMarks[ y * sConfiguration.xres + x ] )
+		return;
+
+	spChangedMarks[ y * sConfiguration.xres + x ] = 1;
+	cell = spChangedCells + sChangedCellsCount++;
+	cell->x = x;
+	cell->y = y;
+}
+
+void changes_cpu_st_compacted( )
+{
+	if( !spChanges )
+		return;
+
+	changes_cpu_st_begin( );
+	sChanges.compacted = 1;
+}
+
+void changes_cpu_st_reloaded( )
+{
+	if( !spChanges )
+		return;
+
+	changes_cpu_st_begin( );
+	sChanges.reloaded = 1;
+}
+
+void changes_cpu_st_end_frame( )
+{
+	sChangesFinished = 1;
+}
+
+const struct PPChanges * changes_cpu_st_get( )
+{
+	const struct PPParticleChange * change;
+	struct PPCellChange * cell;
+	const struct PPParticleMap * pmap;
+	int i;
+
+	if( !spChanges )
+		return NULL;
+
+	for( ; sChangesCollected < sChangesCount; sChangesCollected++ )
+	{
+		change = spChanges + sChangesCollected;
+		changes_cpu_st_cell( change->x0, change->y0 );
+		changes_cpu_st_cell( change->x1, change->y1 );
+	}
+
+	// lists of unfinished frame may still grow, so cells are filled on every request
+	for( i = 0, cell = spChangedCells; i < sChangedCellsCount; i++, cell++ )
+	{
+		pmap = spParticleMap + cell->y * sConfiguration.xres + cell->x;
+		cell->type = pmap->type;
+		cell->index = pmap->type && !pmap->collision ? ( int ) pmap->index : -1;
+	}
+
+	sChanges.particles = spChanges;
+	sChanges.particles_count = sChangesCount;
+	sChanges.cells = spChangedCells;
+	sChanges.cells_count = sChangedCellsCount;
+
+	return &sChanges;
+}
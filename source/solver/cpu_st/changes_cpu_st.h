@@ -0,0 +1,40 @@
+#ifndef __POWDER_CHANGES_CPU_ST_H__
+#define __POWDER_CHANGES_CPU_ST_H__
+
+
+#include "shared/types.h"
+
+
+
+// Change lists hold what happened to the world since the previous update returned: particles
+// spawned, killed and moved to another cell in order of changes, and map cells touched by collision
+// edits. Lists of a finished frame are kept until the next change of the world. Update contexts
+// running in parallel write their own segments, which are appended in band order after the update.
+// Distinct cells of particle changes are collected and filled with cell contents on request, so
+// the update pays only for particle records.
+
+
+
+int changes_cpu_st_init( );
+void changes_cpu_st_deinit( );
+//! Is recording enabled?
+int changes_cpu_st_enabled( );
+//! Start lists of a new frame if the previous one is finished. Must be called before the world is changed.
+void changes_cpu_st_begin( );
+//! Append particle change. (x0, y0) is -1 for spawned particle, (x1, y1) is -1 for killed one.
+void changes_cpu_st_add( int index, int x0, int y0, int x1, int y1 );
+//! Append particle changes written by update context.
+void changes_cpu_st_append( const struct PPParticleChange * changes, int count );
+//! Record map cell changed outside of particle changes.
+void changes_cpu_st_cell( int x, int y );
+//! Particles were compacted and got new indices.
+void changes_cpu_st_compacted( );
+//! World state was overwritten.
+void changes_cpu_st_reloaded( );
+//! Finish frame, its lists stay valid until the next change of the world.
+void changes_cpu_st_end_frame( );
+//! Get lists of changes, NULL if recording is disabled.
+const struct PPChanges * changes_cpu_st_get( );
+
+
+#endif // __POWDER_CHANGES_CPU_ST_H__
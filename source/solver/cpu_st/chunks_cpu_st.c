@@ -0,0 +1,364 @@
+#include "pch.h"
+#include "chunks_cpu_st.h"
+#include "solver_cpu_st.h"
+#include "air_cpu_st.h"
+#include "shared/utils.h"
+#include "shared/workers.h"
+#include <math.h>
+#include <string.h>
+
+
+
+extern struct PPConfiguration sConfiguration;
+extern struct PPConstants sConstants;
+extern struct PPParticleInfo * spParticlesInfo;
+extern struct PPParticlePhysInfo * spParticlesPhysInfo;
+extern struct PPParticlePhysInfo * spParticlesPhysInfoLast;
+extern struct PPParticleMap * spParticleMap;
+extern struct PPWorkers * spWorkers;
+
+extern float * spHeat;
+extern float * spHeatLast;
+
+extern float * spAirVx;
+extern float * spAirVy;
+extern float * spAirP;
+extern float * spAirVxLast;
+extern float * spAirVyLast;
+extern float * spAirPLast;
+extern int sAirStride;
+extern int sGridX;
+extern int sGridY;
+
+int sChunkSize = 0;						//!< Chunk size in pixels, 0 if sleeping is disabled.
+int sChunksX;
+int sChunksY;
+struct PPChunk * spChunks = NULL;
+unsigned char * spChunkTouch = NULL;	//!< Activity flags of chunks, one array per worker thread.
+int sChunkTouchCount;					//!< Number of activity arrays.
+int sDirtyX0, sDirtyY0, sDirtyX1, sDirtyY1;
+
+
+
+
+
+int chunks_cpu_st_init( )
+{
+	int count, i;
+
+	sChunkSize = sConfiguration.chunk_size > 0 ? sConfiguration.chunk_size : 0;
+	sDirtyX0 = sDirtyY0 = 0;
+	sDirtyX1 = sConfiguration.xres;
+	sDirtyY1 = sConfiguration.yres;
+	if( !sChunkSize )
+		return 1;
+
+	sChunksX = ( sConfiguration.xres + sChunkSize - 1 ) / sChunkSize;
+	sChunksY = ( sConfiguration.yres + sChunkSize - 1 ) / sChunkSize;
+	count = sChunksX * sChunksY;
+
+	spChunks = malloc_log( sizeof( struct PPChunk ) * count );
+	if( !spChunks )
+	{
+		chunks_cpu_st_deinit( );
+		return 0;
+	}
+
+	// every thread marks activity in its own array, arrays are merged at the end of frame
+	sChunkTouchCount = workers_count( spWorkers );
+	spChunkTouch = malloc_log( count * sChunkTouchCount );
+	if( !spChunkTouch )
+	{
+		chunks_cpu_st_deinit( );
+		return 0;
+	}
+
+	for( i = 0; i < count; i++ )
+	{
+		spChunks[ i ].awake = 1;
+		spChunks[ i ].calm = 0;
+	}
+	memset( spChunkTouch, 0, count * sChunkTouchCount );
+
+	if( sConfiguration.log_fn )
+		sConfiguration.log_fn( LOG_INFO, "Sleeping chunks: size=%d, chunks=%dx%d.", sChunkSize, sChunksX, sChunksY );
+
+	return 1;
+}
+
+void chunks_cpu_st_deinit( )
+{
+	free( spChunks );
+	free( spChunkTouch );
+	spChunks = NULL;
+	spChunkTouch = NULL;
+	sChunkSize = 0;
+}
+
+int chunks_cpu_st_enabled( )
+{
+	return sChunkSize != 0;
+}
+
+unsigned char * chunks_cpu_st_get_touch( int worker )
+{
+	if( !sChunkSize )
+		return NULL;
+
+	return spChunkTouch + worker * sChunksX * sChunksY;
+}
+
+int chunks_cpu_st_collect( int row_start, int row_end, int * list, int * max_index )
+{
+	const struct PPChunk * chunk;
+	const struct PPParticleMap * pmap, * pend;
+	int count = 0;
+	int y, cx, x0, x1;
+
+	*max_index = -1;
+	for( y = row_start; y < row_end; y++ )
+	{
+		chunk = spChunks + ( y / sChunkSize ) * sChunksX;
+		for( cx = 0; cx < sChunksX; cx++, chunk++ )
+		{
+			if( !chunk->awake )
+				continue;
+
+			// merge runs of awake chunks
+			x0 = cx * sChunkSize;
+			while( cx + 1 < sChunksX && chunk[ 1 ].awake )
+			{
+				cx++;
+				chunk++;
+			}
+			x1 = ( cx + 1 ) * sChunkSize;
+			if( x1 > sConfiguration.xres )
+				x1 = sConfiguration.xres;
+
+			pmap = spParticleMap + y * sConfiguration.xres + x0;
+			pend = spParticleMap + y * sConfiguration.xres + x1;
+			for( ; pmap < pend; pmap++ )
+				if( pmap->type && !pmap->collision )
+				{
+					list[ count++ ] = pmap->index;
+					if( ( int ) pmap->index > *max_index )
+						*max_index = pmap->index;
+				}
+		}
+	}
+
+	return count;
+}
+
+// Chunks [cx0, cx1] x [cy0, cy1] touching cells [x0, x1) x [y0, y1) or their neighbours.
+static void chunks_around( int x0, int y0, int x1, int y1, int * cx0, int * cy0, int * cx1, int * cy1 )
+{
+	*cx0 = x0 > 0 ? ( x0 - 1 ) / sChunkSize : 0;
+	*cy0 = y0 > 0 ? ( y0 - 1 ) / sChunkSize : 0;
+	*cx1 = x1 / sChunkSize;
+	*cy1 = y1 / sChunkSize;
+	if( *cx1 >= sChunksX )
+		*cx1 = sChunksX - 1;
+	if( *cy1 >= sChunksY )
+		*cy1 = sChunksY - 1;
+}
+
+static void touch_around( unsigned char * touch, int x, int y )
+{
+	int cx0, cx1, cy0, cy1, cx, cy;
+
+	chunks_around( x, y, x + 1, y + 1, &cx0, &cy0, &cx1, &cy1 );
+	for( cy = cy0; cy <= cy1; cy++ )
+		for( cx = cx0; cx <= cx1; cx++ )
+			touch[ cy * sChunksX + cx ] = 1;
+}
+
+void chunks_cpu_st_track( unsigned char * touch, int i, int result, float sdt )
+{
+	const struct PPParticleInfo * parti = spParticlesInfo + i;
+	const struct PPParticlePhysInfo * partp = spParticlesPhysInfo + i;
+	const struct PPParticlePhysInfo * partpl = spParticlesPhysInfoLast + i;
+	int x, y, nx, ny;
+	float dtemp;
+
+	if( !touch )
+		return;
+
+	x = ( int ) partpl->x;
+	y = ( int ) partpl->y;
+
+	// dead particle frees its cell, neighbours may fall into it
+	if( result == STEP_KILLED )
+	{
+		touch_around( touch, x, y );
+		return;
+	}
+
+	nx = ( int ) partp->x;
+	ny = ( int ) partp->y;
+	if( nx != x || ny != y )
+	{
+		touch_around( touch, x, y );
+		touch_around( touch, nx, ny );
+	}
+	else
+	{
+		if( spHeat )
+			dtemp = spHeat[ y * sConfiguration.xres + x ] - spHeatLast[ y * sConfiguration.xres + x ];
+		else
+			dtemp = partp->temp - partpl->temp;
+
+		if( fabsf( dtemp ) > sConstants.sleep_temp * sdt )
+			touch_around( touch, x, y );
+		else if( parti->life >= 0 || !( parti->stagnant || parti->blocked ) )
+			touch[ ( y / sChunkSize ) * sChunksX + x / sChunkSize ] = 1;
+	}
+}
+
+void chunks_cpu_st_wake( int x, int y )
+{
+	chunks_cpu_st_wake_rect( x, y, x + 1, y + 1 );
+}
+
+void chunks_cpu_st_wake_rect( int x0, int y0, int x1, int y1 )
+{
+	struct PPChunk * chunk;
+	int cx0, cx1, cy0, cy1, cx, cy;
+
+	if( !sChunkSize )
+		return;
+
+	chunks_around( x0, y0, x1, y1, &cx0, &cy0, &cx1, &cy1 );
+	for( cy = cy0; cy <= cy1; cy++ )
+		for( cx = cx0; cx <= cx1; cx++ )
+		{
+			chunk = spChunks + cy * sChunksX + cx;
+			chunk->awake = 1;
+			chunk->calm = 0;
+		}
+}
+
+// Does air over chunk change fast enough to move its particles? Steady air doesn't wake chunks, particles which it
+// moves keep their chunk awake, and sleeping particles don't damp air, so air over calm pools keeps its speed for long.
+static int air_is_active( int cx, int cy, float sdt )
+{
+	int gx0 = cx * sChunkSize / sConfiguration.grid_size;
+	int gy0 = cy * sChunkSize / sConfiguration.grid_size;
+	int gx1 = ( ( cx + 1 ) * sChunkSize + sConfiguration.grid_size - 1 ) / sConfiguration.grid_size;
+	int gy1 = ( ( cy + 1 ) * sChunkSize + sConfiguration.grid_size - 1 ) / sConfiguration.grid_size;
+	float dp = sConstants.wake_pressure * sdt;
+	float dv = sConstants.wake_air_velocity * sdt;
+	int gx, gy, a;
+
+	if( gx1 > sGridX )
+		gx1 = sGridX;
+	if( gy1 > sGridY )
+		gy1 = sGridY;
+
+	for( gy = gy0; gy < gy1; gy++ )
+		for( gx = gx0; gx < gx1; gx++ )
+		{
+			a = AIR_INDEX( gx, gy );
+			if( fabsf( spAirP[ a ] - spAirPLast[ a ] ) > dp ||
+				fabsf( spAirVx[ a ] - spAirVxLast[ a ] ) > dv ||
+				fabsf( spAirVy[ a ] - spAirVyLast[ a ] ) > dv )
+				return 1;
+		}
+
+	return 0;
+}
+
+// Make both physic streams of chunk particles equal, so stream swaps don't change sleeping particles.
+static void fall_asleep( int cx, int cy )
+{
+	const struct PPParticleMap * pmap;
+	int x, y, x1, y1;
+
+	x1 = ( cx + 1 ) * sChunkSize < sConfiguration.xres ? ( cx + 1 ) * sChunkSize : sConfiguration.xres;
+	y1 = ( cy + 1 ) * sChunkSize < sConfiguration.yres ? ( cy + 1 ) * sChunkSize : sConfiguration.yres;
+
+	for( y = cy * sChunkSize; y < y1; y++ )
+	{
+		pmap = spParticleMap + y * sConfiguration.xres + cx * sChunkSize;
+		for( x = cx * sChunkSize; x < x1; x++, pmap++ )
+			if( pmap->type && !pmap->collision )
+				spParticlesPhysInfoLast[ pmap->index ] = spParticlesPhysInfo[ pmap->index ];
+	}
+}
+
+void chunks_cpu_st_end_frame( pp_time_t dt )
+{
+	struct PPChunk * chunk = spChunks;
+	pp_time_t delay = ( pp_time_t ) ( sConstants.sleep_delay * SECOND );
+	int count = sChunksX * sChunksY;
+	int cx, cy, i, w, touched;
+
+	if( !sChunkSize )
+		return;
+
+	sDirtyX0 = sChunksX;
+	sDirtyY0 = sChunksY;
+	sDirtyX1 = sDirtyY1 = 0;
+
+	for( cy = 0, i = 0; cy < sChunksY; cy++ )
+		for( cx = 0; cx < sChunksX; cx++, i++, chunk++ )
+		{
+			touched = 0;
+			for( w = 0; w < sChunkTouchCount; w++ )
+			{
+				touched |= spChunkTouch[ w * count + i ];
+				spChunkTouch[ w * count + i ] = 0;
+			}
+
+			if( chunk->awake )
+			{
+				if( cx < sDirtyX0 )
+					sDirtyX0 = cx;
+				if( cy < sDirtyY0 )
+					sDirtyY0 = cy;
+				if( cx >= sDirtyX1 )
+					sDirtyX1 = cx + 1;
+				if( cy >= sDirtyY1 )
+					sDirtyY1 = cy + 1;
+
+				if( touched )
+					chunk->calm = 0;
+				else
+				{
+					chunk->calm += dt;
+					if( chunk->calm >= delay )
+					{
+						fall_asleep( cx, cy );
+						chunk->awake = 0;
+					}
+				}
+			}
+			else if( touched || air_is_active( cx, cy, FLT_SECOND * dt ) )
+			{
+				chunk->awake = 1;
+				chunk->calm = 0;
+			}
+		}
+
+	sDirtyX0 *= sChunkSize;
+	sDirtyY0 *= sChunkSize;
+	sDirtyX1 = sDirtyX1 * sChunkSize < sConfiguration.xres ? sDirtyX1 * sChunkSize : sConfiguration.xres;
+	sDirtyY1 = sDirtyY1 * sChunkSize < sConfiguration.yres ? sDirtyY1 * sChunkSize : sConfiguration.yres;
+}
+
+int chunks_cpu_st_get_dirty_rect( int * x0, int * y0, int * x1, int * y1 )
+{
+	*x0 = sDirtyX0;
+	*y0 = sDirtyY0;
+	*x1 = sDirtyX1;
+	*y1 = sDirtyY1;
+
+	return sDirtyX1 > sDirtyX0 && sDirtyY1 > sDirtyY0;
+}
+
+struct PPChunk * chunks_cpu_st_get_chunks( int * count, int * width )
+{
+	*count = sChunkSize ? sChunksX * sChunksY : 0;
+	*width = sChunksX;
+	return spChunks;
+}
\ No newline at end of file
@@ -0,0 +1,49 @@
+#ifndef __POWDER_CHUNKS_CPU_ST_H__
+#define __POWDER_CHUNKS_CPU_ST_H__
+
+
+#include "shared/types.h"
+
+
+
+// World is split into square chunks of PPConfiguration::chunk_size pixels. Particles of
+// sleeping chunks are not updated at all. A chunk falls asleep when all its particles stay
+// calm for PPConstants::sleep_delay: they keep their cells, are stagnant or blocked, have
+// unlimited life and their temperature is in equilibrium. A chunk wakes up when a particle
+// moves, dies or changes temperature next to it, on spawn and collision changes, and when
+// air over it changes fast enough.
+
+
+
+//! Chunk state.
+struct PPChunk
+{
+	int awake;			//!< Particles of chunk are updated.
+	pp_time_t calm;		//!< Time chunk has stayed calm.
+};
+
+
+
+int chunks_cpu_st_init( );
+void chunks_cpu_st_deinit( );
+//! Is sleeping enabled?
+int chunks_cpu_st_enabled( );
+//! Activity flags of worker thread to be passed to chunks_cpu_st_track, NULL if sleeping is disabled.
+unsigned char * chunks_cpu_st_get_touch( int worker );
+//! Collect indices of particles in awake chunks of rows [row_start, row_end). Returns count and maximal collected index in 'max_index'.
+int chunks_cpu_st_collect( int row_start, int row_end, int * list, int * max_index );
+//! Record activity of particle after its update. 'result' is one of PPStepResult.
+void chunks_cpu_st_track( unsigned char * touch, int i, int result, float sdt );
+//! Wake chunks around position immediately. Used for changes done outside of update.
+void chunks_cpu_st_wake( int x, int y );
+//! Wake chunks around rectangle [x0, x1) x [y0, y1) immediately.
+void chunks_cpu_st_wake_rect( int x0, int y0, int x1, int y1 );
+//! Apply activity of the frame: fall asleep, wake up, compute dirty rectangle.
+void chunks_cpu_st_end_frame( pp_time_t dt );
+//! Rectangle [x0, x1) x [y0, y1) of chunks awake during the last update. Returns 0 if it is empty.
+int chunks_cpu_st_get_dirty_rect( int * x0, int * y0, int * x1, int * y1 );
+//! Chunks state for solver state sections.
+struct PPChunk * chunks_cpu_st_get_chunks( int * count, int * width );
+
+
+#endif // __POWDER_CHUNKS_CPU_ST_H__
\ No newline at end of file
@@ -0,0 +1,201 @@
+#include "pch.h"
+#include "compact_cpu_st.h"
+#include "solver_cpu_st.h"
+#include "changes_cpu_st.h"
+#include "shared/utils.h"
+#include <assert.h>
+#include <string.h>
+
+
+
+extern struct PPConfiguration sConfiguration;
+extern struct PPParticleInfo * spParticlesInfo;
+extern struct PPParticlePhysInfo * spParticlesPhysInfo;
+extern struct PPParticlePhysInfo * spParticlesPhysInfoLast;
+extern struct PPParticleMap * spParticleMap;
+extern int sParticleFirstFree;
+extern int sParticleAliveCount;
+extern int * spAliveList;
+extern int * spAlivePositions;
+
+
+
+#define COMPACT_SAMPLES 256		//!< Number of slot pairs sampled to estimate fragmentation.
+#define COMPACT_DISTANCE 4		//!< Particles in neighbour slots farther than this are counted as fragmentation.
+
+float sCompactBaseline = 0.0f;	//!< Fragmentation right after the last compaction.
+
+
+
+// Spread lower 16 bits of v to even bits.
+static __inline unsigned int morton_spread( unsigned int v )
+{
+	v &= 0x0000ffff;
+	v = ( v | ( v << 8 ) ) & 0x00ff00ff;
+	v = ( v | ( v << 4 ) ) & 0x0f0f0f0f;
+	v = ( v | ( v << 2 ) ) & 0x33333333;
+	v = ( v | ( v << 1 ) ) & 0x55555555;
+	return v;
+}
+
+// LSD radix sort of indices by keys, 8 bits per pass. Result is in 'keys' and 'indices'.
+static void radix_sort( unsigned int * keys, int * indices, unsigned int * keys_tmp, int * indices_tmp, int count )
+{
+	unsigned int * result_keys = keys;
+	int * result_indices = indices;
+	int histogram[ 256 ];
+	unsigned int * tk;
+	int * ti;
+	int shift, i, sum, c;
+
+	for( shift = 0; shift < 32; shift += 8 )
+	{
+		memset( histogram, 0, sizeof( histogram ) );
+		for( i = 0; i < count; i++ )
+			histogram[ ( keys[ i ] >> shift ) & 0xff ]++;
+
+		// all keys share this digit
+		if( count == 0 || histogram[ ( keys[ 0 ] >> shift ) & 0xff ] == count )
+			continue;
+
+		for( i = 0, sum = 0; i < 256; i++ )
+		{
+			c = histogram[ i ];
+			histogram[ i ] = sum;
+			sum += c;
+		}
+
+		for( i = 0; i < count; i++ )
+		{
+			c = histogram[ ( keys[ i ] >> shift ) & 0xff ]++;
+			keys_tmp[ c ] = keys[ i ];
+			indices_tmp[ c ] = indices[ i ];
+		}
+
+		tk = keys; keys = keys_tmp; keys_tmp = tk;
+		ti = indices; indices = indices_tmp; indices_tmp = ti;
+	}
+
+	// odd number of passes leaves result in temporary arrays
+	if( keys != result_keys )
+	{
+		memcpy( result_keys, keys, sizeof( unsigned int ) * count );
+		memcpy( result_indices, indices, sizeof( int ) * count );
+	}
+}
+
+// Estimate fraction of neighbour slots in [0, span) which are dead or hold particles far from each other.
+static float sample_fragmentation( int span )
+{
+	const struct PPParticlePhysInfo * a, * b;
+	unsigned int rng;
+	int i, k, bad;
+
+	if( span < 2 )
+		return 0.0f;
+
+	// samples depend on state only, so solvers stepped from the same state make the same decision
+	rng = ( ( unsigned int ) span * 2654435761u ) ^ ( unsigned int ) sParticleAliveCount;
+	rng |= 1;
+
+	bad = 0;
+	for( k = 0; k < COMPACT_SAMPLES; k++ )
+	{
+		rng ^= rng << 13;
+		rng ^= rng >> 17;
+		rng ^= rng << 5;
+		i = ( int ) ( rng % ( unsigned int ) ( span - 1 ) );
+
+		if( !spParticlesInfo[ i ].type || !spParticlesInfo[ i + 1 ].type )
+		{
+			bad++;
+			continue;
+		}
+
+		a = spParticlesPhysInfo + i;
+		b = a + 1;
+		if( a->x - b->x > COMPACT_DISTANCE || b->x - a->x > COMPACT_DISTANCE ||
+			a->y - b->y > COMPACT_DISTANCE || b->y - a->y > COMPACT_DISTANCE )
+			bad++;
+	}
+
+	return ( float ) bad / COMPACT_SAMPLES;
+}
+
+int compact_cpu_st_run( )
+{
+	int num_parts = sConfiguration.xres * sConfiguration.yres;
+	int count = sParticleAliveCount;
+	unsigned int * keys;
+	int * indices;
+	void * gather;
+	int i, j;
+
+	keys = malloc_log( ( sizeof( unsigned int ) + sizeof( int ) ) * 2 * count + sizeof( struct PPParticlePhysInfo ) * count + 1 );
+	if( !keys )
+		return 0;
+
+	indices = ( int * ) ( keys + 2 * count );
+	gather = indices + 2 * count;
+
+	for( j = 0; j < count; j++ )
+	{
+		i = spAliveList[ j ];
+		keys[ j ] = morton_spread( ( unsigned int ) spParticlesPhysInfo[ i ].x ) |
+			( morton_spread( ( unsigned int ) spParticlesPhysInfo[ i ].y ) << 1 );
+		indices[ j ] = i;
+	}
+
+	radix_sort( keys, indices, keys + count, indices + count, count );
+
+	// gather every stream to temporary buffer and copy it back to the front
+	for( i = 0; i < count; i++ )
+		( ( struct PPParticleInfo * ) gather )[ i ] = spParticlesInfo[ indices[ i ] ];
+	memcpy( spParticlesInfo, gather, sizeof( struct PPParticleInfo ) * count );
+
+	for( i = 0; i < count; i++ )
+		( ( struct PPParticlePhysInfo * ) gather )[ i ] = spParticlesPhysInfo[ indices[ i ] ];
+	memcpy( spParticlesPhysInfo, gather, sizeof( struct PPParticlePhysInfo ) * count );
+
+	for( i = 0; i < count; i++ )
+		( ( struct PPParticlePhysInfo * ) gather )[ i ] = spParticlesPhysInfoLast[ indices[ i ] ];
+	memcpy( spParticlesPhysInfoLast, gather, sizeof( struct PPParticlePhysInfo ) * count );
+
+	for( i = 0; i < count; i++ )
+	{
+		j = ( int ) spParticlesPhysInfo[ i ].y * sConfiguration.xres + ( int ) spParticlesPhysInfo[ i ].x;
+		assert( ( int ) spParticleMap[ j ].index == indices[ i ] );
+		spParticleMap[ j ].index = i;
+		spAliveList[ i ] = i;
+		spAlivePositions[ i ] = i;
+	}
+
+	for( i = count; i < num_parts; i++ )
+	{
+		spParticlesInfo[ i ].type = 0;
+		spParticlesInfo[ i ].life = i + 1;
+	}
+	if( count < num_parts )
+		spParticlesInfo[ num_parts - 1 ].life = -1;
+	sParticleFirstFree = count < num_parts ? count : -1;
+
+	free( keys );
+
+	// sparse particles are far from each other even in Morton order, so fragmentation is measured relative to this
+	sCompactBaseline = sample_fragmentation( count );
+	changes_cpu_st_compacted( );
+
+	if( sConfiguration.log_fn )
+		sConfiguration.log_fn( LOG_DEBUG, "Particles compacted: alive=%d, fragmentation=%.2f.", count, sCompactBaseline );
+
+	return 1;
+}
+
+void compact_cpu_st_auto( int span )
+{
+	if( sConfiguration.compact_threshold <= 0.0f )
+		return;
+
+	if( sample_fragmentation( span ) > sCompactBaseline + sConfiguration.compact_threshold )
+		compact_cpu_st_run( );
+}
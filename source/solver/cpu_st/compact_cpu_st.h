@@ -0,0 +1,23 @@
+#ifndef __POWDER_COMPACT_CPU_ST_H__
+#define __POWDER_COMPACT_CPU_ST_H__
+
+
+#include "shared/types.h"
+
+
+
+// Compaction moves alive particles to the front of particle streams, ordered along
+// Morton curve of their positions, so particles close in space are close in memory.
+// Map indices are remapped and free list is rebuilt in ascending order.
+
+
+
+//! Compact particle streams. Returns 0 if temporary memory can't be allocated, streams are left untouched then.
+int compact_cpu_st_run( );
+//! Compact particle streams if their fragmentation has grown by configured threshold since the last compaction.
+//! 'span' is the number of slots scanned by update. Fragmentation is estimated by sampling neighbour slots,
+//! which are either dead or hold particles far from each other.
+void compact_cpu_st_auto( int span );
+
+
+#endif // __POWDER_COMPACT_CPU_ST_H__
@@ -0,0 +1,218 @@
+#include "pch.h"
+#include "distance_cpu_st.h"
+#include "planes_cpu_st.h"
+#include "shared/utils.h"
+#include <string.h>
+
+
+
+// Window recomputed after collision changes. Cells up to DISTANCE_MAX - 1 from changed cells can
+// change, and their nearest collisions are up to DISTANCE_MAX further. Changes wider than
+// DISTANCE_LOCAL rebuild the whole field.
+#define DISTANCE_LOCAL 128
+#define DISTANCE_WINDOW ( 4 * DISTANCE_MAX + DISTANCE_LOCAL )
+
+
+
+extern struct PPConfiguration sConfiguration;
+extern unsigned int * spCollisionBits;
+extern int sPlaneStride;
+
+unsigned char * spCollisionDistance = NULL;
+unsigned char * spDistanceScratch = NULL;	//!< DISTANCE_WINDOW x DISTANCE_WINDOW cells for local rebuild.
+int sDistanceDirtyX0, sDistanceDirtyY0, sDistanceDirtyX1, sDistanceDirtyY1;	//!< Collision changes since the last flush.
+
+
+
+
+
+// Cells up to r from rectangle [x0, x1) x [y0, y1), clipped to the world.
+static void grow_rect( int x0, int y0, int x1, int y1, int r, int * gx0, int * gy0, int * gx1, int * gy1 )
+{
+	*gx0 = x0 - r < 0 ? 0 : x0 - r;
+	*gy0 = y0 - r < 0 ? 0 : y0 - r;
+	*gx1 = x1 + r > sConfiguration.xres ? sConfiguration.xres : x1 + r;
+	*gy1 = y1 + r > sConfiguration.yres ? sConfiguration.yres : y1 + r;
+}
+
+static int is_seed( int x, int y )
+{
+	return x == 0 || y == 0 || x == sConfiguration.xres - 1 || y == sConfiguration.yres - 1 ||
+		PLANE_TEST( spCollisionBits, x, y );
+}
+
+// Two pass chamfer transform of [x0, x1) x [y0, y1) into dist with row stride x1 - x0. With unit
+// weights for all eight neighbours it gives exact Chebyshev distance. Cells closer to the region
+// edge than to their nearest seed may be overestimated, callers use only the inner part.
+static void chamfer( unsigned char * dist, int x0, int y0, int x1, int y1 )
+{
+	int w = x1 - x0;
+	int h = y1 - y0;
+	int x, y, v;
+	unsigned char * row;
+
+	for( y = 0; y < h; y++ )
+	{
+		row = dist + y * w;
+		for( x = 0; x < w; x++ )
+		{
+			if( is_seed( x0 + x, y0 + y ) )
+			{
+				row[ x ] = 0;
+				continue;
+			}
+
+			v = DISTANCE_MAX - 1;
+			if( x > 0 && row[ x - 1 ] < v )
+				v = row[ x - 1 ];
+			if( y > 0 )
+			{
+				if( row[ x - w ] < v )
+					v = row[ x - w ];
+				if( x > 0 && row[ x - w - 1 ] < v )
+					v = row[ x - w - 1 ];
+				if( x < w - 1 && row[ x - w + 1 ] < v )
+					v = row[ x - w + 1 ];
+			}
+			row[ x ] = ( unsigned char )( v + 1 );
+		}
+	}
+
+	for( y = h - 1; y >= 0; y-- )
+	{
+		row = dist + y * w;
+		for( x = w - 1; x >= 0; x-- )
+		{
+			v = row[ x ] - 1;
+			if( v <= 0 )
+				continue;
+
+			if( x < w - 1 && row[ x + 1 ] < v )
+				v = row[ x + 1 ];
+			if( y < h - 1 )
+			{
+				if( row[ x + w ] < v )
+					v = row[ x + w ];
+				if( x > 0 && row[ x + w - 1 ] < v )
+					v = row[ x + w - 1 ];
+				if( x < w - 1 && row[ x + w + 1 ] < v )
+					v = row[ x + w + 1 ];
+			}
+			row[ x ] = ( unsigned char )( v + 1 );
+		}
+	}
+}
+
+// Recompute field around changes in rectangle [x0, x1) x [y0, y1).
+static void update_rect( int x0, int y0, int x1, int y1 )
+{
+	int wx0, wy0, wx1, wy1;
+	int j;
+
+	grow_rect( x0, y0, x1, y1, 2 * DISTANCE_MAX, &wx0, &wy0, &wx1, &wy1 );
+	if( wx1 - wx0 > DISTANCE_WINDOW || wy1 - wy0 > DISTANCE_WINDOW )
+	{
+		chamfer( spCollisionDistance, 0, 0, sConfiguration.xres, sConfiguration.yres );
+		return;
+	}
+
+	grow_rect( x0, y0, x1, y1, DISTANCE_MAX - 1, &x0, &y0, &x1, &y1 );
+
+	chamfer( spDistanceScratch, wx0, wy0, wx1, wy1 );
+
+	for( j = y0; j < y1; j++ )
+		memcpy( spCollisionDistance + j * sConfiguration.xres + x0,
+			spDistanceScratch + ( j - wy0 ) * ( wx1 - wx0 ) + x0 - wx0, x1 - x0 );
+}
+
+int distance_cpu_st_init( )
+{
+	spCollisionDistance = malloc_log( sConfiguration.xres * sConfiguration.yres );
+	if( !spCollisionDistance )
+	{
+		distance_cpu_st_deinit( );
+		return 0;
+	}
+
+	spDistanceScratch = malloc_log( DISTANCE_WINDOW * DISTANCE_WINDOW );
+	if( !spDistanceScratch )
+	{
+		distance_cpu_st_deinit( );
+		return 0;
+	}
+
+	distance_cpu_st_rebuild( );
+	return 1;
+}
+
+void distance_cpu_st_deinit( )
+{
+	free( spCollisionDistance );
+	free( spDistanceScratch );
+	spCollisionDistance = NULL;
+	spDistanceScratch = NULL;
+}
+
+void distance_cpu_st_touch( int x0, int y0, int x1, int y1 )
+{
+	if( sDistanceDirtyX1 <= sDistanceDirtyX0 )
+	{
+		sDistanceDirtyX0 = x0;
+		sDistanceDirtyY0 = y0;
+		sDistanceDirtyX1 = x1;
+		sDistanceDirtyY1 = y1;
+		return;
+	}
+
+	if( x0 < sDistanceDirtyX0 )
+		sDistanceDirtyX0 = x0;
+	if( y0 < sDistanceDirtyY0 )
+		sDistanceDirtyY0 = y0;
+	if( x1 > sDistanceDirtyX1 )
+		sDistanceDirtyX1 = x1;
+	if( y1 > sDistanceDirtyY1 )
+		sDistanceDirtyY1 = y1;
+}
+
+void distance_cpu_st_flush( )
+{
+	if( sDistanceDirtyX1 <= sDistanceDirtyX0 )
+		return;
+
+	update_rect( sDistanceDirtyX0, sDistanceDirtyY0, sDistanceDirtyX1, sDistanceDirtyY1 );
+	sDistanceDirtyX0 = sDistanceDirtyX1 = 0;
+}
+
+void distance_cpu_st_rebuild( )
+{
+	chamfer( spCollisionDistance, 0, 0, sConfiguration.xres, sConfiguration.yres );
+	sDistanceDirtyX0 = sDistanceDirtyX1 = 0;
+}
+
+int distance_cpu_st_check( )
+{
+	const unsigned char * d = spCollisionDistance;
+	int x, y, i, j, v;
+
+	// exact field is the only one, where every cell is one more than its nearest neighbour
+	for( y = 0; y < sConfiguration.yres; y++ )
+		for( x = 0; x < sConfiguration.xres; x++, d++ )
+		{
+			if( is_seed( x, y ) )
+			{
+				if( *d )
+					return 0;
+				continue;
+			}
+
+			v = DISTANCE_MAX - 1;
+			for( j = -1; j < 2; j++ )
+				for( i = -1; i < 2; i++ )
+					if( d[ j * sConfiguration.xres + i ] < v )
+						v = d[ j * sConfiguration.xres + i ];
+			if( *d != v + 1 )
+				return 0;
+		}
+
+	return 1;
+}
@@ -0,0 +1,31 @@
+#ifndef __POWDER_DISTANCE_CPU_ST_H__
+#define __POWDER_DISTANCE_CPU_ST_H__
+
+
+#include "shared/types.h"
+
+
+
+// Chebyshev distance from every cell to the nearest collision or world border cell, saturated at
+// DISTANCE_MAX. Particle moving by at most one cell per step can't hit anything in the first
+// distance - 1 steps, so the tracer tests only the cells it can actually stop at.
+// Collision edits only mark changed area, the field is brought up to date at the start of update,
+// so painting stays O(1) per pixel. During update it is read only.
+
+#define DISTANCE_MAX 32
+
+
+
+int distance_cpu_st_init( );
+void distance_cpu_st_deinit( );
+//! Mark collisions of rectangle [x0, x1) x [y0, y1) as changed.
+void distance_cpu_st_touch( int x0, int y0, int x1, int y1 );
+//! Update field around changed collisions. Collision plane must be up to date.
+void distance_cpu_st_flush( );
+//! Rebuild field from collision plane.
+void distance_cpu_st_rebuild( );
+//! Check field against collision plane. Returns 0 if they differ.
+int distance_cpu_st_check( );
+
+
+#endif // __POWDER_DISTANCE_CPU_ST_H__
@@ -0,0 +1,350 @@
+#include "pch.h"
+#include "heat_cpu_st.h"
+#include "solver_cpu_st.h"
+#include "shared/utils.h"
+#include "shared/workers.h"
+#include "shared/cpu.h"
+#include "solver/trace.h"
+#include <string.h>
+
+
+
+extern struct PPConfiguration sConfiguration;
+extern struct PPParticleType * spParticleTypes;
+extern struct PPParticlePhysInfo * spParticlesPhysInfo;
+extern struct PPParticlePhysInfo * spParticlesPhysInfoLast;
+extern struct PPParticleMap * spParticleMap;
+extern int sParticleAliveCount;
+extern int * spAliveList;
+
+float * spHeatMemory = NULL;	//!< Single allocation for all heat grids.
+float * spHeat = NULL;			//!< Current temperatures, xres * yres.
+float * spHeatLast = NULL;		//!< Previous temperatures.
+float * spHeatMask = NULL;		//!< 1 for occupied cells, 0 for empty ones.
+float * spHeatConduct = NULL;	//!< Heat conduct of cell particle, 0 for empty cells and collisions.
+int sHeatSynced;				//!< Particle temperatures are up to date.
+
+
+
+//! Arguments of heat stencil for cells of one row. Pointers point to the first cell of row.
+struct PPHeatSpan
+{
+	const float * last;
+	const float * mask;
+	const float * conduct;
+	float * out;
+	int stride;
+	float sdt;
+};
+
+//! Rows of one parallel heat update.
+struct PPHeatRows
+{
+	int rows;			//!< Rows per job.
+	float sdt;
+};
+
+typedef void (* PPHeatSpanFn) ( const struct PPHeatSpan * s, int begin, int end );
+
+PPHeatSpanFn sHeatSpanFn = NULL;
+const char * sHeatKernelsName = "";
+
+
+
+
+
+//
+// scalar kernels
+//
+
+static void heat_span_scalar( const struct PPHeatSpan * s, int begin, int end )
+{
+	const float * t = s->last;
+	const float * m = s->mask;
+	int w = s->stride;
+	float sum, count;
+	int i;
+
+	// neighbours are summed in the same order as the particle gather does
+	for( i = begin; i < end; i++ )
+	{
+		count = m[ i - w ] + m[ i - w + 1 ] + m[ i + 1 ] + m[ i + w + 1 ] +
+			m[ i + w ] + m[ i + w - 1 ] + m[ i - 1 ] + m[ i - w - 1 ];
+		sum = t[ i - w ] + t[ i - w + 1 ] + t[ i + 1 ] + t[ i + w + 1 ] +
+			t[ i + w ] + t[ i + w - 1 ] + t[ i - 1 ] + t[ i - w - 1 ];
+
+		s->out[ i ] = count > 0.0f ? t[ i ] + ( sum / count - t[ i ] ) * s->conduct[ i ] * s->sdt : t[ i ];
+	}
+}
+
+
+
+#ifdef CPU_X86
+
+//
+// SSE2 kernels
+//
+
+#define HEAT_SSE2_SUM8( p, i, w ) _mm_add_ps( _mm_add_ps( _mm_add_ps( _mm_add_ps( _mm_add_ps( _mm_add_ps( _mm_add_ps( \
+	_mm_loadu_ps( p + i - w ), _mm_loadu_ps( p + i - w + 1 ) ), _mm_loadu_ps( p + i + 1 ) ), _mm_loadu_ps( p + i + w + 1 ) ), \
+	_mm_loadu_ps( p + i + w ) ), _mm_loadu_ps( p + i + w - 1 ) ), _mm_loadu_ps( p + i - 1 ) ), _mm_loadu_ps( p + i - w - 1 ) )
+
+static CPU_TARGET_SSE2 void heat_span_sse2( const struct PPHeatSpan * s, int begin, int end )
+{
+	__m128 sdt = _mm_set1_ps( s->sdt );
+	__m128 zero = _mm_setzero_ps( );
+	__m128 one = _mm_set1_ps( 1.0f );
+	__m128 count, sum, t, delta, occupied;
+	int w = s->stride;
+	int i;
+
+	for( i = begin; i + 4 <= end; i += 4 )
+	{
+		count = HEAT_SSE2_SUM8( s->mask, i, w );
+		sum = HEAT_SSE2_SUM8( s->last, i, w );
+		t = _mm_loadu_ps( s->last + i );
+
+		// cells without neighbours keep their temperature, division by 1 only avoids NaN
+		occupied = _mm_cmpgt_ps( count, zero );
+		count = _mm_max_ps( count, one );
+		delta = _mm_mul_ps( _mm_mul_ps( _mm_sub_ps( _mm_div_ps( sum, count ), t ), _mm_loadu_ps( s->conduct + i ) ), sdt );
+		_mm_storeu_ps( s->out + i, _mm_add_ps( t, _mm_and_ps( occupied, delta ) ) );
+	}
+
+	heat_span_scalar( s, i, end );
+}
+
+
+
+//
+// AVX2 kernels
+//
+
+#define HEAT_AVX2_SUM8( p, i, w ) _mm256_add_ps( _mm256_add_ps( _mm256_add_ps( _mm256_add_ps( _mm256_add_ps( _mm256_add_ps( _mm256_add_ps( \
+	_mm256_loadu_ps( p + i - w ), _mm256_loadu_ps( p + i - w + 1 ) ), _mm256_loadu_ps( p + i + 1 ) ), _mm256_loadu_ps( p + i + w + 1 ) ), \
+	_mm256_loadu_ps( p + i + w ) ), _mm256_loadu_ps( p + i + w - 1 ) ), _mm256_loadu_ps( p + i - 1 ) ), _mm256_loadu_ps( p + i - w - 1 ) )
+
+static CPU_TARGET_AVX2 void heat_span_avx2( const struct PPHeatSpan * s, int begin, int end )
+{
+	__m256 sdt = _mm256_set1_ps( s->sdt );
+	__m256 zero = _mm256_setzero_ps( );
+	__m256 one = _mm256_set1_ps( 1.0f );
+	__m256 count, sum, t, delta, occupied;
+	int w = s->stride;
+	int i;
+
+	for( i = begin; i + 8 <= end; i += 8 )
+	{
+		count = HEAT_AVX2_SUM8( s->mask, i, w );
+		sum = HEAT_AVX2_SUM8( s->last, i, w );
+		t = _mm256_loadu_ps( s->last + i );
+
+		occupied = _mm256_cmp_ps( count, zero, _CMP_GT_OQ );
+		count = _mm256_max_ps( count, one );
+		delta = _mm256_mul_ps( _mm256_mul_ps( _mm256_sub_ps( _mm256_div_ps( sum, count ), t ), _mm256_loadu_ps( s->conduct + i ) ), sdt );
+		_mm256_storeu_ps( s->out + i, _mm256_add_ps( t, _mm256_and_ps( occupied, delta ) ) );
+	}
+
+	heat_span_scalar( s, i, end );
+}
+
+#endif // CPU_X86
+
+
+
+
+
+int heat_cpu_st_init( )
+{
+	int num_parts = sConfiguration.xres * sConfiguration.yres;
+
+	if( !sConfiguration.heat_grid )
+		return 1;
+
+	spHeatMemory = malloc_log( sizeof( float ) * num_parts * 4 );
+	if( !spHeatMemory )
+	{
+		heat_cpu_st_deinit( );
+		return 0;
+	}
+	memset( spHeatMemory, 0, sizeof( float ) * num_parts * 4 );
+	spHeat = spHeatMemory;
+	spHeatLast = spHeat + num_parts;
+	spHeatMask = spHeatLast + num_parts;
+	spHeatConduct = spHeatMask + num_parts;
+	sHeatSynced = 1;
+
+	sHeatSpanFn = heat_span_scalar;
+	sHeatKernelsName = "scalar";
+
+#ifdef CPU_X86
+	if( cpu_has_avx2( ) )
+	{
+		sHeatSpanFn = heat_span_avx2;
+		sHeatKernelsName = "avx2";
+	}
+	else if( cpu_has_sse2( ) )
+	{
+		sHeatSpanFn = heat_span_sse2;
+		sHeatKernelsName = "sse2";
+	}
+#endif
+
+	if( sConfiguration.log_fn )
+		sConfiguration.log_fn( LOG_INFO, "Heat grid: kernels=%s.", sHeatKernelsName );
+
+	return 1;
+}
+
+void heat_cpu_st_deinit( )
+{
+	free( spHeatMemory );
+	spHeatMemory = NULL;
+	spHeat = NULL;
+	spHeatLast = NULL;
+	spHeatMask = NULL;
+	spHeatConduct = NULL;
+}
+
+int heat_cpu_st_enabled( )
+{
+	return spHeat != NULL;
+}
+
+const char * heat_cpu_st_get_kernels_name( )
+{
+	return sHeatKernelsName;
+}
+
+// Border rows and columns never hold particles, so only interior cells are updated.
+// Border cells are written to both grids and don't change.
+static void heat_update_rows( int y0, int y1, float sdt )
+{
+	struct PPHeatSpan s;
+	int y, row;
+
+	s.stride = sConfiguration.xres;
+	s.sdt = sdt;
+	for( y = y0; y < y1; y++ )
+	{
+		row = y * sConfiguration.xres;
+		s.last = spHeatLast + row;
+		s.mask = spHeatMask + row;
+		s.conduct = spHeatConduct + row;
+		s.out = spHeat + row;
+		sHeatSpanFn( &s, 1, sConfiguration.xres - 1 );
+	}
+}
+
+static void heat_rows_job( void * user, int job, int worker )
+{
+	const struct PPHeatRows * rows = ( const struct PPHeatRows * ) user;
+	int y0 = 1 + job * rows->rows;
+	int y1 = y0 + rows->rows < sConfiguration.yres - 1 ? y0 + rows->rows : sConfiguration.yres - 1;
+	double trace = TRACE_BEGIN( );
+
+	heat_update_rows( y0, y1, rows->sdt );
+	TRACE_END( "heat rows", worker, job, trace );
+}
+
+void heat_cpu_st_update( struct PPWorkers * workers, int threads, pp_time_t dt )
+{
+	struct PPHeatRows rows;
+	float * tmp;
+	int interior = sConfiguration.yres - 2;
+
+	if( !spHeat )
+		return;
+
+	tmp = spHeat;
+	spHeat = spHeatLast;
+	spHeatLast = tmp;
+	sHeatSynced = 0;
+
+	if( interior <= 0 )
+		return;
+
+	rows.sdt = FLT_SECOND * dt;
+	if( threads <= 1 )
+	{
+		heat_update_rows( 1, sConfiguration.yres - 1, rows.sdt );
+		return;
+	}
+
+	// a few jobs per thread to balance rows of different cost
+	rows.rows = ( interior + threads * 4 - 1 ) / ( threads * 4 );
+	workers_run_limited( workers, heat_rows_job, &rows, ( interior + rows.rows - 1 ) / rows.rows, threads );
+}
+
+void heat_cpu_st_set( int cell, float temp, float hconduct )
+{
+	if( !spHeat )
+		return;
+
+	spHeat[ cell ] = temp;
+	spHeatLast[ cell ] = temp;
+	spHeatMask[ cell ] = 1.0f;
+	spHeatConduct[ cell ] = hconduct;
+	sHeatSynced = 0;
+}
+
+void heat_cpu_st_clear( int cell )
+{
+	if( !spHeat )
+		return;
+
+	spHeat[ cell ] = 0.0f;
+	spHeatLast[ cell ] = 0.0f;
+	spHeatMask[ cell ] = 0.0f;
+	spHeatConduct[ cell ] = 0.0f;
+}
+
+void heat_cpu_st_move( int from, int to )
+{
+	if( !spHeat )
+		return;
+
+	spHeat[ to ] = spHeat[ from ];
+	spHeatMask[ to ] = 1.0f;
+	spHeatConduct[ to ] = spHeatConduct[ from ];
+	spHeat[ from ] = 0.0f;
+	spHeatMask[ from ] = 0.0f;
+	spHeatConduct[ from ] = 0.0f;
+}
+
+void heat_cpu_st_sync( )
+{
+	struct PPParticlePhysInfo * partp, * partpl;
+	int i;
+
+	if( !spHeat || sHeatSynced )
+		return;
+
+	for( i = 0; i < sParticleAliveCount; i++ )
+	{
+		partp = spParticlesPhysInfo + spAliveList[ i ];
+		partpl = spParticlesPhysInfoLast + spAliveList[ i ];
+		partp->temp = spHeat[ ( int ) partp->y * sConfiguration.xres + ( int ) partp->x ];
+		partpl->temp = spHeatLast[ ( int ) partpl->y * sConfiguration.xres + ( int ) partpl->x ];
+	}
+
+	sHeatSynced = 1;
+}
+
+void heat_cpu_st_state_loaded( )
+{
+	const struct PPParticleMap * pmap = spParticleMap;
+	int npart = sConfiguration.xres * sConfiguration.yres;
+	int i;
+
+	if( !spHeat )
+		return;
+
+	for( i = 0; i < npart; i++, pmap++ )
+	{
+		spHeatMask[ i ] = pmap->type ? 1.0f : 0.0f;
+		spHeatConduct[ i ] = pmap->type && !pmap->collision ? spParticleTypes[ pmap->type ].hconduct : 0.0f;
+	}
+
+	sHeatSynced = 0;
+}
@@ -0,0 +1,40 @@
+#ifndef __POWDER_HEAT_CPU_ST_H__
+#define __POWDER_HEAT_CPU_ST_H__
+
+
+#include "shared/types.h"
+
+
+
+// With PPConfiguration::heat_grid temperature lives in dense grids aligned with particle map
+// instead of particles. Every frame a stencil pass computes the current grid from the previous
+// one, and grid values move together with particles. Occupied cells conduct heat with factor
+// of their particle type, empty cells stay zero. Particle temperatures are synced on access.
+
+
+
+struct PPWorkers;
+
+
+
+int heat_cpu_st_init( );
+void heat_cpu_st_deinit( );
+//! Is heat grid enabled?
+int heat_cpu_st_enabled( );
+//! Name of selected kernels set.
+const char * heat_cpu_st_get_kernels_name( );
+//! Swap grids and compute current temperatures from previous ones. Stencil runs on 'threads' workers.
+void heat_cpu_st_update( struct PPWorkers * workers, int threads, pp_time_t dt );
+//! Place temperature of new particle or collision into both grids.
+void heat_cpu_st_set( int cell, float temp, float hconduct );
+//! Clear cell in both grids.
+void heat_cpu_st_clear( int cell );
+//! Move current temperature of particle to new cell.
+void heat_cpu_st_move( int from, int to );
+//! Copy grid temperatures into particle physic streams, if they are out of date.
+void heat_cpu_st_sync( );
+//! Rebuild occupancy and conduct of cells from particle map.
+void heat_cpu_st_state_loaded( );
+
+
+#endif // __POWDER_HEAT_CPU_ST_H__
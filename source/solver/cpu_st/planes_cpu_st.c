@@ -0,0 +1,132 @@
+#include "pch.h"
+#include "api.h"
+#include "planes_cpu_st.h"
+#include "solver_cpu_st.h"
+#include "shared/utils.h"
+#include <string.h>
+
+
+
+extern struct PPConfiguration sConfiguration;
+extern struct PPParticleMap * spParticleMap;
+
+unsigned int * spPlanesMemory = NULL;	//!< Single allocation for all planes.
+unsigned int * spOccupancyBits = NULL;
+unsigned int * spCollisionBits = NULL;
+unsigned int * spStagnantBits = NULL;
+unsigned int * spTypeBits = NULL;		//!< Occupancy planes of particle types, one after another.
+int sPlaneStride;						//!< Words per row.
+int sPlaneSize;							//!< Words per plane.
+
+
+
+
+
+int planes_cpu_st_init( )
+{
+	int count = 3 + pp_get_particle_types_count( );
+
+	sPlaneStride = ( sConfiguration.xres + 31 ) / 32;
+	sPlaneSize = sPlaneStride * sConfiguration.yres;
+
+	spPlanesMemory = malloc_log( sizeof( unsigned int ) * sPlaneSize * count );
+	if( !spPlanesMemory )
+	{
+		planes_cpu_st_deinit( );
+		return 0;
+	}
+	memset( spPlanesMemory, 0, sizeof( unsigned int ) * sPlaneSize * count );
+
+	spOccupancyBits = spPlanesMemory;
+	spCollisionBits = spOccupancyBits + sPlaneSize;
+	spStagnantBits = spCollisionBits + sPlaneSize;
+	spTypeBits = spStagnantBits + sPlaneSize;
+
+	return 1;
+}
+
+void planes_cpu_st_deinit( )
+{
+	free( spPlanesMemory );
+	spPlanesMemory = NULL;
+	spOccupancyBits = NULL;
+	spCollisionBits = NULL;
+	spStagnantBits = NULL;
+	spTypeBits = NULL;
+}
+
+void planes_cpu_st_place( int x, int y, int type, int collision, int stagnant )
+{
+	int word = y * sPlaneStride + ( x >> 5 );
+	unsigned int bit = 1u << ( x & 31 );
+
+	spOccupancyBits[ word ] |= bit;
+	spTypeBits[ type * sPlaneSize + word ] |= bit;
+	if( collision )
+		spCollisionBits[ word ] |= bit;
+	else
+		spCollisionBits[ word ] &= ~bit;
+	if( stagnant )
+		spStagnantBits[ word ] |= bit;
+	else
+		spStagnantBits[ word ] &= ~bit;
+}
+
+void planes_cpu_st_remove( int x, int y, int type )
+{
+	int word = y * sPlaneStride + ( x >> 5 );
+	unsigned int bit = 1u << ( x & 31 );
+
+	spOccupancyBits[ word ] &= ~bit;
+	spCollisionBits[ word ] &= ~bit;
+	spTypeBits[ type * sPlaneSize + word ] &= ~bit;
+}
+
+void planes_cpu_st_set_stagnant( int x, int y, int stagnant )
+{
+	int word = y * sPlaneStride + ( x >> 5 );
+	unsigned int bit = 1u << ( x & 31 );
+
+	if( stagnant )
+		spStagnantBits[ word ] |= bit;
+	else
+		spStagnantBits[ word ] &= ~bit;
+}
+
+void planes_cpu_st_rebuild( )
+{
+	const struct PPParticleMap * pmap = spParticleMap;
+	int x, y;
+
+	memset( spPlanesMemory, 0, sizeof( unsigned int ) * sPlaneSize * ( 3 + pp_get_particle_types_count( ) ) );
+
+	for( y = 0; y < sConfiguration.yres; y++ )
+		for( x = 0; x < sConfiguration.xres; x++, pmap++ )
+		{
+			if( pmap->stagnant )
+				planes_cpu_st_set_stagnant( x, y, 1 );
+			if( pmap->type )
+				planes_cpu_st_place( x, y, pmap->type, pmap->collision, pmap->stagnant );
+		}
+}
+
+int planes_cpu_st_check( )
+{
+	const struct PPParticleMap * pmap = spParticleMap;
+	int x, y;
+
+	for( y = 0; y < sConfiguration.yres; y++ )
+		for( x = 0; x < sConfiguration.xres; x++, pmap++ )
+		{
+			if( !PLANE_TEST( spOccupancyBits, x, y ) != !pmap->type )
+				return 0;
+			if( !pmap->type )
+				continue;
+			if( !PLANE_TEST( spCollisionBits, x, y ) != !pmap->collision ||
+				!PLANE_TEST( spStagnantBits, x, y ) != !pmap->stagnant ||
+				!PLANE_TEST( spTypeBits + pmap->type * sPlaneSize, x, y ) )
+				return 0;
+		}
+
+	return 1;
+}
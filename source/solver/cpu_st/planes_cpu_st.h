@@ -0,0 +1,32 @@
+#ifndef __POWDER_PLANES_CPU_ST_H__
+#define __POWDER_PLANES_CPU_ST_H__
+
+
+#include "shared/types.h"
+
+
+
+// Bit planes mirror particle map with one bit per cell: occupancy, collision, stagnant and
+// one occupancy plane per particle type. Rows start at word boundary, so threads updating
+// different rows never share a word. Planes are updated together with the map.
+
+#define PLANE_ROW( plane, y ) ( ( plane ) + ( y ) * sPlaneStride )
+#define PLANE_TEST( plane, x, y ) ( PLANE_ROW( plane, y )[ ( x ) >> 5 ] & ( 1u << ( ( x ) & 31 ) ) )
+
+
+
+int planes_cpu_st_init( );
+void planes_cpu_st_deinit( );
+//! Mark cell as occupied by particle or collision.
+void planes_cpu_st_place( int x, int y, int type, int collision, int stagnant );
+//! Mark cell of given type as empty.
+void planes_cpu_st_remove( int x, int y, int type );
+//! Update stagnant bit of cell.
+void planes_cpu_st_set_stagnant( int x, int y, int stagnant );
+//! Rebuild planes from particle map.
+void planes_cpu_st_rebuild( );
+//! Check planes against particle map. Returns 0 if they differ.
+int planes_cpu_st_check( );
+
+
+#endif // __POWDER_PLANES_CPU_ST_H__
@@ -0,0 +1,271 @@
+#include "pch.h"
+#include "positions_cpu_st.h"
+#include "heat_cpu_st.h"
+#include "shared/workers.h"
+#include "shared/cpu.h"
+#include <string.h>
+
+
+
+#define POSITIONS_JOB_PARTICLES 8192	//!< Particles of one export job.
+#define FIXED16_SCALE 16.0f				//!< Fixed point steps per pixel of POSITION_FIXED16.
+#define FIXED16_MAX 65535.0f
+
+
+
+extern struct PPParticlePhysInfo * spParticlesPhysInfo;
+extern struct PPParticlePhysInfo * spParticlesPhysInfoLast;
+extern int * spAliveList;
+extern int sParticleAliveCount;
+extern struct PPWorkers * spWorkers;
+
+
+
+//! Arguments of one pp_export_positions call.
+struct PPPositionsView
+{
+	int format;
+	unsigned char * buffer;
+	int stride;
+	float alpha;
+	const int * alive;
+	int alive_count;
+	const struct PPParticlePhysInfo * phys;
+	const struct PPParticlePhysInfo * phys_last;
+};
+
+typedef void (* PPPositionsFn) ( const struct PPParticlePhysInfo * phys, const struct PPParticlePhysInfo * phys_last, const int * list, int count, float alpha, unsigned char * out, int stride );
+
+PPPositionsFn sPositionsFns[ 3 ];		//!< Kernels indexed by PPPositionFormat.
+const char * sPositionsKernelsName = "";
+
+
+
+
+
+//
+// scalar kernels
+//
+
+static void positions_float2_scalar( const struct PPParticlePhysInfo * phys, const struct PPParticlePhysInfo * phys_last, const int * list, int count, float alpha, unsigned char * out, int stride )
+{
+	const struct PPParticlePhysInfo * cur, * last;
+	float v[ 2 ];
+	int i;
+
+	for( i = 0; i < count; i++, out += stride )
+	{
+		cur = phys + list[ i ];
+		last = phys_last + list[ i ];
+		v[ 0 ] = last->x + alpha * ( cur->x - last->x );
+		v[ 1 ] = last->y + alpha * ( cur->y - last->y );
+		memcpy( out, v, sizeof( v ) );
+	}
+}
+
+static void positions_float3_scalar( const struct PPParticlePhysInfo * phys, const struct PPParticlePhysInfo * phys_last, const int * list, int count, float alpha, unsigned char * out, int stride )
+{
+	const struct PPParticlePhysInfo * cur, * last;
+	float v[ 3 ];
+	int i;
+
+	for( i = 0; i < count; i++, out += stride )
+	{
+		cur = phys + list[ i ];
+		last = phys_last + list[ i ];
+		v[ 0 ] = last->x + alpha * ( cur->x - last->x );
+		v[ 1 ] = last->y + alpha * ( cur->y - last->y );
+		v[ 2 ] = last->temp + alpha * ( cur->temp - last->temp );
+		memcpy( out, v, sizeof( v ) );
+	}
+}
+
+// Round half up and saturate, the same as vector kernel.
+static unsigned short to_fixed16( float v )
+{
+	v = v * FIXED16_SCALE + 0.5f;
+	if( v < 0.0f )
+		return 0;
+	if( v > FIXED16_MAX )
+		return ( unsigned short ) FIXED16_MAX;
+	return ( unsigned short ) v;
+}
+
+static void positions_fixed16_scalar( const struct PPParticlePhysInfo * phys, const struct PPParticlePhysInfo * phys_last, const int * list, int count, float alpha, unsigned char * out, int stride )
+{
+	const struct PPParticlePhysInfo * cur, * last;
+	unsigned short v[ 2 ];
+	int i;
+
+	for( i = 0; i < count; i++, out += stride )
+	{
+		cur = phys + list[ i ];
+		last = phys_last + list[ i ];
+		v[ 0 ] = to_fixed16( last->x + alpha * ( cur->x - last->x ) );
+		v[ 1 ] = to_fixed16( last->y + alpha * ( cur->y - last->y ) );
+		memcpy( out, v, sizeof( v ) );
+	}
+}
+
+
+
+#ifdef CPU_X86
+
+//
+// SSE2 kernels
+//
+
+// Blend x and y of two particles into x0 y0 x1 y1.
+static CPU_TARGET_SSE2 __m128 blend2_sse2( const struct PPParticlePhysInfo * phys, const struct PPParticlePhysInfo * phys_last, int a, int b, __m128 alpha )
+{
+	__m128 cur = _mm_loadh_pi( _mm_loadl_pi( _mm_setzero_ps( ), ( const __m64 * ) &phys[ a ].x ),
+		( const __m64 * ) &phys[ b ].x );
+	__m128 last = _mm_loadh_pi( _mm_loadl_pi( _mm_setzero_ps( ), ( const __m64 * ) &phys_last[ a ].x ),
+		( const __m64 * ) &phys_last[ b ].x );
+
+	return _mm_add_ps( last, _mm_mul_ps( alpha, _mm_sub_ps( cur, last ) ) );
+}
+
+static CPU_TARGET_SSE2 void positions_float2_sse2( const struct PPParticlePhysInfo * phys, const struct PPParticlePhysInfo * phys_last, const int * list, int count, float alpha, unsigned char * out, int stride )
+{
+	__m128 a = _mm_set1_ps( alpha );
+	__m128 p;
+	int i;
+
+	for( i = 0; i + 2 <= count; i += 2, out += 2 * stride )
+	{
+		p = blend2_sse2( phys, phys_last, list[ i ], list[ i + 1 ], a );
+		_mm_storel_pi( ( __m64 * ) out, p );
+		_mm_storeh_pi( ( __m64 * ) ( out + stride ), p );
+	}
+
+	positions_float2_scalar( phys, phys_last, list + i, count - i, alpha, out, stride );
+}
+
+static CPU_TARGET_SSE2 void positions_float3_sse2( const struct PPParticlePhysInfo * phys, const struct PPParticlePhysInfo * phys_last, const int * list, int count, float alpha, unsigned char * out, int stride )
+{
+	const struct PPParticlePhysInfo * cur, * last;
+	__m128 a = _mm_set1_ps( alpha );
+	__m128 p;
+	float t;
+	int i;
+
+	for( i = 0; i + 2 <= count; i += 2, out += 2 * stride )
+	{
+		p = blend2_sse2( phys, phys_last, list[ i ], list[ i + 1 ], a );
+		_mm_storel_pi( ( __m64 * ) out, p );
+		_mm_storeh_pi( ( __m64 * ) ( out + stride ), p );
+
+		cur = phys + list[ i ];
+		last = phys_last + list[ i ];
+		t = last->temp + alpha * ( cur->temp - last->temp );
+		memcpy( out + 8, &t, sizeof( t ) );
+
+		cur = phys + list[ i + 1 ];
+		last = phys_last + list[ i + 1 ];
+		t = last->temp + alpha * ( cur->temp - last->temp );
+		memcpy( out + stride + 8, &t, sizeof( t ) );
+	}
+
+	positions_float3_scalar( phys, phys_last, list + i, count - i, alpha, out, stride );
+}
+
+// Convert x0 y0 x1 y1 to fixed point, round half up and saturate to [0, 65535].
+static CPU_TARGET_SSE2 __m128i fixed4_sse2( __m128 p )
+{
+	p = _mm_add_ps( _mm_mul_ps( p, _mm_set1_ps( FIXED16_SCALE ) ), _mm_set1_ps( 0.5f ) );
+	p = _mm_min_ps( _mm_max_ps( p, _mm_setzero_ps( ) ), _mm_set1_ps( FIXED16_MAX ) );
+
+	// SSE2 has only signed pack, so values are biased to signed range
+	return _mm_sub_epi32( _mm_cvttps_epi32( p ), _mm_set1_epi32( 32768 ) );
+}
+
+static CPU_TARGET_SSE2 void positions_fixed16_sse2( const struct PPParticlePhysInfo * phys, const struct PPParticlePhysInfo * phys_last, const int * list, int count, float alpha, unsigned char * out, int stride )
+{
+	__m128 a = _mm_set1_ps( alpha );
+	__m128i v;
+	int i, k, bits;
+
+	for( i = 0; i + 4 <= count; i += 4, out += 4 * stride )
+	{
+		v = _mm_packs_epi32( fixed4_sse2( blend2_sse2( phys, phys_last, list[ i ], list[ i + 1 ], a ) ),
+			fixed4_sse2( blend2_sse2( phys, phys_last, list[ i + 2 ], list[ i + 3 ], a ) ) );
+		v = _mm_xor_si128( v, _mm_set1_epi16( ( short ) 0x8000 ) );
+
+		if( stride == 4 )
+		{
+			_mm_storeu_si128( ( __m128i * ) out, v );
+			continue;
+		}
+
+		for( k = 0; k < 4; k++ )
+		{
+			bits = _mm_cvtsi128_si32( v );
+			memcpy( out + k * stride, &bits, sizeof( bits ) );
+			v = _mm_srli_si128( v, 4 );
+		}
+	}
+
+	positions_fixed16_scalar( phys, phys_last, list + i, count - i, alpha, out, stride );
+}
+
+#endif // CPU_X86
+
+
+
+
+
+void positions_cpu_st_init_kernels( )
+{
+	sPositionsFns[ POSITION_FLOAT2 ] = positions_float2_scalar;
+	sPositionsFns[ POSITION_FLOAT3 ] = positions_float3_scalar;
+	sPositionsFns[ POSITION_FIXED16 ] = positions_fixed16_scalar;
+	sPositionsKernelsName = "scalar";
+
+#ifdef CPU_X86
+	if( cpu_has_sse2( ) )
+	{
+		sPositionsFns[ POSITION_FLOAT2 ] = positions_float2_sse2;
+		sPositionsFns[ POSITION_FLOAT3 ] = positions_float3_sse2;
+		sPositionsFns[ POSITION_FIXED16 ] = positions_fixed16_sse2;
+		sPositionsKernelsName = "sse2";
+	}
+#endif
+}
+
+const char * positions_cpu_st_get_kernels_name( )
+{
+	return sPositionsKernelsName;
+}
+
+static void positions_job( void * user, int job, int worker )
+{
+	const struct PPPositionsView * view = ( const struct PPPositionsView * ) user;
+	int start = job * POSITIONS_JOB_PARTICLES;
+	int count = view->alive_count - start < POSITIONS_JOB_PARTICLES ? view->alive_count - start : POSITIONS_JOB_PARTICLES;
+
+	( void ) worker;
+
+	sPositionsFns[ view->format ]( view->phys, view->phys_last, view->alive + start, count, view->alpha, view->buffer + start * view->stride, view->stride );
+}
+
+int positions_cpu_st_export( const struct PPRenderSource * source, float alpha, int format, void * buffer, int stride )
+{
+	struct PPPositionsView view;
+
+	// temperatures of heat grid are copied to particles on request, published streams are copied after it
+	if( format == POSITION_FLOAT3 && !source )
+		heat_cpu_st_sync( );
+
+	view.format = format;
+	view.buffer = ( unsigned char * ) buffer;
+	view.stride = stride;
+	view.alpha = alpha;
+	view.alive = source ? source->alive : spAliveList;
+	view.alive_count = source ? source->alive_count : sParticleAliveCount;
+	view.phys = source ? source->phys : spParticlesPhysInfo;
+	view.phys_last = source ? source->phys_last : spParticlesPhysInfoLast;
+
+	workers_run( source ? NULL : spWorkers, positions_job, &view, ( view.alive_count + POSITIONS_JOB_PARTICLES - 1 ) / POSITIONS_JOB_PARTICLES );
+	return view.alive_count;
+}
@@ -0,0 +1,25 @@
+#ifndef __POWDER_POSITIONS_CPU_ST_H__
+#define __POWDER_POSITIONS_CPU_ST_H__
+
+
+#include "solver/solver.h"
+
+
+
+// Positions are exported in order of alive list, so record k belongs to particle pp_get_alive_particles( )[ k ].
+// Each record is the previous physical state blended towards the current one, which lets caller render
+// faster than it updates. Records of a block of alive list are computed by one worker, a published source is
+// exported by the calling thread alone.
+
+
+
+//! Select export kernels for current CPU.
+void positions_cpu_st_init_kernels( );
+//! Name of selected kernels set.
+const char * positions_cpu_st_get_kernels_name( );
+//! Write interpolated records of alive particles of 'source', or of solver state if it's NULL, in one of PPPositionFormat with
+//! stride in bytes. Returns number of records.
+int positions_cpu_st_export( const struct PPRenderSource * source, float alpha, int format, void * buffer, int stride );
+
+
+#endif // __POWDER_POSITIONS_CPU_ST_H__
@@ -0,0 +1,352 @@
+#include "pch.h"
+#include "api.h"
+#include "render_cpu_st.h"
+#include "solver_cpu_st.h"
+#include "air_cpu_st.h"
+#include "shared/workers.h"
+#include "shared/cpu.h"
+#include <string.h>
+
+
+
+#define RENDER_JOB_ROWS 32		//!< Rows of one render job.
+#define RENDER_CHUNK 256		//!< Gathered values are converted to half floats in chunks of this many pixels.
+
+// Float to half conversion constants: values from HALF_MAX up are infinity, values below
+// HALF_MIN_NORMAL are subnormal halves, HALF_MAGIC is 0.5f which aligns subnormal mantissa,
+// HALF_BIAS rebiases exponent and adds rounding bias of mantissa.
+#define HALF_MAX ( ( 127 + 16 ) << 23 )
+#define HALF_MIN_NORMAL ( ( 127 - 14 ) << 23 )
+#define HALF_MAGIC ( ( 127 - 1 ) << 23 )
+#define HALF_BIAS ( 0xfff - ( ( 127 - 15 ) << 23 ) )
+
+
+
+extern struct PPConfiguration sConfiguration;
+extern struct PPParticleType * spParticleTypes;
+extern struct PPParticlePhysInfo * spParticlesPhysInfo;
+extern struct PPParticleMap * spParticleMap;
+extern struct PPWorkers * spWorkers;
+extern float * spHeat;
+extern float * spAirP;
+extern int sAirStride;
+extern int sGridX;
+
+
+
+//! Arguments of one pp_render call.
+struct PPRenderView
+{
+	int format;
+	unsigned char * buffer;
+	int stride;
+	int x;
+	int y;
+	int width;
+	int height;
+	const struct PPParticleMap * map;
+	const float * heat;
+	const struct PPParticlePhysInfo * phys;
+	const struct PPAirParticle * air;	//!< Packed air grid, NULL reads pressure of solver.
+	unsigned int palette[ 256 ];	//!< Colors of cell types.
+	float collision_temp[ 256 ];	//!< Temperatures of collision types.
+};
+
+typedef void (* PPRenderTypesFn) ( const struct PPParticleMap * pmap, unsigned char * out, int count );
+typedef void (* PPRenderColorsFn) ( const struct PPParticleMap * pmap, const unsigned int * palette, unsigned int * out, int count );
+typedef void (* PPRenderHalfFn) ( const float * src, unsigned short * out, int count );
+
+PPRenderTypesFn sRenderTypesFn = NULL;
+PPRenderColorsFn sRenderColorsFn = NULL;
+PPRenderHalfFn sRenderHalfFn = NULL;
+const char * sRenderKernelsName = "";
+
+
+
+
+
+//
+// scalar kernels
+//
+
+static void render_types_scalar( const struct PPParticleMap * pmap, unsigned char * out, int count )
+{
+	int i;
+
+	for( i = 0; i < count; i++ )
+		out[ i ] = ( unsigned char ) pmap[ i ].type;
+}
+
+static void render_colors_scalar( const struct PPParticleMap * pmap, const unsigned int * palette, unsigned int * out, int count )
+{
+	int i;
+
+	for( i = 0; i < count; i++ )
+		out[ i ] = palette[ pmap[ i ].type ];
+}
+
+// Round to nearest even, the same as hardware conversion.
+static unsigned short float_to_half( float f )
+{
+	union { float f; unsigned int u; } v;
+	unsigned int sign, a;
+
+	v.f = f;
+	sign = ( v.u >> 16 ) & 0x8000;
+	a = v.u & 0x7fffffff;
+
+	if( a >= HALF_MAX )
+		return ( unsigned short ) ( sign | ( a > 0x7f800000 ? 0x7e00 : 0x7c00 ) );
+
+	if( a < HALF_MIN_NORMAL )
+	{
+		v.u = a;
+		v.f += 0.5f;
+		return ( unsigned short ) ( sign | ( v.u - HALF_MAGIC ) );
+	}
+
+	return ( unsigned short ) ( sign | ( ( a + HALF_BIAS + ( ( a >> 13 ) & 1 ) ) >> 13 ) );
+}
+
+static void render_half_scalar( const float * src, unsigned short * out, int count )
+{
+	int i;
+
+	for( i = 0; i < count; i++ )
+		out[ i ] = float_to_half( src[ i ] );
+}
+
+
+
+#ifdef CPU_X86
+
+//
+// SSE2 kernels
+//
+
+// Type is the lowest byte of map cell.
+static CPU_TARGET_SSE2 void render_types_sse2( const struct PPParticleMap * pmap, unsigned char * out, int count )
+{
+	const __m128i * src = ( const __m128i * ) pmap;
+	__m128i mask = _mm_set1_epi32( 0xff );
+	__m128i a, b;
+	int i;
+
+	for( i = 0; i + 16 <= count; i += 16, src += 4 )
+	{
+		a = _mm_packs_epi32( _mm_and_si128( _mm_loadu_si128( src ), mask ), _mm_and_si128( _mm_loadu_si128( src + 1 ), mask ) );
+		b = _mm_packs_epi32( _mm_and_si128( _mm_loadu_si128( src + 2 ), mask ), _mm_and_si128( _mm_loadu_si128( src + 3 ), mask ) );
+		_mm_storeu_si128( ( __m128i * ) ( out + i ), _mm_packus_epi16( a, b ) );
+	}
+
+	render_types_scalar( pmap + i, out + i, count - i );
+}
+
+static CPU_TARGET_SSE2 __m128i half4_sse2( const float * src )
+{
+	__m128i x = _mm_castps_si128( _mm_loadu_ps( src ) );
+	__m128i sign_mask = _mm_set1_epi32( ( int ) 0x80000000 );
+	__m128i a = _mm_andnot_si128( sign_mask, x );
+	__m128i special, sub, normal, is_regular, is_sub, r;
+
+	special = _mm_or_si128( _mm_set1_epi32( 0x7c00 ), _mm_and_si128( _mm_cmpgt_epi32( a, _mm_set1_epi32( 0x7f800000 ) ), _mm_set1_epi32( 0x200 ) ) );
+	sub = _mm_sub_epi32( _mm_castps_si128( _mm_add_ps( _mm_castsi128_ps( a ), _mm_set1_ps( 0.5f ) ) ), _mm_set1_epi32( HALF_MAGIC ) );
+	normal = _mm_srli_epi32( _mm_add_epi32( _mm_add_epi32( a, _mm_set1_epi32( HALF_BIAS ) ),
+		_mm_and_si128( _mm_srli_epi32( a, 13 ), _mm_set1_epi32( 1 ) ) ), 13 );
+
+	is_regular = _mm_cmpgt_epi32( _mm_set1_epi32( HALF_MAX ), a );
+	is_sub = _mm_cmpgt_epi32( _mm_set1_epi32( HALF_MIN_NORMAL ), a );
+	r = _mm_or_si128( _mm_and_si128( is_sub, sub ), _mm_andnot_si128( is_sub, normal ) );
+	r = _mm_or_si128( _mm_and_si128( is_regular, r ), _mm_andnot_si128( is_regular, special ) );
+	r = _mm_or_si128( r, _mm_srli_epi32( _mm_and_si128( x, sign_mask ), 16 ) );
+
+	// sign extension lets signed saturating pack keep all 16 bits
+	return _mm_srai_epi32( _mm_slli_epi32( r, 16 ), 16 );
+}
+
+static CPU_TARGET_SSE2 void render_half_sse2( const float * src, unsigned short * out, int count )
+{
+	int i;
+
+	for( i = 0; i + 8 <= count; i += 8 )
+		_mm_storeu_si128( ( __m128i * ) ( out + i ), _mm_packs_epi32( half4_sse2( src + i ), half4_sse2( src + i + 4 ) ) );
+
+	render_half_scalar( src + i, out + i, count - i );
+}
+
+
+
+//
+// AVX2 kernels
+//
+
+static CPU_TARGET_AVX2 void render_colors_avx2( const struct PPParticleMap * pmap, const unsigned int * palette, unsigned int * out, int count )
+{
+	__m256i mask = _mm256_set1_epi32( 0xff );
+	__m256i types;
+	int i;
+
+	for( i = 0; i + 8 <= count; i += 8 )
+	{
+		types = _mm256_and_si256( _mm256_loadu_si256( ( const __m256i * ) ( pmap + i ) ), mask );
+		_mm256_storeu_si256( ( __m256i * ) ( out + i ), _mm256_i32gather_epi32( ( const int * ) palette, types, 4 ) );
+	}
+
+	render_colors_scalar( pmap + i, palette, out + i, count - i );
+}
+
+#endif // CPU_X86
+
+
+
+
+
+// Vector kernels read type as the lowest byte of map cell, which depends on bit-field layout of compiler.
+static int map_type_is_low_byte( )
+{
+	struct PPParticleMap pmap;
+	unsigned int bits;
+
+	memset( &pmap, 0, sizeof( pmap ) );
+	pmap.type = 0xff;
+	memcpy( &bits, &pmap, sizeof( bits ) );
+	return sizeof( pmap ) == sizeof( bits ) && bits == 0xff;
+}
+
+void render_cpu_st_init_kernels( )
+{
+	sRenderTypesFn = render_types_scalar;
+	sRenderColorsFn = render_colors_scalar;
+	sRenderHalfFn = render_half_scalar;
+	sRenderKernelsName = "scalar";
+
+#ifdef CPU_X86
+	if( cpu_has_sse2( ) )
+	{
+		sRenderHalfFn = render_half_sse2;
+		sRenderKernelsName = "sse2";
+		if( map_type_is_low_byte( ) )
+			sRenderTypesFn = render_types_sse2;
+	}
+	if( cpu_has_avx2( ) && map_type_is_low_byte( ) )
+	{
+		sRenderColorsFn = render_colors_avx2;
+		sRenderKernelsName = "avx2";
+	}
+#endif
+}
+
+const char * render_cpu_st_get_kernels_name( )
+{
+	return sRenderKernelsName;
+}
+
+static void render_temperature_row( const struct PPRenderView * view, const struct PPParticleMap * pmap, unsigned short * out )
+{
+	float temps[ RENDER_CHUNK ];
+	int i, j, count;
+
+	if( view->heat )
+	{
+		sRenderHalfFn( view->heat + ( pmap - view->map ), out, view->width );
+		return;
+	}
+
+	for( i = 0; i < view->width; i += count )
+	{
+		count = view->width - i < RENDER_CHUNK ? view->width - i : RENDER_CHUNK;
+		for( j = 0; j < count; j++, pmap++ )
+			temps[ j ] = !pmap->type ? 0.0f : pmap->collision ? view->collision_temp[ pmap->type ] : view->phys[ pmap->index ].temp;
+		sRenderHalfFn( temps, out + i, count );
+	}
+}
+
+static void render_pressure_row( const struct PPRenderView * view, int y, unsigned short * out )
+{
+	float pressures[ RENDER_CHUNK ];
+	const struct PPAirParticle * air = NULL;
+	const float * p = NULL;
+	int i, j, count;
+
+	// solver air may be updated while published one is rendered
+	if( view->air )
+		air = view->air + y / sConfiguration.grid_size * sGridX;
+	else
+		p = spAirP + AIR_INDEX( 0, y / sConfiguration.grid_size );
+
+	for( i = 0; i < view->width; i += count )
+	{
+		count = view->width - i < RENDER_CHUNK ? view->width - i : RENDER_CHUNK;
+		for( j = 0; j < count; j++ )
+			pressures[ j ] = air ? air[ ( view->x + i + j ) / sConfiguration.grid_size ].p : p[ ( view->x + i + j ) / sConfiguration.grid_size ];
+		sRenderHalfFn( pressures, out + i, count );
+	}
+}
+
+static void render_rows_job( void * user, int job, int worker )
+{
+	const struct PPRenderView * view = ( const struct PPRenderView * ) user;
+	const struct PPParticleMap * pmap;
+	unsigned char * out;
+	int row, y;
+	int row_end = ( job + 1 ) * RENDER_JOB_ROWS < view->height ? ( job + 1 ) * RENDER_JOB_ROWS : view->height;
+
+	( void ) worker;
+
+	for( row = job * RENDER_JOB_ROWS; row < row_end; row++ )
+	{
+		y = view->y + row;
+		pmap = view->map + y * sConfiguration.xres + view->x;
+		out = view->buffer + row * view->stride;
+
+		switch( view->format )
+		{
+		case RENDER_RGBA8:
+			sRenderColorsFn( pmap, view->palette, ( unsigned int * ) out, view->width );
+			break;
+		case RENDER_TYPE8:
+			sRenderTypesFn( pmap, out, view->width );
+			break;
+		case RENDER_TEMPERATURE16F:
+			render_temperature_row( view, pmap, ( unsigned short * ) out );
+			break;
+		case RENDER_PRESSURE16F:
+			// pixel rows of the same air cell row are equal
+			if( row > job * RENDER_JOB_ROWS && ( y - 1 ) / sConfiguration.grid_size == y / sConfiguration.grid_size )
+				memcpy( out, out - view->stride, sizeof( unsigned short ) * view->width );
+			else
+				render_pressure_row( view, y, ( unsigned short * ) out );
+			break;
+		}
+	}
+}
+
+int render_cpu_st_run( const struct PPRenderSource * source, int format, void * buffer, int stride, int x, int y, int width, int height )
+{
+	struct PPRenderView view;
+	int i, types_count = pp_get_particle_types_count( );
+
+	view.format = format;
+	view.buffer = ( unsigned char * ) buffer;
+	view.stride = stride;
+	view.x = x;
+	view.y = y;
+	view.width = width;
+	view.height = height;
+	view.map = source ? source->map : spParticleMap;
+	view.heat = source ? source->heat : spHeat;
+	view.phys = source ? source->phys : spParticlesPhysInfo;
+	view.air = source ? source->air : NULL;
+
+	// type 0 is empty cell, types out of range can't appear in map
+	memset( view.palette, 0, sizeof( view.palette ) );
+	memset( view.collision_temp, 0, sizeof( view.collision_temp ) );
+	for( i = 1; i < types_count && i < 256; i++ )
+	{
+		view.palette[ i ] = spParticleTypes[ i ].color;
+		view.collision_temp[ i ] = spParticleTypes[ i ].initial_temp;
+	}
+
+	workers_run( source ? NULL : spWorkers, render_rows_job, &view, ( height + RENDER_JOB_ROWS - 1 ) / RENDER_JOB_ROWS );
+	return 1;
+}
@@ -0,0 +1,27 @@
+#ifndef __POWDER_RENDER_CPU_ST_H__
+#define __POWDER_RENDER_CPU_ST_H__
+
+
+#include "solver/solver.h"
+
+
+
+// Raster output walks particle map rows of the viewport and writes caller's buffer in the same
+// order, so a frame is one sequential pass without touching particle streams for types and colors.
+// Temperatures come from the heat grid if it is enabled, otherwise they are gathered from
+// particles of occupied cells. Pressure of air cell row is converted once and copied to the other
+// pixel rows of the cell. Row blocks are rendered on worker threads, except for a published source, which
+// is rendered while the update may use them.
+
+
+
+//! Select render kernels for current CPU.
+void render_cpu_st_init_kernels( );
+//! Name of selected kernels set.
+const char * render_cpu_st_get_kernels_name( );
+//! Render viewport [x, x + width) x [y, y + height) inside of the world in one of PPRenderFormat to buffer with row stride in bytes.
+//! Reads 'source', or solver state if it's NULL.
+int render_cpu_st_run( const struct PPRenderSource * source, int format, void * buffer, int stride, int x, int y, int width, int height );
+
+
+#endif // __POWDER_RENDER_CPU_ST_H__
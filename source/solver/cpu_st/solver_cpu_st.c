@@ -1,39 +1,113 @@
 #include "pch.h"
+#include "api.h"
 #include "solver_cpu_st.h"
+#include "air_cpu_st.h"
+#include "compact_cpu_st.h"
+#include "chunks_cpu_st.h"
+#include "heat_cpu_st.h"
+#include "planes_cpu_st.h"
+#include "distance_cpu_st.h"
+#include "changes_cpu_st.h"
+#include "render_cpu_st.h"
+#include "positions_cpu_st.h"
+#include "solver/solver.h"
+#include "solver/stats.h"
+#include "solver/trace.h"
 #include "shared/utils.h"
 #include "shared/types.h"
+#include "shared/workers.h"
+#include "shared/random.h"
+#include "shared/bits.h"
+#include "shared/timer.h"
 #include <assert.h>
 #include <math.h>
 
 
 
+#define SLICE_BLOCK 1024			//!< Particles updated between deadline checks of sliced update.
+
+//! Stage of sliced update.
+enum PPSliceStage
+{
+	SLICE_IDLE,				//!< No step in progress.
+	SLICE_PARTICLES,		//!< Air and heat are updated, particles update continues from sSliceIndex.
+	SLICE_FINISH,			//!< Particles are updated, chunks and compaction are left.
+};
+
+
+
 extern struct PPConfiguration sConfiguration;
 extern struct PPConstants sConstants;
 extern struct PPParticleType * spParticleTypes;
+extern struct PPWorkers * spWorkers;
+extern float sCompactBaseline;
+extern float * spHeat;
+extern float * spHeatLast;
+extern unsigned int * spOccupancyBits;
+extern unsigned int * spCollisionBits;
+extern unsigned int * spStagnantBits;
+extern unsigned int * spTypeBits;
+extern int sPlaneStride;
+extern int sPlaneSize;
+extern unsigned char * spCollisionDistance;
+extern struct PPParticleChange * spChanges;
+extern int sChangesCount;
+extern int sChangedCellsCount;
+extern int sChangesCollected;
+extern int sChangesFinished;
+extern struct PPChanges sChanges;
+extern unsigned int * spPlanesMemory;
+extern float * spHeatMask;
+extern float * spHeatConduct;
+extern int sHeatSynced;
 
 struct PPParticleInfo * spParticlesInfo = NULL;
 struct PPParticlePhysInfo * spParticlesPhysInfo = NULL;
 struct PPParticlePhysInfo * spParticlesPhysInfoLast = NULL;
 int sParticleFirstFree;
 int sParticleAliveCount;
-
-
-struct PPAirParticle * spAir = NULL;
-struct PPAirParticle * spAirLast = NULL;
+int * spAliveList = NULL;			//!< Indices of alive particles, the first sParticleAliveCount entries are valid.
+int * spAlivePositions = NULL;		//!< Position of alive particle in spAliveList, indexed by particle.
+
+
+float * spAirMemory = NULL;			//!< Single allocation for all air float arrays.
+float * spAirVx = NULL;
+float * spAirVy = NULL;
+float * spAirP = NULL;
+float * spAirVxLast = NULL;
+float * spAirVyLast = NULL;
+float * spAirPLast = NULL;
+float * spAirOpen = NULL;			//!< 1 for open cells and 0 for collision cells, used as kernels mask.
+unsigned char * spAirType = NULL;	//!< Collision type of air cells, sGridX * sGridY without border.
+int * spAirSolid = NULL;			//!< Number of collision pixels of air cells, the cell is solid when it is full.
+float * spAirScratch = NULL;		//!< Air kernels scratch, one piece per air thread.
+int sAirThreads;
+int sAirStride;
 int sGridX;
 int sGridY;
 
+struct PPAirParticle * spAir = NULL;		//!< Public view of current air grid, see solver_cpu_st_get_air_particle_stream.
+struct PPAirParticle * spAirLast = NULL;	//!< Public view of previous air grid.
+int sAirViewDirty = 0;						//!< View was handed out and may be modified by the caller.
+
 float sAirKernel[9];
 
 
-//! Particle map entry.
-struct PPParticleMap
-{
-	unsigned int type : 8;		//!< Particle type. Used for caching.
-    unsigned int stagnant : 1;  //!< Cached value of particle stagnant state.
-	unsigned int index : 22;	//!< Index of particle in particles array.
-	unsigned int collision : 1;	//!< Is this particle collision particle?
-} * spParticleMap = NULL;
+struct PPParticleMap * spParticleMap = NULL;
+int * spUpdateList = NULL;			//!< Particles of awake chunks, used only with sleeping chunks.
+
+unsigned int sFrame;						//!< Number of updated frames, part of random generator key.
+float sMaxSpeed;							//!< Largest velocity component of particles moved by the last update, in pixels per second.
+
+struct PPStepContext sSliceCtx;				//!< Context of step in progress.
+int sSliceStage = SLICE_IDLE;
+int sSliceIndex;							//!< Position in alive list or spUpdateList, where particles update continues.
+int sSliceCount;							//!< Number of particles in spUpdateList.
+int sSliceSpan;								//!< Maximal index of updated particle + 1.
+
+struct PPTypeCoefs * spTypeCoefs = NULL;	//!< Per type coefficients, indexed by particle type.
+int sTypeCoefsCount;
+pp_time_t sTypeCoefsDt;						//!< Frame time coefficients were computed for.
 
 
 
@@ -79,16 +153,87 @@ int solver_cpu_st_init( )
 	}
 	memset( spParticleMap, 0, sizeof( struct PPParticleMap ) * num_parts );
 
+	spAliveList = malloc_log( sizeof( int ) * num_parts );
+	if( !spAliveList )
+	{
+		solver_cpu_st_deinit( );
+		return 0;
+	}
+
+	spAlivePositions = malloc_log( sizeof( int ) * num_parts );
+	if( !spAlivePositions )
+	{
+		solver_cpu_st_deinit( );
+		return 0;
+	}
+
+	// dead slots are zeroed, so equal worlds have equal state sections
+	memset( spParticlesInfo, 0, sizeof( struct PPParticleInfo ) * num_parts );
+	memset( spParticlesPhysInfo, 0, sizeof( struct PPParticlePhysInfo ) * num_parts );
+	memset( spParticlesPhysInfoLast, 0, sizeof( struct PPParticlePhysInfo ) * num_parts );
+	memset( spAliveList, 0, sizeof( int ) * num_parts );
+
 	for(i=0; i< num_parts - 1; i++)
         spParticlesInfo[i].life = i+1;
     spParticlesInfo[num_parts - 1].life = -1;
 	sParticleFirstFree = 0;
 	sParticleAliveCount = 0;
+	sCompactBaseline = 0.0f;
+	sFrame = 0;
+	sMaxSpeed = 0.0f;
+	sSliceStage = SLICE_IDLE;
 
 	sGridX = sConfiguration.xres / sConfiguration.grid_size;
 	sGridY = sConfiguration.yres / sConfiguration.grid_size;
 
+	sAirStride = sGridX + 2;
+	num_parts = sAirStride * ( sGridY + 2 );
+	spAirMemory = malloc_log( sizeof( float ) * num_parts * 7 );
+	if( !spAirMemory )
+	{
+		solver_cpu_st_deinit( );
+		return 0;
+	}
+	memset( spAirMemory, 0, sizeof( float ) * num_parts * 7 );
+	spAirVx = spAirMemory;
+	spAirVy = spAirVx + num_parts;
+	spAirP = spAirVy + num_parts;
+	spAirVxLast = spAirP + num_parts;
+	spAirVyLast = spAirVxLast + num_parts;
+	spAirPLast = spAirVyLast + num_parts;
+	spAirOpen = spAirPLast + num_parts;
+
+	// single thread processes the whole grid as one block
+	sAirThreads = sConfiguration.air_threads < workers_count( spWorkers ) ? sConfiguration.air_threads : workers_count( spWorkers );
+	if( sAirThreads > 1 )
+		num_parts = sAirThreads * air_cpu_st_get_scratch_size( sConfiguration.air_tile_size < sGridX ? sConfiguration.air_tile_size : sGridX );
+	else
+		num_parts = air_cpu_st_get_scratch_size( sGridX );
+
+	spAirScratch = malloc_log( sizeof( float ) * num_parts );
+	if( !spAirScratch )
+	{
+		solver_cpu_st_deinit( );
+		return 0;
+	}
+
 	num_parts = sGridX * sGridY;
+	spAirType = malloc_log( num_parts );
+	if( !spAirType )
+	{
+		solver_cpu_st_deinit( );
+		return 0;
+	}
+	memset( spAirType, 0, num_parts );
+
+	spAirSolid = malloc_log( sizeof( int ) * num_parts );
+	if( !spAirSolid )
+	{
+		solver_cpu_st_deinit( );
+		return 0;
+	}
+	memset( spAirSolid, 0, sizeof( int ) * num_parts );
+
 	spAir = malloc_log( sizeof( struct PPAirParticle ) * num_parts );
 	if( !spAir )
 	{
@@ -105,6 +250,11 @@ int solver_cpu_st_init( )
 
 	memset( spAir, 0, sizeof( struct PPAirParticle ) * num_parts );
 	memset( spAirLast, 0, sizeof( struct PPAirParticle ) * num_parts );
+	sAirViewDirty = 0;
+
+	for( j = 0; j < sGridY; j++ )
+		for( i = 0; i < sGridX; i++ )
+			spAirOpen[ AIR_INDEX( i, j ) ] = 1.0f;
 
     for(j=-1; j<2; j++)
         for(i=-1; i<2; i++)
@@ -117,6 +267,65 @@ int solver_cpu_st_init( )
         for(i=-1; i<2; i++)
             sAirKernel[(i+1)+3*(j+1)] *= s;
 
+	air_cpu_st_init_kernels( );
+	if( sConfiguration.log_fn )
+		sConfiguration.log_fn( LOG_INFO, "Air update: kernels=%s, threads=%d, tile=%d.",
+			air_cpu_st_get_kernels_name( ), sAirThreads, sConfiguration.air_tile_size );
+
+	render_cpu_st_init_kernels( );
+	positions_cpu_st_init_kernels( );
+	if( sConfiguration.log_fn )
+		sConfiguration.log_fn( LOG_INFO, "Render: kernels=%s, positions=%s.", render_cpu_st_get_kernels_name( ), positions_cpu_st_get_kernels_name( ) );
+
+	sTypeCoefsCount = pp_get_particle_types_count( );
+	spTypeCoefs = malloc_log( sizeof( struct PPTypeCoefs ) * sTypeCoefsCount );
+	if( !spTypeCoefs )
+	{
+		solver_cpu_st_deinit( );
+		return 0;
+	}
+	sTypeCoefsDt = -1;
+
+	if( !planes_cpu_st_init( ) )
+	{
+		solver_cpu_st_deinit( );
+		return 0;
+	}
+
+	if( !distance_cpu_st_init( ) )
+	{
+		solver_cpu_st_deinit( );
+		return 0;
+	}
+
+	if( !heat_cpu_st_init( ) )
+	{
+		solver_cpu_st_deinit( );
+		return 0;
+	}
+
+	if( !chunks_cpu_st_init( ) )
+	{
+		solver_cpu_st_deinit( );
+		return 0;
+	}
+
+	if( !changes_cpu_st_init( ) )
+	{
+		solver_cpu_st_deinit( );
+		return 0;
+	}
+
+	if( chunks_cpu_st_enabled( ) )
+	{
+		spUpdateList = malloc_log( sizeof( int ) * sConfiguration.xres * sConfiguration.yres );
+		if( !spUpdateList )
+		{
+			solver_cpu_st_deinit( );
+			return 0;
+		}
+	}
+
 	return 1;
 }
 
@@ -125,93 +334,133 @@ int solver_cpu_st_deinit( )
 	free( spParticlesInfo );
 	free( spParticlesPhysInfo );
 	free( spParticlesPhysInfoLast );
+	free( spAirMemory );
+	free( spAirScratch );
+	free( spAirType );
+	free( spAirSolid );
 	free( spAir );
 	free( spAirLast );
 	free( spParticleMap );
+	free( spAliveList );
+	free( spAlivePositions );
+	free( spUpdateList );
+	free( spTypeCoefs );
+	changes_cpu_st_deinit( );
+	chunks_cpu_st_deinit( );
+	heat_cpu_st_deinit( );
+	distance_cpu_st_deinit( );
+	planes_cpu_st_deinit( );
+	spParticlesInfo = NULL;
+	spParticlesPhysInfo = NULL;
+	spParticlesPhysInfoLast = NULL;
+	spAirMemory = NULL;
+	spAirScratch = NULL;
+	spAirType = NULL;
+	spAirSolid = NULL;
+	spAir = NULL;
+	spAirLast = NULL;
+	spParticleMap = NULL;
+	spAliveList = NULL;
+	spAlivePositions = NULL;
+	spUpdateList = NULL;
+	spTypeCoefs = NULL;
 	return 1;
 }
 
+void free_part( unsigned int i )
+{
+	int last, position = spAlivePositions[ i ];
+
+	spParticlesInfo[ i ].life = sParticleFirstFree;
+	sParticleFirstFree = i;
+	sParticleAliveCount--;
+
+	// the last alive particle takes place of the removed one
+	last = spAliveList[ sParticleAliveCount ];
+	spAliveList[ position ] = last;
+	spAlivePositions[ last ] = position;
+	STATS_COUNT( killed );
+}
+
 void kill_part( struct PPParticleInfo * pi, int x, int y, unsigned int i )
 {
 	pi->type = 0;
-	pi->life = sParticleFirstFree;
-	sParticleFirstFree = i;
 
 	if( x >= 0 && x < sConfiguration.xres && y >= 0 && y < sConfiguration.yres )
 	{
 		assert( spParticleMap[ y * sConfiguration.xres + x ].index == i );
 		assert( spParticlesInfo + spParticleMap[ y * sConfiguration.xres + x ].index == pi );
 
+		planes_cpu_st_remove( x, y, spParticleMap[ y * sConfiguration.xres + x ].type );
 		spParticleMap[ y * sConfiguration.xres + x ].type = 0;
+		heat_cpu_st_clear( y * sConfiguration.xres + x );
 	}
 
-	sParticleAliveCount--;
+	free_part( i );
 }
 
-void update_air( pp_time_t dt )
+static void air_pack_view( struct PPAirParticle * view, const float * vx, const float * vy, const float * p )
 {
-    int x, y, i, j;
-    float dp, dx, dy, f;
-	float avgx, avgy, avgp;
-	float sdt = FLT_SECOND * dt;
-	float p_loss_factor = ( float ) pow( sConstants.p_loss, ( float ) dt * FLT_SECOND );
-	float v_loss_factor = ( float ) pow( sConstants.v_loss, ( float ) dt * FLT_SECOND );
-	struct PPAirParticle * air;
-	struct PPAirParticle * air_last, * tmp;
-
-	air = spAirLast;
-	spAirLast = spAir;
-	spAir = air;
-
-	air = spAir;
-	air_last = spAirLast;
-    for( y = 0; y < sGridY; y++ )
-        for( x = 0; x < sGridX; x++, air++, air_last++ )
-        {
-			air->type = air_last->type;
-			if( air_last->type )
-			{
-				air->vx = air->vy = air->p = 0.0f;
-				continue;
-			}
+	int x, y, i;
 
-            avgx = 0.0f;
-            avgy = 0.0f;
-            avgp = 0.0f;
-            for( j = -1; j < 2; j++ )
-                for( i = -1; i < 2; i++ )
-				{
-                    if( y + j >= 0 && y + j < sGridY &&
-                        x + i >= 0 && x + i < sGridX )
-					{
-	                    f = sAirKernel[i + 1 + ( j + 1 ) * 3];
-						tmp = air_last + sGridX * j + i;
-						avgx += tmp->vx * f;
-						avgy += tmp->vy * f;
-						avgp += tmp->p * f;
-					}
-				}
+	for( y = 0; y < sGridY; y++ )
+		for( x = 0; x < sGridX; x++, view++ )
+		{
+			i = AIR_INDEX( x, y );
+			view->type = spAirType[ y * sGridX + x ];
+			view->vx = vx[ i ];
+			view->vy = vy[ i ];
+			view->p = p[ i ];
+		}
+}
 
-			dp = dx = dy = 0.0f;
-			if( y > 0 && y < sGridY - 1 )
-			{
-				dp += ( air_last + sGridX )->vy - ( air_last - sGridX )->vy;
-	            dy = ( air_last + sGridX )->p - ( air_last - sGridX )->p;
-			}
+// Takes changes made by the caller to the current air view.
+static void air_sync_view( )
+{
+	const struct PPAirParticle * view = spAir;
+	int x, y, i;
 
-			if( x > 0 && x < sGridX - 1 )
-			{
-				dp += ( air_last + 1 )->vx - ( air_last - 1 )->vx;
-	            dx = ( air_last + 1 )->p - ( air_last - 1 )->p;
-			}
+	if( !sAirViewDirty )
+		return;
 
-			air->vx = avgx * v_loss_factor - dx * sConstants.v_hstep * sdt;
-			air->vy = avgy * v_loss_factor - dy * sConstants.v_hstep * sdt;
-			air->p = avgp * p_loss_factor - dp * sConstants.p_hstep * sdt;
+	for( y = 0; y < sGridY; y++ )
+		for( x = 0; x < sGridX; x++, view++ )
+		{
+			i = AIR_INDEX( x, y );
+			spAirVx[ i ] = view->vx;
+			spAirVy[ i ] = view->vy;
+			spAirP[ i ] = view->p;
 		}
+
+	sAirViewDirty = 0;
+}
+
+void solver_cpu_st_update_air( pp_time_t dt )
+{
+	float * tmp;
+
+	air_sync_view( );
+
+	tmp = spAirVxLast;
+	spAirVxLast = spAirVx;
+	spAirVx = tmp;
+
+	tmp = spAirVyLast;
+	spAirVyLast = spAirVy;
+	spAirVy = tmp;
+
+	tmp = spAirPLast;
+	spAirPLast = spAirP;
+	spAirP = tmp;
+
+	air_cpu_st_begin( dt );
+	if( sAirThreads > 1 )
+		air_cpu_st_update_tiles( spWorkers, sAirThreads, sConfiguration.air_tile_size, spAirScratch );
+	else
+		air_cpu_st_update_block( 0, 0, sGridX, sGridY, spAirScratch );
 }
 
-static __inline int try_move( int i, int x, int y, int nx, int ny )
+static __inline int try_move( struct PPStepContext * ctx, int i, int x, int y, int nx, int ny )
 {
 	i;
 
@@ -221,12 +470,122 @@ static __inline int try_move( int i, int x, int y, int nx, int ny )
 	if( nx < 1 || ny < 1 || nx >= sConfiguration.xres - 1 || ny >= sConfiguration.yres - 1 )
 		return 1;
 
-	if( spParticleMap[ ny * sConfiguration.xres + nx ].type )
+	if( ny < ctx->row_min || ny >= ctx->row_max )
+	{
+		ctx->defer = 1;
+		return 0;
+	}
+
+	STEP_STAT( ctx, moves );
+	if( PLANE_TEST( spOccupancyBits, nx, ny ) )
+	{
+		STEP_STAT( ctx, moves_failed );
 		return 0;
+	}
 
 	return 1;
 }
 
+// Occupancy of eight neighbours of (x, y) in plane: three cells above, left and right, three cells below.
+static __inline unsigned int plane_neighbours( const unsigned int * plane, int x, int y )
+{
+	const unsigned int * row = PLANE_ROW( plane, y - 1 );
+	int b = x - 1;
+	int w = b >> 5;
+	int shift = b & 31;
+	unsigned int up, mid, down;
+
+	up = row[ w ] >> shift;
+	mid = row[ w + sPlaneStride ] >> shift;
+	down = row[ w + 2 * sPlaneStride ] >> shift;
+	if( shift > 29 )
+	{
+		up |= row[ w + 1 ] << ( 32 - shift );
+		mid |= row[ w + 1 + sPlaneStride ] << ( 32 - shift );
+		down |= row[ w + 1 + 2 * sPlaneStride ] << ( 32 - shift );
+	}
+
+	return ( up & 7 ) | ( ( mid & 1 ) << 3 ) | ( ( mid & 4 ) << 2 ) | ( ( down & 7 ) << 5 );
+}
+
+// Cells of row y in [a, b], where liquid spreading stops: other particles or collisions in row y,
+// and free cells of rows y and ny.
+static __inline unsigned int spread_events( int w, int y, int ny, int type, int a, int b )
+{
+	unsigned int occ = PLANE_ROW( spOccupancyBits, y )[ w ];
+	unsigned int events = ( occ & ~PLANE_ROW( spTypeBits + type * sPlaneSize, y )[ w ] ) | ~occ |
+		~PLANE_ROW( spOccupancyBits, ny )[ w ];
+
+	if( w == a >> 5 )
+		events &= ~0u << ( a & 31 );
+	if( w == b >> 5 )
+		events &= ~0u >> ( 31 - ( b & 31 ) );
+	return events;
+}
+
+// Find where liquid at (x, y) spreads along its row in direction r: the first column 'rx', where row ny
+// or row y is free, passing through particles of the same type. Search covers cells x + 1 to x + k - 1
+// to the right and x - 1 to x - k to the left. World border columns count as free. Returns 1 if the
+// particle goes to row ny, 2 if it stays in row y and 0 if the way is blocked.
+static int spread_liquid( struct PPStepContext * ctx, int x, int y, int ny, int r, int k, int type, int * rx )
+{
+	int a, b, border, w, j;
+	unsigned int events;
+
+	if( r > 0 )
+	{
+		a = x + 1;
+		b = x + k - 1;
+		border = b >= sConfiguration.xres - 1 ? sConfiguration.xres - 1 : -1;
+		if( b > sConfiguration.xres - 2 )
+			b = sConfiguration.xres - 2;
+
+		for( w = a >> 5, j = -1; a <= b && w <= b >> 5; w++ )
+		{
+			STEP_STAT( ctx, liquid_search );
+			events = spread_events( w, y, ny, type, a, b );
+			if( events )
+			{
+				j = w * 32 + bits_ctz( events );
+				break;
+			}
+		}
+	}
+	else
+	{
+		a = x - k;
+		b = x - 1;
+		border = a <= 0 ? 0 : -1;
+		if( a < 1 )
+			a = 1;
+
+		for( w = b >> 5, j = -1; a <= b && w >= a >> 5; w-- )
+		{
+			STEP_STAT( ctx, liquid_search );
+			events = spread_events( w, y, ny, type, a, b );
+			if( events )
+			{
+				j = w * 32 + bits_highest( events );
+				break;
+			}
+		}
+	}
+
+	if( j < 0 )
+	{
+		if( border < 0 )
+			return 0;
+		j = border;
+	}
+
+	// other particle or collision in the way
+	if( PLANE_TEST( spOccupancyBits, j, y ) && !PLANE_TEST( spTypeBits + type * sPlaneSize, j, y ) )
+		return 0;
+
+	*rx = j;
+	return j == border || !PLANE_TEST( spOccupancyBits, j, ny ) ? 1 : 2;
+}
+
 #ifdef _DEBUG
 int incollision( const struct PPParticlePhysInfo * p )
 {
@@ -239,16 +598,39 @@ int incollision( const struct PPParticlePhysInfo * p )
 	nx /= sConfiguration.grid_size;
 	ny /= sConfiguration.grid_size;
 
-	if( spAir[ ny * sGridX + nx ].type )
+	if( spAirType[ ny * sGridX + nx ] )
 		return 1;
 
 	return 0;
 }
 #endif
 
-static __inline float frand( )
+// Random numbers depend only on seed, frame, particle and stage, not on processing order or thread,
+// so a deferred particle draws the same numbers as it would without deferring.
+static __inline void step_random_begin( struct PPStepContext * ctx, int i, int stage )
+{
+	ctx->rnd_counter[ 0 ] = ( unsigned int ) i;
+	ctx->rnd_counter[ 1 ] = ( unsigned int ) stage;
+	ctx->rnd_counter[ 2 ] = 0;
+	ctx->rnd_counter[ 3 ] = 0;
+	ctx->rnd_left = 0;
+}
+
+static __inline unsigned int step_rand( struct PPStepContext * ctx )
+{
+	if( !ctx->rnd_left )
+	{
+		random_philox( ctx->rnd_counter, ctx->rnd_key, ctx->rnd );
+		ctx->rnd_counter[ 2 ]++;
+		ctx->rnd_left = 4;
+	}
+
+	return ctx->rnd[ --ctx->rnd_left ];
+}
+
+static __inline float frand( struct PPStepContext * ctx )
 {
-	return ( float ) rand( ) / RAND_MAX;
+	return random_to_float( step_rand( ctx ) );
 }
 
 static __inline int fast_ftol( float x )
@@ -261,438 +643,594 @@ static __inline int fast_ftol( float x )
     return (int)((m >> e) & -(e < 32));
 }
 
-void solver_cpu_st_update( pp_time_t dt )
+// Record particle change of update step.
+static __inline void step_change( struct PPStepContext * ctx, int i, int x0, int y0, int x1, int y1 )
 {
-	struct PPParticleInfo * parti;
-	struct PPParticlePhysInfo * partp, *partpl;
-	struct PPAirParticle * air;
-	struct PPParticleType * ptype;
-    struct PPParticleMap * tempp = NULL, * n, * ne, * e, * se, * s, * sw, * w, * nw;
-	int i, j, k, r, npart;
-	int x, y, nx = 0, ny = 0;
-	int gridx, gridy;
-	int found, savestagnant, wasblocked;
-	float loss_factor;
-	float sdt = FLT_SECOND * dt;
-	float accum_heat;
-	float savex, savey;
-	float dx, dy, absdx, absdy;
-	int heat_count;
-	int processed_count = 0;
-	float maxv = 0.0f;
-
-	update_air( dt );
-
-	partp = spParticlesPhysInfo;
-	spParticlesPhysInfo = spParticlesPhysInfoLast;
-	spParticlesPhysInfoLast = partp;
-
-	npart = sConfiguration.xres * sConfiguration.yres;
+	struct PPParticleChange * change;
 
-	parti = spParticlesInfo;
-	partpl = spParticlesPhysInfoLast;
-	partp = spParticlesPhysInfo;
+	if( !spChanges )
+		return;
 
-	for( i = 0; i < npart && processed_count < sParticleAliveCount; i++, parti++, partp++, partpl++ )
+	if( !ctx->changes )
 	{
-		if( !parti->type )
-			continue;
-
-		x = fast_ftol( partpl->x );
-		y = fast_ftol( partpl->y );
+		changes_cpu_st_add( i, x0, y0, x1, y1 );
+		return;
+	}
 
-        assert( ( int ) spParticleMap[ y * sConfiguration.xres + x ].index == i );
-        assert( spParticleMap[ y * sConfiguration.xres + x ].stagnant == parti->stagnant );
+	change = ctx->changes + ctx->changes_count++;
+	change->index = i;
+	change->x0 = x0;
+	change->y0 = y0;
+	change->x1 = x1;
+	change->y1 = y1;
+}
 
-		if( parti->life >= 0 )
-		{
-			parti->life -= dt;
-			if( parti->life <= 0 )
-			{
-				kill_part( parti, x, y, i );
-				continue;
-			}
-		}
+static void step_kill( struct PPStepContext * ctx, struct PPParticleInfo * pi, int x, int y, int i )
+{
+	step_change( ctx, i, x, y, -1, -1 );
 
-        assert( !( x < 1 || y < 1 || x >= sConfiguration.xres - 1 || y >= sConfiguration.yres - 1 ) );
+	if( !ctx->killed )
+	{
+		kill_part( pi, x, y, i );
+		return;
+	}
 
-        tempp = spParticleMap + y * sConfiguration.xres + x;
-        n = tempp - sConfiguration.xres;
-        ne = n + 1;
-        e = tempp + 1;
-        se = e + sConfiguration.xres;
-        s = se - 1;
-        sw = s - 1;
-        w = tempp - 1;
-        nw = n - 1;
+	// particle is returned to free list later by the caller, only its own map cell is touched here
+	pi->type = 0;
+	if( x >= 0 && x < sConfiguration.xres && y >= 0 && y < sConfiguration.yres )
+	{
+		assert( ( int ) spParticleMap[ y * sConfiguration.xres + x ].index == i );
+		planes_cpu_st_remove( x, y, spParticleMap[ y * sConfiguration.xres + x ].type );
+		spParticleMap[ y * sConfiguration.xres + x ].type = 0;
+		heat_cpu_st_clear( y * sConfiguration.xres + x );
+	}
 
-		//
-		// handle temperature
-		//
+	ctx->killed[ ctx->killed_count++ ] = i;
+}
 
-		ptype = spParticleTypes + parti->type;
-		if( ptype->hconduct > 0.0f )
-		{
-			accum_heat = 0.0f;
-			heat_count = 0;
-
-            if( n->type )
-            {
-                accum_heat += ( spParticlesPhysInfoLast + n->index )->temp;
-                heat_count++;
-            }
-            if( ne->type )
-            {
-                accum_heat += ( spParticlesPhysInfoLast + ne->index )->temp;
-                heat_count++;
-            }
-            if( e->type )
-            {
-                accum_heat += ( spParticlesPhysInfoLast + e->index )->temp;
-                heat_count++;
-            }
-            if( se->type )
-            {
-                accum_heat += ( spParticlesPhysInfoLast + se->index )->temp;
-                heat_count++;
-            }
-            if( s->type )
-            {
-                accum_heat += ( spParticlesPhysInfoLast + s->index )->temp;
-                heat_count++;
-            }
-            if( sw->type )
-            {
-                accum_heat += ( spParticlesPhysInfoLast + sw->index )->temp;
-                heat_count++;
-            }
-            if( w->type )
-            {
-                accum_heat += ( spParticlesPhysInfoLast + w->index )->temp;
-                heat_count++;
-            }
-            if( nw->type )
-            {
-                accum_heat += ( spParticlesPhysInfoLast + nw->index )->temp;
-                heat_count++;
-            }
-
-			if( heat_count > 0 )
-				partp->temp = partpl->temp + ( accum_heat / heat_count - partpl->temp ) * ptype->hconduct * sdt;
-		}
-        else
-        {
-            heat_count = n->type ? 1 : 0;
-            if( ne->type )
-                heat_count++;
-            if( e->type )
-                heat_count++;
-            if( se->type )
-                heat_count++;
-            if( s->type )
-                heat_count++;
-            if( sw->type )
-                heat_count++;
-            if( w->type )
-                heat_count++;
-            if( nw->type )
-                heat_count++;
-        }
+void solver_cpu_st_begin_frame( struct PPStepContext * ctx )
+{
+	sFrame++;
+	ctx->rnd_key[ 0 ] = sConfiguration.seed;
+	ctx->rnd_key[ 1 ] = sFrame;
+	ctx->rnd_left = 0;
+}
 
-        wasblocked = parti->blocked;
-        parti->blocked = heat_count == 8 &&
-            n->stagnant && ne->stagnant && e->stagnant &&
-            se->stagnant && s->stagnant && sw->stagnant &&
-            w->stagnant && nw->stagnant;
+void solver_cpu_st_swap_streams( )
+{
+	struct PPParticlePhysInfo * tmp;
 
-		//
-		// handle particle update, based on its type and neighbours
-		//
+	tmp = spParticlesPhysInfo;
+	spParticlesPhysInfo = spParticlesPhysInfoLast;
+	spParticlesPhysInfoLast = tmp;
+}
 
-#include "particles/update_cpu_st.inl"
+#define STATE_KERNEL update_state_0
+#define STATE_HCONDUCT 0
+#define STATE_HOTAIR 0
+#define STATE_DIFFUSION 0
+#include "state_cpu_st.inl"
+
+#define STATE_KERNEL update_state_1
+#define STATE_HCONDUCT 1
+#define STATE_HOTAIR 0
+#define STATE_DIFFUSION 0
+#include "state_cpu_st.inl"
+
+#define STATE_KERNEL update_state_2
+#define STATE_HCONDUCT 0
+#define STATE_HOTAIR 1
+#define STATE_DIFFUSION 0
+#include "state_cpu_st.inl"
+
+#define STATE_KERNEL update_state_3
+#define STATE_HCONDUCT 1
+#define STATE_HOTAIR 1
+#define STATE_DIFFUSION 0
+#include "state_cpu_st.inl"
+
+#define STATE_KERNEL update_state_4
+#define STATE_HCONDUCT 0
+#define STATE_HOTAIR 0
+#define STATE_DIFFUSION 1
+#include "state_cpu_st.inl"
+
+#define STATE_KERNEL update_state_5
+#define STATE_HCONDUCT 1
+#define STATE_HOTAIR 0
+#define STATE_DIFFUSION 1
+#include "state_cpu_st.inl"
+
+#define STATE_KERNEL update_state_6
+#define STATE_HCONDUCT 0
+#define STATE_HOTAIR 1
+#define STATE_DIFFUSION 1
+#include "state_cpu_st.inl"
+
+#define STATE_KERNEL update_state_7
+#define STATE_HCONDUCT 1
+#define STATE_HOTAIR 1
+#define STATE_DIFFUSION 1
+#include "state_cpu_st.inl"
+
+// Kernels indexed by feature mask: 1 - heat conduct, 2 - hot air, 4 - diffusion.
+static int ( * const sStateKernels[ 8 ] )( struct PPStepContext * ctx, int i ) =
+{
+	update_state_0, update_state_1, update_state_2, update_state_3,
+	update_state_4, update_state_5, update_state_6, update_state_7,
+};
 
-		partp->x = partpl->x;
-		partp->y = partpl->y;
-        if( parti->blocked )
-        {
-            if( !wasblocked )
-            {
-                partp->vx = 0.0f;
-                partp->vy = 0.0f;
-                parti->stagnant = 1;
-			    parti->freefall = 0;
-    		    spParticleMap[ y * sConfiguration.xres + x ].stagnant = parti->stagnant;
-            }
-			processed_count++;
-            continue;
-        }
+void solver_cpu_st_prepare_types( pp_time_t dt )
+{
+	struct PPParticleType * ptype;
+	struct PPTypeCoefs * coefs;
+	float sdt = FLT_SECOND * dt;
+	int i, j;
 
-		assert( ptype->move_type != MT_IMMOVABLE );
+	// particle types don't change after initialization, so only frame time matters
+	if( dt == sTypeCoefsDt )
+		return;
 
-		//
-		// handle velocity
-		//
+	for( i = 0, ptype = spParticleTypes, coefs = spTypeCoefs; i < sTypeCoefsCount; i++, ptype++, coefs++ )
+	{
+		// heat grid conducts heat in a separate pass
+		j = ( ptype->hconduct > 0.0f && !heat_cpu_st_enabled( ) ? 1 : 0 ) |
+			( ptype->hotair > 0.0f ? 2 : 0 ) |
+			( ptype->diffusion > 0.0f ? 4 : 0 );
+		coefs->update_state = sStateKernels[ j ];
+		coefs->airloss = ( float ) pow( ptype->airloss, ( float ) dt * FLT_SECOND );
+		coefs->vloss = ( float ) pow( ptype->vloss, ( float ) dt * FLT_SECOND );
+		for( j = 0; j < 9; j++ )
+			coefs->hotair[ j ] = ptype->hotair * sdt * sAirKernel[ j ];
+	}
+	sTypeCoefsDt = dt;
+}
 
-        gridx = x / sConfiguration.grid_size;
-		gridy = y / sConfiguration.grid_size;
+int solver_cpu_st_update_particle_state( struct PPStepContext * ctx, int i )
+{
+	STEP_STAT( ctx, particles );
+	return spTypeCoefs[ spParticlesInfo[ i ].type ].update_state( ctx, i );
+}
 
-		air = spAir + gridy * sGridX + gridx;
-		assert( !air->type );
+int solver_cpu_st_update_particle_position( struct PPStepContext * ctx, int i )
+{
+	struct PPParticleInfo * parti = spParticlesInfo + i;
+	struct PPParticlePhysInfo * partp = spParticlesPhysInfo + i;
+	struct PPParticlePhysInfo * partpl = spParticlesPhysInfoLast + i;
+	struct PPParticleType * ptype = spParticleTypes + parti->type;
+    struct PPParticleMap * tempp = NULL;
+	int j, k, r;
+	int x, y, nx = 0, ny = 0;
+	int ty0, ty1;
+	int leap, step;
+	int found, savestagnant, savefreefall;
+	float sdt = ctx->sdt;
+	float savex, savey;
+	float dx, dy, absdx, absdy;
+	float maxv;
 
-		loss_factor = ( float ) pow( ptype->airloss, ( float ) dt * FLT_SECOND );
+	x = fast_ftol( partpl->x );
+	y = fast_ftol( partpl->y );
+	step_random_begin( ctx, i, 1 );
 
-		air->vx *= loss_factor;
-		air->vy *= loss_factor;
+	//
+	// handle position
+	//
 
-		air->vx += ptype->airdrag * partpl->vx * sdt;
-		air->vy += ptype->airdrag * partpl->vy * sdt;
+	dx = partp->vx * sdt;
+	dy = partp->vy * sdt;
 
-		if( ptype->hotair > 0 && gridy > 0 && gridy < sGridY - 1 && 
-			gridx > 0 && gridx < sGridX - 1 )
+	// rows covered by trace must be inside of the window
+	ty0 = y - 1;
+	ty1 = y + 1;
+	if( dy < 0.0f )
+		ty0 = partpl->y + dy < 1.0f ? 0 : fast_ftol( partpl->y + dy ) - 1;
+	else
+		ty1 = fast_ftol( partpl->y + dy ) + 1;
+	if( ty1 > sConfiguration.yres - 1 )
+		ty1 = sConfiguration.yres - 1;
+	if( ty0 < ctx->row_min || ty1 >= ctx->row_max )
+		return STEP_DEFERRED;
+
+	// trace against collisions, every step moves by less than one cell
+    absdx = fabsf( dx );
+    absdy = fabsf( dy );
+	maxv = absdx > absdy ? absdx : absdy;
+	if( maxv > ctx->max_move )
+		ctx->max_move = maxv;
+	k = fast_ftol( maxv + 1 );
+	dx /= k;
+	dy /= k;
+	nx = x;
+	ny = y;
+	for( j = 0; j < k; j += leap )
+	{
+		// steps before the distance to nearest collision or border can't stop particle, test only the last one
+		leap = spCollisionDistance[ ny * sConfiguration.xres + nx ];
+		assert( leap > 0 );
+		STEP_STAT( ctx, trace_steps );
+		if( leap > k - j )
+			leap = k - j;
+		for( step = 0; step < leap; step++ )
 		{
-			for( j = -1; j < 2; j++ )
-				for( k = -1; k < 2; k++ )
-					( air + j * sGridX + k )->p += ptype->hotair * sdt * sAirKernel[k + 1 + ( j + 1 ) * 3];
+			partp->x += dx;
+			partp->y += dy;
 		}
+		nx = fast_ftol( partp->x );
+		ny = fast_ftol( partp->y );
+		if( nx < 1 || nx >= sConfiguration.xres - 1 ||
+			ny < 1 || ny >= sConfiguration.yres - 1 )
+			break;
 
-		loss_factor = ( float ) pow( ptype->vloss, ( float ) dt * FLT_SECOND );
+		if( PLANE_TEST( spCollisionBits, nx, ny ) )
+			break;
+	}
+
+	if( nx < 1 || nx >= sConfiguration.xres - 1 ||
+		ny < 1 || ny >= sConfiguration.yres - 1 )
+    {
+		step_kill( ctx, parti, x, y, i );
+		return STEP_KILLED;
+    }
 
-		partp->vx = partpl->vx * loss_factor + ptype->advection * air->vx * sdt;
-		partp->vy = partpl->vy * loss_factor + ( ptype->advection * air->vy + ptype->gravity ) * sdt;
+	if( x == nx && y == ny )
+	{
+		STEP_STAT_ADD( ctx, stagnant, parti->stagnant );
+		return STEP_DONE;
+	}
 
-		if(ptype->diffusion > 0.0f)
+	tempp = spParticleMap + ny * sConfiguration.xres + nx;
+	savestagnant = parti->stagnant;
+	savefreefall = parti->freefall;
+	parti->stagnant = 0;
+	parti->freefall = 1;
+	ctx->defer = 0;
+	if( tempp->type )
+	{
+		parti->freefall = 0;
+		savex = partp->x;
+		savey = partp->y;
+		partp->x = partpl->x;
+		partp->y = partpl->y;
+		assert( !incollision( partp ) );
+		if( ptype->move_type == MT_NORMAL )
 		{
-			partp->vx += ptype->diffusion * ( frand( ) * 2.0f - 1.0f ) * sdt;
-			partp->vy += ptype->diffusion * ( frand( ) * 2.0f - 1.0f ) * sdt;
+			parti->stagnant = 1;
 		}
-
-		//
-		// handle position
-		//
-
-		// trace against collisions
-		dx = partp->vx * sdt;
-		dy = partp->vy * sdt;
-        absdx = fabsf( dx );
-        absdy = fabsf( dy );
-		maxv = absdx > absdy ? absdx : absdy;
-		k = fast_ftol( maxv + 1 );
-		dx /= k;
-		dy /= k;
-		for( j = 0; j < k; j++ )
+		else
 		{
-			partp->x += dx;
-			partp->y += dy;
-			nx = fast_ftol( partp->x );
-			ny = fast_ftol( partp->y );
-			if( nx < 1 || nx >= sConfiguration.xres - 1 || 
-				ny < 1 || ny >= sConfiguration.yres - 1 )
-				break;
+			assert( ptype->move_type == MT_POWDER || ptype->move_type == MT_LIQUID );
 
-            tempp = spParticleMap + ny * sConfiguration.xres + nx;
-			if( tempp->collision )
-				break;
-		}
-
-		if( nx < 1 || nx >= sConfiguration.xres - 1 || 
-			ny < 1 || ny >= sConfiguration.yres - 1 )
-        {
-			kill_part( parti, x, y, i );
-			continue;
-        }
-
-		if( x == nx && y == ny )
-		{
-			processed_count++;
-			continue;
-		}
-
-		savestagnant = parti->stagnant;
-		parti->stagnant = 0;
-		parti->freefall = 1;
-		if( tempp->type )
-		{
-			parti->freefall = 0;
-			savex = partp->x;
-			savey = partp->y;
-			partp->x = partpl->x;
-			partp->y = partpl->y;
-			assert( !incollision( partp ) );
-			if( ptype->move_type == MT_NORMAL )
+			if( nx != x && try_move( ctx, i, x, y, nx, y ) )
 			{
-				parti->stagnant = 1;
+				partp->x = savex;
+				assert( !incollision( partp ) );
+			}
+			else if( ny != y && try_move( ctx, i, x, y, x, ny ) )
+			{
+				partp->y = savey;
+				assert( !incollision( partp ) );
 			}
 			else
 			{
-				assert( ptype->move_type == MT_POWDER || ptype->move_type == MT_LIQUID );
-
-				if( nx != x && try_move( i, x, y, nx, y ) )
+				r = ( step_rand( ctx ) & 1 ) * 2 - 1;
+				if( ny != y && try_move( ctx, i, x, y, x + r, ny ) )
 				{
-					partp->x = savex;
+					partp->x = ( float )( x + r ) + 0.5f;
+					partp->y = savey;
 					assert( !incollision( partp ) );
 				}
-				else if( ny != y && try_move( i, x, y, x, ny ) )
+				else if( ny != y && try_move( ctx, i, x, y, x - r, ny ) )
 				{
+					partp->x = ( float )( x - r ) + 0.5f;
 					partp->y = savey;
 					assert( !incollision( partp ) );
 				}
-				else
+				else if( nx != x && try_move( ctx, i, x, y, nx, y + r ) )
 				{
-					r = ( rand() & 1 ) * 2 - 1;
-					if( ny != y && try_move( i, x, y, x + r, ny ) )
-					{
-						partp->x = ( float )( x + r ) + 0.5f;
-						partp->y = savey;
-						assert( !incollision( partp ) );
-					}
-					else if( ny != y && try_move( i, x, y, x - r, ny ) )
-					{
-						partp->x = ( float )( x - r ) + 0.5f;
-						partp->y = savey;
-						assert( !incollision( partp ) );
-					}
-					else if( nx != x && try_move( i, x, y, nx, y + r ) )
-					{
-						partp->x = savex;
-						partp->y = ( float )( y + r ) + 0.5f;
-						assert( !incollision( partp ) );
-					}
-					else if( nx != x && try_move( i, x, y, nx, y - r ) )
+					partp->x = savex;
+					partp->y = ( float )( y + r ) + 0.5f;
+					assert( !incollision( partp ) );
+				}
+				else if( nx != x && try_move( ctx, i, x, y, nx, y - r ) )
+				{
+					partp->x = savex;
+					partp->y = ( float )( y - r ) + 0.5f;
+					assert( !incollision( partp ) );
+				}
+				else if( ptype->move_type == MT_LIQUID && partp->vy > fabs( partp->vx ) )
+				{
+					k = savestagnant ? 10 : 50;
+
+					// rows y and ny are inside of the window, trace has checked them
+					assert( ny >= ctx->row_min && ny < ctx->row_max );
+					found = spread_liquid( ctx, x, y, ny, r, k, parti->type, &j );
+					if( found )
 					{
-						partp->x = savex;
-						partp->y = ( float )( y - r ) + 0.5f;
+						partp->x = ( float )( j ) + 0.5f;
+						x = j;
+						if( found == 1 )
+						{
+							partp->y = ( float )( ny ) + 0.5f;
+							y = ny;
+						}
 						assert( !incollision( partp ) );
 					}
-					else if( ptype->move_type == MT_LIQUID && partp->vy > fabs( partp->vx ) )
+					if( found )
 					{
-						found = 0;
-						k = savestagnant ? 10 : 50;
+						r = partp->vy > 0 ? 1 : -1;
                         tempp = spParticleMap + y * sConfiguration.xres + x;
-						for( j = x + r; j >= x - k && j < x + k; j += r )
+						for( j = y + r; j >= y - k && j < y + k; j += r )
 						{
-                            tempp += r;
-							if( tempp->type && tempp->type != parti->type )
+							if( j < ctx->row_min || j >= ctx->row_max )
+							{
+								ctx->defer = 1;
 								break;
+							}
 
-							if( try_move( i, x, y, j, ny ) )
+                            STEP_STAT( ctx, liquid_search );
+                            tempp += r * sConfiguration.xres;
+							if( tempp->type && tempp->type != parti->type )
 							{
-								partp->x = ( float )( j ) + 0.5f;
-								partp->y = ( float )( ny ) + 0.5f;
-								x = j;
-								y = ny;
-								found = 1;
-								assert( !incollision( partp ) );
+								found = 0;
 								break;
 							}
-							if( try_move( i, x, y, j, y ) )
+							if( try_move( ctx, i, x, y, x, j ) )
 							{
-								partp->x = ( float )( j ) + 0.5f;
-								x = j;
-								found = 1;
+								partp->y = ( float )( j ) + 0.5f;
 								assert( !incollision( partp ) );
 								break;
 							}
 						}
-						if( found )
-						{
-    						r = partp->vy > 0 ? 1 : -1;
-                            tempp = spParticleMap + y * sConfiguration.xres + x;
-							for( j = y + r; j >= y - k && j < y + k; j += r )
-							{
-                                tempp += r * sConfiguration.xres;
-    							if( tempp->type && tempp->type != parti->type )
-								{
-									found = 0;
-									break;
-								}
-								if( try_move( i, x, y, x, j ) )
-								{
-									partp->y = ( float )( j ) + 0.5f;
-									assert( !incollision( partp ) );
-									break;
-								}
-							}
-						}
-
-						if( !found )
-							parti->stagnant = 1;
 					}
-					else
-					{
+
+					if( !found )
 						parti->stagnant = 1;
-					}
+				}
+				else
+				{
+					parti->stagnant = 1;
 				}
 			}
-			partp->vx *= ptype->collision;
-			partp->vy *= ptype->collision;
 		}
 
-		x = fast_ftol( partpl->x );
-		y = fast_ftol( partpl->y );
-		nx = fast_ftol( partp->x );
-		ny = fast_ftol( partp->y );
+		if( ctx->defer )
+		{
+			// restore everything touched by this stage, particle will be processed again later
+			parti->stagnant = savestagnant;
+			parti->freefall = savefreefall;
+			partp->x = partpl->x;
+			partp->y = partpl->y;
+			return STEP_DEFERRED;
+		}
 
-        if( x == nx && y == ny )
-        {
-    		spParticleMap[ y * sConfiguration.xres + x ].stagnant = parti->stagnant;
-    		processed_count++;
-            continue;
-        }
+		partp->vx *= ptype->collision;
+		partp->vy *= ptype->collision;
+	}
+
+	x = fast_ftol( partpl->x );
+	y = fast_ftol( partpl->y );
+	nx = fast_ftol( partp->x );
+	ny = fast_ftol( partp->y );
+
+    if( x == nx && y == ny )
+    {
+		spParticleMap[ y * sConfiguration.xres + x ].stagnant = parti->stagnant;
+		planes_cpu_st_set_stagnant( x, y, parti->stagnant );
+		STEP_STAT_ADD( ctx, stagnant, parti->stagnant );
+		return STEP_DONE;
+    }
+
+    if( nx < 1 || ny < 1 ||
+		nx >= sConfiguration.xres - 1 ||
+		ny >= sConfiguration.yres - 1 )
+	{
+		step_kill( ctx, parti, x, y, i );
+		return STEP_KILLED;
+	}
 
-        if( nx < 1 || ny < 1 ||
-			nx >= sConfiguration.xres - 1 ||
-			ny >= sConfiguration.yres - 1 )
+	assert( !incollision( partp ) );
+    assert( spParticleMap[ ny * sConfiguration.xres + nx ].type == 0 );
+    assert( ( int ) spParticleMap[ y * sConfiguration.xres + x ].index == i );
+
+	spParticleMap[ y * sConfiguration.xres + x ].type = 0;
+	spParticleMap[ ny * sConfiguration.xres + nx ].type = parti->type;
+	spParticleMap[ ny * sConfiguration.xres + nx ].index = i;
+	spParticleMap[ ny * sConfiguration.xres + nx ].stagnant = parti->stagnant;
+	planes_cpu_st_remove( x, y, parti->type );
+	planes_cpu_st_place( nx, ny, parti->type, 0, parti->stagnant );
+	heat_cpu_st_move( y * sConfiguration.xres + x, ny * sConfiguration.xres + nx );
+	step_change( ctx, i, x, y, nx, ny );
+	STEP_STAT_ADD( ctx, stagnant, parti->stagnant );
+
+	return STEP_DONE;
+}
+
+// Finish step of sliced update after its particles.
+static int finish_slice( pp_time_t dt )
+{
+	double t = stats_begin( );
+	double trace = TRACE_BEGIN( );
+
+	chunks_cpu_st_end_frame( dt );
+	compact_cpu_st_auto( sSliceSpan );
+	stats_lap( &sStatsNext.finish_ms, t );
+	TRACE_END( "finish", 0, -1, trace );
+
+	sSliceStage = SLICE_IDLE;
+	return 1;
+}
+
+int solver_cpu_st_update_slice( pp_time_t dt, double deadline )
+{
+	struct PPStepContext * ctx = &sSliceCtx;
+	unsigned char * touch;
+	int i, n, index, res;
+	double t, trace;
+#ifdef _DEBUG
+	int x, y;
+	struct PPParticlePhysInfo * partp;
+#endif
+
+	if( sSliceStage == SLICE_FINISH )
+		return finish_slice( dt );
+
+	touch = chunks_cpu_st_get_touch( 0 );
+
+	if( sSliceStage == SLICE_IDLE )
+	{
+		t = stats_begin( );
+		trace = TRACE_BEGIN( );
+		changes_cpu_st_begin( );
+		solver_cpu_st_update_air( dt );
+		t = stats_lap( &sStatsNext.air_ms, t );
+		TRACE_END( "air", 0, -1, trace );
+
+		trace = TRACE_BEGIN( );
+		solver_cpu_st_swap_streams( );
+		solver_cpu_st_prepare_types( dt );
+		distance_cpu_st_flush( );
+		heat_cpu_st_update( spWorkers, sAirThreads, dt );
+		stats_lap( &sStatsNext.heat_ms, t );
+		TRACE_END( "heat", 0, -1, trace );
+
+		ctx->dt = dt;
+		ctx->sdt = FLT_SECOND * dt;
+		ctx->row_min = 0;
+		ctx->row_max = sConfiguration.yres;
+		solver_cpu_st_begin_frame( ctx );
+		ctx->killed = NULL;
+		ctx->killed_count = 0;
+		ctx->defer = 0;
+		ctx->changes = NULL;
+		ctx->changes_count = 0;
+		memset( &ctx->stats, 0, sizeof( ctx->stats ) );
+		ctx->max_move = 0.0f;
+
+		// only particles of awake chunks are updated
+		if( touch )
 		{
-			kill_part( parti, x, y, i );
-			continue;
+			sSliceCount = chunks_cpu_st_collect( 0, sConfiguration.yres, spUpdateList, &sSliceSpan );
+			sSliceSpan++;
 		}
+		else
+			sSliceSpan = 0;
 
-		assert( !incollision( partp ) );
-        assert( spParticleMap[ ny * sConfiguration.xres + nx ].type == 0 );
-        assert( ( int ) spParticleMap[ y * sConfiguration.xres + x ].index == i );
+		sSliceIndex = 0;
+		sSliceStage = SLICE_PARTICLES;
+		if( deadline > 0.0 && timer_ms( ) >= deadline )
+			return 0;
+	}
 
-		spParticleMap[ y * sConfiguration.xres + x ].type = 0;
-		spParticleMap[ ny * sConfiguration.xres + nx ].type = parti->type;
-		spParticleMap[ ny * sConfiguration.xres + nx ].index = i;
-		spParticleMap[ ny * sConfiguration.xres + nx ].stagnant = parti->stagnant;
+	t = stats_begin( );
+	trace = TRACE_BEGIN( );
+	i = sSliceIndex;
 
-    	processed_count++;
-    }
+	if( touch )
+	{
+		while( i < sSliceCount )
+		{
+			for( n = 0; n < SLICE_BLOCK && i < sSliceCount; n++, i++ )
+			{
+				res = solver_cpu_st_update_particle_state( ctx, spUpdateList[ i ] );
+				if( res == STEP_CONTINUE )
+					res = solver_cpu_st_update_particle_position( ctx, spUpdateList[ i ] );
+
+				assert( res != STEP_DEFERRED );
+				chunks_cpu_st_track( touch, spUpdateList[ i ], res, ctx->sdt );
+			}
+
+			if( i < sSliceCount && deadline > 0.0 && timer_ms( ) >= deadline )
+				break;
+		}
+	}
+	else
+	{
+		// particle killed by its update is replaced with the last alive one, which is updated next
+		while( i < sParticleAliveCount )
+		{
+			for( n = 0; n < SLICE_BLOCK && i < sParticleAliveCount; n++ )
+			{
+				index = spAliveList[ i ];
+				if( index >= sSliceSpan )
+					sSliceSpan = index + 1;
+
+				res = solver_cpu_st_update_particle_state( ctx, index );
+				if( res == STEP_CONTINUE )
+					res = solver_cpu_st_update_particle_position( ctx, index );
+
+				assert( res != STEP_DEFERRED );
+				if( res != STEP_KILLED )
+					i++;
+			}
+
+			if( i < sParticleAliveCount && deadline > 0.0 && timer_ms( ) >= deadline )
+				break;
+		}
+	}
+
+	sSliceIndex = i;
+	if( i < ( touch ? sSliceCount : sParticleAliveCount ) )
+	{
+		stats_lap( &sStatsNext.particles_ms, t );
+		TRACE_END( "particles", 0, -1, trace );
+		return 0;
+	}
+
+	sMaxSpeed = dt > 0 ? ctx->max_move / ctx->sdt : 0.0f;
+	stats_add_step( &ctx->stats );
+	stats_lap( &sStatsNext.particles_ms, t );
+	TRACE_END( "particles", 0, -1, trace );
 
 #ifdef _DEBUG
     // check consistency
-    processed_count = 0;
-	parti = spParticlesInfo;
-	partpl = spParticlesPhysInfoLast;
-	partp = spParticlesPhysInfo;
-
-	for( i = 0; i < npart && processed_count < sParticleAliveCount; i++, parti++, partp++, partpl++ )
+	for( i = 0; i < sParticleAliveCount; i++ )
 	{
-		if( !parti->type )
-			continue;
+		index = spAliveList[ i ];
+		partp = spParticlesPhysInfo + index;
+		assert( spParticlesInfo[ index ].type && spAlivePositions[ index ] == i );
 
 		x = fast_ftol( partp->x );
 		y = fast_ftol( partp->y );
 
-        assert( ( int ) spParticleMap[ y * sConfiguration.xres + x ].index == i );
-
-        processed_count++;
+        assert( ( int ) spParticleMap[ y * sConfiguration.xres + x ].index == index );
     }
+	assert( planes_cpu_st_check( ) );
+	assert( distance_cpu_st_check( ) );
 #endif
+
+	sSliceStage = SLICE_FINISH;
+	if( deadline > 0.0 && timer_ms( ) >= deadline )
+		return 0;
+
+	return finish_slice( dt );
 }
 
-void solver_cpu_st_spawn_at( int x, int y, unsigned int type )
+void solver_cpu_st_update( pp_time_t dt )
+{
+	solver_cpu_st_update_slice( dt, 0.0 );
+}
+
+void solver_cpu_st_end_frame( )
+{
+	changes_cpu_st_end_frame( );
+}
+
+float solver_cpu_st_get_max_speed( )
+{
+	float air = air_cpu_st_get_max_velocity( );
+
+	return air > sMaxSpeed ? air : sMaxSpeed;
+}
+
+// Spawn particle into empty cell, there must be a dead particle.
+static void spawn_cell( struct PPParticleMap * pmap, int x, int y, unsigned int type )
 {
-	struct PPParticleMap * pmap = spParticleMap + y * sConfiguration.xres + x;
 	struct PPParticleInfo * parti;
 	struct PPParticlePhysInfo * partp, * partpl;
 	int index;
 
-	if( pmap->type )
-		return;
-
-	if( sParticleFirstFree < 0 )
-		return;
+	assert( !pmap->type && sParticleFirstFree >= 0 );
 
 	index = sParticleFirstFree;
 	parti = spParticlesInfo + index;
@@ -716,7 +1254,87 @@ void solver_cpu_st_spawn_at( int x, int y, unsigned int type )
 	pmap->collision = 0;
     pmap->stagnant = 0;
 
+	spAliveList[ sParticleAliveCount ] = index;
+	spAlivePositions[ index ] = sParticleAliveCount;
 	sParticleAliveCount++;
+	STATS_COUNT( spawned );
+	planes_cpu_st_place( x, y, type, 0, 0 );
+	if( spChanges )
+		changes_cpu_st_add( index, -1, -1, x, y );
+	heat_cpu_st_set( y * sConfiguration.xres + x, partp->temp, spParticleTypes[ type ].hconduct );
+}
+
+void solver_cpu_st_spawn_at( int x, int y, unsigned int type )
+{
+	struct PPParticleMap * pmap = spParticleMap + y * sConfiguration.xres + x;
+
+	if( pmap->type )
+		return;
+
+	if( sParticleFirstFree < 0 )
+		return;
+
+	changes_cpu_st_begin( );
+	spawn_cell( pmap, x, y, type );
+	chunks_cpu_st_wake( x, y );
+}
+
+int solver_cpu_st_spawn_rect( int x, int y, int width, int height, unsigned int type, const unsigned char * types, int stride )
+{
+	struct PPParticleMap * pmap;
+	int types_count = pp_get_particle_types_count( );
+	int i, j, spawned = 0;
+
+	changes_cpu_st_begin( );
+	for( j = 0; j < height && sParticleFirstFree >= 0; j++ )
+	{
+		pmap = spParticleMap + ( y + j ) * sConfiguration.xres + x;
+		for( i = 0; i < width && sParticleFirstFree >= 0; i++, pmap++ )
+		{
+			if( types )
+			{
+				type = types[ j * stride + i ];
+				if( !type || ( int ) type >= types_count )
+					continue;
+			}
+			if( pmap->type )
+				continue;
+
+			spawn_cell( pmap, x + i, y + j, type );
+			spawned++;
+		}
+	}
+
+	if( spawned )
+		chunks_cpu_st_wake_rect( x, y, x + width, y + height );
+
+	return spawned;
+}
+
+int solver_cpu_st_spawn_records( const struct PPSpawnRecord * records, int count )
+{
+	struct PPParticleMap * pmap;
+	int types_count = pp_get_particle_types_count( );
+	int i, spawned = 0;
+
+	changes_cpu_st_begin( );
+	for( i = 0; i < count && sParticleFirstFree >= 0; i++, records++ )
+	{
+		if( records->x < 1 || records->x >= sConfiguration.xres - 1 ||
+			records->y < 1 || records->y >= sConfiguration.yres - 1 ||
+			!records->type || ( int ) records->type >= types_count )
+			continue;
+
+		pmap = spParticleMap + records->y * sConfiguration.xres + records->x;
+		if( pmap->type )
+			continue;
+
+		spawn_cell( pmap, records->x, records->y, records->type );
+		chunks_cpu_st_wake( records->x, records->y );
+		spawned++;
+	}
+
+	return spawned;
 }
 
 int solver_cpu_st_get_alive_particles_count( )
@@ -724,6 +1342,11 @@ int solver_cpu_st_get_alive_particles_count( )
 	return sParticleAliveCount;
 }
 
+const int * solver_cpu_st_get_alive_particles( )
+{
+	return spAliveList;
+}
+
 const struct PPParticleInfo * solver_cpu_st_get_particles_info_stream( )
 {
 	return spParticlesInfo;
@@ -731,78 +1354,417 @@ const struct PPParticleInfo * solver_cpu_st_get_particles_info_stream( )
 
 const struct PPParticlePhysInfo * solver_cpu_st_get_particles_phys_info_stream( )
 {
+	heat_cpu_st_sync( );
 	return spParticlesPhysInfo;
 }
 
 const struct PPParticlePhysInfo * solver_cpu_st_get_particles_phys_info_stream_last( )
 {
+	heat_cpu_st_sync( );
 	return spParticlesPhysInfoLast;
 }
 
+// Air is stored as structure of arrays, so public streams are views packed on request.
+// Changes made by the caller to the current view are taken on the next air access.
 struct PPAirParticle * solver_cpu_st_get_air_particle_stream( )
 {
+	air_sync_view( );
+	air_pack_view( spAir, spAirVx, spAirVy, spAirP );
+	sAirViewDirty = 1;
 	return spAir;
 }
 
 const struct PPAirParticle * solver_cpu_st_get_air_particle_stream_last( )
 {
+	air_pack_view( spAirLast, spAirVxLast, spAirVyLast, spAirPLast );
 	return spAirLast;
 }
 
+void solver_cpu_st_pack_air( struct PPAirParticle * air )
+{
+	air_sync_view( );
+	air_pack_view( air, spAirVx, spAirVy, spAirP );
+}
+
+// Count collision pixel change of air cell.
+static void air_solid_add( int x, int y, int delta )
+{
+	spAirSolid[ ( y / sConfiguration.grid_size ) * sGridX + x / sConfiguration.grid_size ] += delta;
+}
+
+// Make air cell solid, when all its pixels are collisions, and open otherwise.
+static void air_solid_update( int gridx, int gridy )
+{
+	int a = gridy * sGridX + gridx;
+
+	if( spAirSolid[ a ] == sConfiguration.grid_size * sConfiguration.grid_size )
+	{
+		spAirType[ a ] = spParticleMap[ gridy * sConfiguration.grid_size * sConfiguration.xres + gridx * sConfiguration.grid_size ].type;
+		spAirOpen[ AIR_INDEX( gridx, gridy ) ] = 0.0f;
+	}
+	else
+	{
+		spAirType[ a ] = 0;
+		spAirOpen[ AIR_INDEX( gridx, gridy ) ] = 1.0f;
+	}
+}
+
+// Put collision into empty cell. Air cell and distance field are updated by caller.
+static void collision_add( struct PPParticleMap * pmap, int x, int y, unsigned int collision_type )
+{
+	assert( !pmap->type );
+	assert( spParticleTypes[ collision_type ].move_type == MT_IMMOVABLE );
+
+	pmap->index = 0;
+	pmap->type = collision_type;
+	pmap->collision = 1;
+	pmap->stagnant = 1;
+	planes_cpu_st_place( x, y, collision_type, 1, 1 );
+	heat_cpu_st_set( y * sConfiguration.xres + x, spParticleTypes[ collision_type ].initial_temp, 0.0f );
+	air_solid_add( x, y, 1 );
+	if( spChanges )
+		changes_cpu_st_cell( x, y );
+}
+
+// Remove collision from cell. Air cell and distance field are updated by caller.
+static void collision_remove( struct PPParticleMap * pmap, int x, int y )
+{
+	assert( pmap->collision );
+
+	planes_cpu_st_remove( x, y, pmap->type );
+	pmap->type = 0;
+	pmap->collision = 0;
+	heat_cpu_st_clear( y * sConfiguration.xres + x );
+	air_solid_add( x, y, -1 );
+	if( spChanges )
+		changes_cpu_st_cell( x, y );
+}
+
 void solver_cpu_st_collision_set( int x, int y, unsigned int collision_type )
 {
+	struct PPParticleMap * pmap;
 	int gridx;
 	int gridy;
-	int i, j;
-	int cnt;
 
 	if( x < 0 || x >= sConfiguration.xres || y < 0 || y >= sConfiguration.yres )
 		return;
 
+	pmap = spParticleMap + y * sConfiguration.xres + x;
 	gridx = x / sConfiguration.grid_size;
 	gridy = y / sConfiguration.grid_size;
+	chunks_cpu_st_wake( x, y );
+	changes_cpu_st_begin( );
 
 	if( collision_type )
 	{
-		if( spParticleMap[ y * sConfiguration.xres + x ].type )
+		if( pmap->type )
 			return;
 
-		assert( spParticleTypes[ collision_type ].move_type == MT_IMMOVABLE );
-
-		spParticleMap[ y * sConfiguration.xres + x ].index = 0;
-		spParticleMap[ y * sConfiguration.xres + x ].type = collision_type;
-		spParticleMap[ y * sConfiguration.xres + x ].collision = 1;
-        spParticleMap[ y * sConfiguration.xres + x ].stagnant = 1;
-
-		cnt = 0;
-		for( j = gridy * sConfiguration.grid_size; j < ( gridy + 1 ) * sConfiguration.grid_size; j++ )
-			for( i = gridx * sConfiguration.grid_size; i < ( gridx + 1 ) * sConfiguration.grid_size; i++ )
-				if( spParticleMap[ j * sConfiguration.xres + i ].type == collision_type )
-					cnt++;
-
-		if( cnt == sConfiguration.grid_size * sConfiguration.grid_size )
-			spAir[ gridy * sGridX + gridx ].type = collision_type;
+		collision_add( pmap, x, y, collision_type );
+		distance_cpu_st_touch( x, y, x + 1, y + 1 );
 	}
 	else
 	{
-		if( spAir[ gridy * sGridX + gridx ].type )
+		if( !pmap->type )
+			return;
+
+		if( !pmap->collision )
 		{
-			spParticleMap[ y * sConfiguration.xres + x ].type = 0;
-			spParticleMap[ y * sConfiguration.xres + x ].collision = 0;
-			spAir[ gridy * sGridX + gridx ].type = 0;
+			if( spChanges )
+				changes_cpu_st_add( pmap->index, x, y, -1, -1 );
+			kill_part( spParticlesInfo + pmap->index, x, y, pmap->index );
+			return;
 		}
-		else
+
+		collision_remove( pmap, x, y );
+		distance_cpu_st_touch( x, y, x + 1, y + 1 );
+	}
+
+	air_solid_update( gridx, gridy );
+}
+
+int solver_cpu_st_collision_import( int x, int y, int width, int height, const unsigned char * types, int stride )
+{
+	struct PPParticleMap * pmap;
+	unsigned int type;
+	int types_count = pp_get_particle_types_count( );
+	int i, j, changed = 0;
+	int gx0, gy0, gx1, gy1;
+
+	changes_cpu_st_begin( );
+	for( j = 0; j < height; j++ )
+	{
+		pmap = spParticleMap + ( y + j ) * sConfiguration.xres + x;
+		for( i = 0; i < width; i++, pmap++ )
 		{
-			if( spParticleMap[ y * sConfiguration.xres + x ].type )
-				if( spParticleMap[ y * sConfiguration.xres + x ].collision )
-				{
-					spParticleMap[ y * sConfiguration.xres + x ].type = 0;
-					spParticleMap[ y * sConfiguration.xres + x ].collision = 0;
-				}
-				else
-				{
-					kill_part( spParticlesInfo + spParticleMap[ y * sConfiguration.xres + x ].index, x, y, spParticleMap[ y * sConfiguration.xres + x ].index );
-				}
+			type = types[ j * stride + i ];
+			if( ( int ) type >= types_count || ( type && spParticleTypes[ type ].move_type != MT_IMMOVABLE ) )
+				continue;
+			if( pmap->collision && pmap->type != type )
+			{
+				collision_remove( pmap, x + i, y + j );
+				changed++;
+			}
+			if( type && !pmap->type )
+			{
+				collision_add( pmap, x + i, y + j, type );
+				changed++;
+			}
 		}
 	}
-}
\ No newline at end of file
+
+	if( !changed )
+		return 0;
+
+	gx0 = x / sConfiguration.grid_size;
+	gy0 = y / sConfiguration.grid_size;
+	gx1 = ( x + width - 1 ) / sConfiguration.grid_size;
+	gy1 = ( y + height - 1 ) / sConfiguration.grid_size;
+	for( j = gy0; j <= gy1; j++ )
+		for( i = gx0; i <= gx1; i++ )
+			air_solid_update( i, j );
+
+	distance_cpu_st_touch( x, y, x + width, y + height );
+	chunks_cpu_st_wake_rect( x, y, x + width, y + height );
+	return changed;
+}
+
+static int add_section( struct PPStateSection * sections, int count, int max_count,
+	int id, const char * name, void * data, int size, int stride, int width, int border )
+{
+	if( count >= max_count )
+		return count;
+
+	sections[ count ].id = id;
+	sections[ count ].name = name;
+	sections[ count ].data = data;
+	sections[ count ].size = size;
+	sections[ count ].stride = stride;
+	sections[ count ].width = width;
+	sections[ count ].border = border;
+	return count + 1;
+}
+
+int solver_cpu_st_get_state_sections( struct PPStateSection * sections, int max_count )
+{
+	struct PPChunk * chunks;
+	int chunks_count, chunks_width;
+	int num_parts = sConfiguration.xres * sConfiguration.yres;
+	int num_air = sAirStride * ( sGridY + 2 ) * sizeof( float );
+	int count = 0;
+
+	air_sync_view( );
+
+	count = add_section( sections, count, max_count, SECTION_FIRST_FREE, "first_free",
+		&sParticleFirstFree, sizeof( int ), sizeof( int ), 0, 0 );
+	count = add_section( sections, count, max_count, SECTION_ALIVE_COUNT, "alive_count",
+		&sParticleAliveCount, sizeof( int ), sizeof( int ), 0, 0 );
+	count = add_section( sections, count, max_count, SECTION_ALIVE_LIST, "alive_list",
+		spAliveList, sizeof( int ) * num_parts, sizeof( int ), 0, 0 );
+	count = add_section( sections, count, max_count, SECTION_PARTICLES_INFO, "particles_info",
+		spParticlesInfo, sizeof( struct PPParticleInfo ) * num_parts, sizeof( struct PPParticleInfo ), 0, 0 );
+	count = add_section( sections, count, max_count, SECTION_PARTICLES_PHYS, "particles_phys",
+		spParticlesPhysInfo, sizeof( struct PPParticlePhysInfo ) * num_parts, sizeof( struct PPParticlePhysInfo ), 0, 0 );
+	count = add_section( sections, count, max_count, SECTION_PARTICLES_PHYS_LAST, "particles_phys_last",
+		spParticlesPhysInfoLast, sizeof( struct PPParticlePhysInfo ) * num_parts, sizeof( struct PPParticlePhysInfo ), 0, 0 );
+	count = add_section( sections, count, max_count, SECTION_PARTICLE_MAP, "particle_map",
+		spParticleMap, sizeof( struct PPParticleMap ) * num_parts, sizeof( struct PPParticleMap ), sConfiguration.xres, 0 );
+	count = add_section( sections, count, max_count, SECTION_AIR_TYPE, "air_type",
+		spAirType, sGridX * sGridY, 1, sGridX, 0 );
+	count = add_section( sections, count, max_count, SECTION_AIR_VX, "air_vx",
+		spAirVx, num_air, sizeof( float ), sAirStride, 1 );
+	count = add_section( sections, count, max_count, SECTION_AIR_VY, "air_vy",
+		spAirVy, num_air, sizeof( float ), sAirStride, 1 );
+	count = add_section( sections, count, max_count, SECTION_AIR_P, "air_p",
+		spAirP, num_air, sizeof( float ), sAirStride, 1 );
+	count = add_section( sections, count, max_count, SECTION_AIR_VX_LAST, "air_vx_last",
+		spAirVxLast, num_air, sizeof( float ), sAirStride, 1 );
+	count = add_section( sections, count, max_count, SECTION_AIR_VY_LAST, "air_vy_last",
+		spAirVyLast, num_air, sizeof( float ), sAirStride, 1 );
+	count = add_section( sections, count, max_count, SECTION_AIR_P_LAST, "air_p_last",
+		spAirPLast, num_air, sizeof( float ), sAirStride, 1 );
+	count = add_section( sections, count, max_count, SECTION_COMPACT_BASELINE, "compact_baseline",
+		&sCompactBaseline, sizeof( float ), sizeof( float ), 0, 0 );
+	count = add_section( sections, count, max_count, SECTION_FRAME, "frame",
+		&sFrame, sizeof( unsigned int ), sizeof( unsigned int ), 0, 0 );
+	count = add_section( sections, count, max_count, SECTION_MAX_SPEED, "max_speed",
+		&sMaxSpeed, sizeof( float ), sizeof( float ), 0, 0 );
+
+	chunks = chunks_cpu_st_get_chunks( &chunks_count, &chunks_width );
+	if( chunks_count )
+		count = add_section( sections, count, max_count, SECTION_CHUNKS, "chunks",
+			chunks, sizeof( struct PPChunk ) * chunks_count, sizeof( struct PPChunk ), chunks_width, 0 );
+
+	if( heat_cpu_st_enabled( ) )
+	{
+		count = add_section( sections, count, max_count, SECTION_HEAT, "heat",
+			spHeat, sizeof( float ) * num_parts, sizeof( float ), sConfiguration.xres, 0 );
+		count = add_section( sections, count, max_count, SECTION_HEAT_LAST, "heat_last",
+			spHeatLast, sizeof( float ) * num_parts, sizeof( float ), sConfiguration.xres, 0 );
+	}
+
+	return count;
+}
+
+// Structures kept up to date by update and edits. Distance field, open and solid air cells depend on collisions only,
+// which update doesn't change, so they aren't listed.
+int solver_cpu_st_get_derived_sections( struct PPStateSection * sections, int max_count )
+{
+	int num_parts = sConfiguration.xres * sConfiguration.yres;
+	int planes = sizeof( unsigned int ) * sPlaneSize * ( 3 + pp_get_particle_types_count( ) );
+	int count = 0;
+
+	count = add_section( sections, count, max_count, DERIVED_ALIVE_POSITIONS, "alive_positions",
+		spAlivePositions, sizeof( int ) * num_parts, sizeof( int ), 0, 0 );
+	count = add_section( sections, count, max_count, DERIVED_PLANES, "planes",
+		spPlanesMemory, planes, sizeof( unsigned int ), sPlaneStride, 0 );
+
+	if( heat_cpu_st_enabled( ) )
+	{
+		count = add_section( sections, count, max_count, DERIVED_HEAT_MASK, "heat_mask",
+			spHeatMask, sizeof( float ) * num_parts, sizeof( float ), sConfiguration.xres, 0 );
+		count = add_section( sections, count, max_count, DERIVED_HEAT_CONDUCT, "heat_conduct",
+			spHeatConduct, sizeof( float ) * num_parts, sizeof( float ), sConfiguration.xres, 0 );
+	}
+	count = add_section( sections, count, max_count, DERIVED_HEAT_SYNCED, "heat_synced",
+		&sHeatSynced, sizeof( int ), sizeof( int ), 0, 0 );
+
+	// records past the counters are overwritten by the next changes, cell marks are cleared by the next frame
+	if( changes_cpu_st_enabled( ) )
+	{
+		count = add_section( sections, count, max_count, DERIVED_CHANGES, "changes",
+			&sChanges, sizeof( struct PPChanges ), sizeof( struct PPChanges ), 0, 0 );
+		count = add_section( sections, count, max_count, DERIVED_CHANGES_COUNT, "changes_count",
+			&sChangesCount, sizeof( int ), sizeof( int ), 0, 0 );
+		count = add_section( sections, count, max_count, DERIVED_CHANGED_CELLS_COUNT, "changed_cells_count",
+			&sChangedCellsCount, sizeof( int ), sizeof( int ), 0, 0 );
+		count = add_section( sections, count, max_count, DERIVED_CHANGES_COLLECTED, "changes_collected",
+			&sChangesCollected, sizeof( int ), sizeof( int ), 0, 0 );
+		count = add_section( sections, count, max_count, DERIVED_CHANGES_FINISHED, "changes_finished",
+			&sChangesFinished, sizeof( int ), sizeof( int ), 0, 0 );
+	}
+
+	return count;
+}
+
+int solver_cpu_st_check_state( )
+{
+	const struct PPParticleMap * pmap;
+	const struct PPParticlePhysInfo * partp;
+	int num_parts = sConfiguration.xres * sConfiguration.yres;
+	int types = pp_get_particle_types_count( );
+	int i, x, y, count;
+
+	if( sParticleFirstFree < -1 || sParticleFirstFree >= num_parts ||
+		sParticleAliveCount < 0 || sParticleAliveCount > num_parts )
+		return 0;
+
+	// free list is followed by spawns, types index coefficient tables
+	for( i = 0, count = 0; i < num_parts; i++ )
+	{
+		if( spParticlesInfo[ i ].type >= types ||
+			( !spParticlesInfo[ i ].type && ( spParticlesInfo[ i ].life < -1 || spParticlesInfo[ i ].life >= num_parts ) ) )
+			return 0;
+		if( spParticlesInfo[ i ].type )
+			count++;
+	}
+	if( count != sParticleAliveCount )
+		return 0;
+
+	// free list links every dead particle once and ends, a loop or an alive particle would be spawned over
+	for( i = sParticleFirstFree, count = 0; i >= 0; i = spParticlesInfo[ i ].life, count++ )
+		if( count >= num_parts - sParticleAliveCount || spParticlesInfo[ i ].type )
+			return 0;
+	if( count != num_parts - sParticleAliveCount )
+		return 0;
+
+	for( i = 0, pmap = spParticleMap; i < num_parts; i++, pmap++ )
+		if( pmap->type >= types || ( pmap->type && !pmap->collision && ( int ) pmap->index >= num_parts ) )
+			return 0;
+
+	// alive particles must be listed once, be inside the world and found by the map at their positions,
+	// positions in alive list are rebuilt by state_loaded anyway
+	for( i = 0; i < num_parts; i++ )
+		spAlivePositions[ i ] = -1;
+
+	for( i = 0; i < sParticleAliveCount; i++ )
+	{
+		if( spAliveList[ i ] < 0 || spAliveList[ i ] >= num_parts || !spParticlesInfo[ spAliveList[ i ] ].type ||
+			spAlivePositions[ spAliveList[ i ] ] >= 0 )
+			return 0;
+		spAlivePositions[ spAliveList[ i ] ] = i;
+
+		partp = spParticlesPhysInfo + spAliveList[ i ];
+		if( !( partp->x >= 0.0f && partp->x < sConfiguration.xres && partp->y >= 0.0f && partp->y < sConfiguration.yres ) )
+			return 0;
+
+		x = fast_ftol( partp->x );
+		y = fast_ftol( partp->y );
+		pmap = spParticleMap + y * sConfiguration.xres + x;
+		if( pmap->collision || ( int ) pmap->index != spAliveList[ i ] )
+			return 0;
+	}
+
+	return 1;
+}
+
+void solver_cpu_st_state_loaded( )
+{
+	int i, x, y;
+
+	for( i = 0; i < sParticleAliveCount; i++ )
+		spAlivePositions[ spAliveList[ i ] ] = i;
+
+	for( y = 0; y < sGridY; y++ )
+		for( x = 0; x < sGridX; x++ )
+			spAirOpen[ AIR_INDEX( x, y ) ] = spAirType[ y * sGridX + x ] ? 0.0f : 1.0f;
+
+	memset( spAirSolid, 0, sizeof( int ) * sGridX * sGridY );
+	for( y = 0; y < sConfiguration.yres; y++ )
+		for( x = 0; x < sConfiguration.xres; x++ )
+			if( spParticleMap[ y * sConfiguration.xres + x ].collision )
+				air_solid_add( x, y, 1 );
+
+	sAirViewDirty = 0;
+	planes_cpu_st_rebuild( );
+	distance_cpu_st_rebuild( );
+	heat_cpu_st_state_loaded( );
+	changes_cpu_st_reloaded( );
+}
+
+
+
+const struct PPSolver sSolverCpuSt =
+{
+	"cpu_st",
+	solver_cpu_st_init,
+	solver_cpu_st_deinit,
+	NULL,
+	NULL,
+	solver_cpu_st_update,
+	solver_cpu_st_update_slice,
+	solver_cpu_st_end_frame,
+	solver_cpu_st_get_max_speed,
+	solver_cpu_st_get_alive_particles_count,
+	solver_cpu_st_get_alive_particles,
+	solver_cpu_st_get_particles_info_stream,
+	solver_cpu_st_get_particles_phys_info_stream,
+	solver_cpu_st_get_particles_phys_info_stream_last,
+	solver_cpu_st_get_air_particle_stream,
+	solver_cpu_st_get_air_particle_stream_last,
+	solver_cpu_st_pack_air,
+	solver_cpu_st_spawn_at,
+	solver_cpu_st_spawn_rect,
+	solver_cpu_st_spawn_records,
+	solver_cpu_st_collision_set,
+	solver_cpu_st_collision_import,
+	compact_cpu_st_run,
+	chunks_cpu_st_get_dirty_rect,
+	changes_cpu_st_get,
+	render_cpu_st_run,
+	positions_cpu_st_export,
+	solver_cpu_st_get_state_sections,
+	solver_cpu_st_check_state,
+	solver_cpu_st_state_loaded,
+	solver_cpu_st_get_derived_sections,
+};
\ No newline at end of file
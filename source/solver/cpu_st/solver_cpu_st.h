@@ -3,23 +3,105 @@
 
 
 #include "shared/types.h"
+#include "solver/stats.h"
 
 
 
+struct PPStateSection;
+
+
+
+
+//! Particle map entry.
+struct PPParticleMap
+{
+	unsigned int type : 8;		//!< Particle type. Used for caching.
+    unsigned int stagnant : 1;  //!< Cached value of particle stagnant state.
+	unsigned int index : 22;	//!< Index of particle in particles array.
+	unsigned int collision : 1;	//!< Is this particle collision particle?
+};
+
+
+
+//! Result of particle update stage.
+enum PPStepResult
+{
+	STEP_CONTINUE,		//!< Stage is complete, particle needs next stage.
+	STEP_DONE,			//!< Particle is completely updated.
+	STEP_KILLED,		//!< Particle was killed.
+	STEP_DEFERRED,		//!< Particle position can't be updated inside of context window, it's left untouched.
+};
+
+//! State of particles update shared by particles processed on the same thread.
+struct PPStepContext
+{
+	pp_time_t dt;			//!< Frame time.
+	float sdt;				//!< Frame time in seconds.
+	int row_min;			//!< First map row position update is allowed to touch.
+	int row_max;			//!< Map row after the last one position update is allowed to touch.
+	unsigned int rnd_counter[ 4 ];	//!< Counter of random generator: particle index, update stage, block of words.
+	unsigned int rnd_key[ 2 ];		//!< Key of random generator: seed and frame.
+	unsigned int rnd[ 4 ];			//!< Random words of the current block.
+	int rnd_left;					//!< Number of unused words in 'rnd'.
+	int * killed;			//!< If not NULL, indices of killed particles are stored here and free list is left untouched.
+	int killed_count;		//!< Number of elements in 'killed'.
+	int defer;				//!< Set when position update tried to leave the window.
+	struct PPParticleChange * changes;	//!< If not NULL, particle changes are stored here instead of change lists.
+	int changes_count;		//!< Number of elements in 'changes'.
+	struct PPStepStats stats;	//!< Counters of particle update, added to frame statistics after the pass.
+	float max_move;			//!< Longest move of particle along one axis in pixels.
+};
+
+//! Coefficients of particle type for the current frame time.
+struct PPTypeCoefs
+{
+	float airloss;		//!< Air velocity loss factor.
+	float vloss;		//!< Particle velocity loss factor.
+	float hotair[ 9 ];	//!< Pressure added to neighbour air cells.
+	int ( * update_state )( struct PPStepContext * ctx, int i );	//!< State update kernel specialized for type features.
+};
+
+
 
 int solver_cpu_st_init( );
 int solver_cpu_st_deinit( );
 void solver_cpu_st_update( pp_time_t dt );
+//! Run step until 'deadline' of timer_ms, 0 for no deadline. Returns 1 if the step is complete, otherwise the next call continues it.
+int solver_cpu_st_update_slice( pp_time_t dt, double deadline );
+void solver_cpu_st_end_frame( );
+float solver_cpu_st_get_max_speed( );
 
 int solver_cpu_st_get_alive_particles_count( );
+const int * solver_cpu_st_get_alive_particles( );
 const struct PPParticleInfo * solver_cpu_st_get_particles_info_stream( );
 const struct PPParticlePhysInfo * solver_cpu_st_get_particles_phys_info_stream( );
 const struct PPParticlePhysInfo * solver_cpu_st_get_particles_phys_info_stream_last( );
 struct PPAirParticle * solver_cpu_st_get_air_particle_stream( );
 const struct PPAirParticle * solver_cpu_st_get_air_particle_stream_last( );
+void solver_cpu_st_pack_air( struct PPAirParticle * air );
 
 void solver_cpu_st_spawn_at( int x, int y, unsigned int type );
+int solver_cpu_st_spawn_rect( int x, int y, int width, int height, unsigned int type, const unsigned char * types, int stride );
+int solver_cpu_st_spawn_records( const struct PPSpawnRecord * records, int count );
 void solver_cpu_st_collision_set( int x, int y, unsigned int collision_type );
+int solver_cpu_st_collision_import( int x, int y, int width, int height, const unsigned char * types, int stride );
+
+int solver_cpu_st_get_state_sections( struct PPStateSection * sections, int max_count );
+//! Check consistency of sections loaded from outside. Returns 0 if they could crash the solver.
+int solver_cpu_st_check_state( );
+void solver_cpu_st_state_loaded( );
+int solver_cpu_st_get_derived_sections( struct PPStateSection * sections, int max_count );
+
+void solver_cpu_st_update_air( pp_time_t dt );
+void solver_cpu_st_swap_streams( );
+//! Start frame: advance frame counter and set random generator key of context.
+void solver_cpu_st_begin_frame( struct PPStepContext * ctx );
+//! Compute coefficients of particle types for frame time.
+void solver_cpu_st_prepare_types( pp_time_t dt );
+int solver_cpu_st_update_particle_state( struct PPStepContext * ctx, int i );
+int solver_cpu_st_update_particle_position( struct PPStepContext * ctx, int i );
+//! Return particle, which is already marked dead, to free list and remove it from alive list.
+void free_part( unsigned int i );
 
 
 #endif // __POWDER_SOLVER_CPU_ST_H__
\ No newline at end of file
@@ -0,0 +1,187 @@
+// Particle state update kernel. It is included by solver_cpu_st.c once for every feature set,
+// so particle types don't pay for branches of features they don't have. Before including define:
+//   STATE_KERNEL     - name of kernel function,
+//   STATE_HCONDUCT   - 1 if type conducts heat,
+//   STATE_HOTAIR     - 1 if type heats air,
+//   STATE_DIFFUSION  - 1 if type has chaotic velocity.
+
+
+
+static int STATE_KERNEL( struct PPStepContext * ctx, int i )
+{
+	struct PPParticleInfo * parti = spParticlesInfo + i;
+	struct PPParticlePhysInfo * partp = spParticlesPhysInfo + i;
+	struct PPParticlePhysInfo * partpl = spParticlesPhysInfoLast + i;
+	struct PPParticleType * ptype = spParticleTypes + parti->type;
+	const struct PPTypeCoefs * coefs = spTypeCoefs + parti->type;
+#if STATE_HCONDUCT
+    struct PPParticleMap * tempp, * n, * ne, * e, * se, * s, * sw, * w, * nw;
+	float accum_heat;
+	int heat_count;
+#endif
+#if STATE_HOTAIR
+	int j, k;
+#endif
+	int x, y;
+	int gridx, gridy, a;
+	int wasblocked;
+	float sdt = ctx->sdt;
+
+	assert( parti->type );
+
+	x = fast_ftol( partpl->x );
+	y = fast_ftol( partpl->y );
+
+    assert( ( int ) spParticleMap[ y * sConfiguration.xres + x ].index == i );
+    assert( spParticleMap[ y * sConfiguration.xres + x ].stagnant == parti->stagnant );
+
+	if( parti->life >= 0 )
+	{
+		parti->life -= ctx->dt;
+		if( parti->life <= 0 )
+		{
+			step_kill( ctx, parti, x, y, i );
+			return STEP_KILLED;
+		}
+	}
+
+    assert( !( x < 1 || y < 1 || x >= sConfiguration.xres - 1 || y >= sConfiguration.yres - 1 ) );
+
+	//
+	// handle temperature
+	//
+
+#if STATE_HCONDUCT
+    tempp = spParticleMap + y * sConfiguration.xres + x;
+    n = tempp - sConfiguration.xres;
+    ne = n + 1;
+    e = tempp + 1;
+    se = e + sConfiguration.xres;
+    s = se - 1;
+    sw = s - 1;
+    w = tempp - 1;
+    nw = n - 1;
+
+	{
+		accum_heat = 0.0f;
+		heat_count = 0;
+
+        if( n->type )
+        {
+            accum_heat += ( spParticlesPhysInfoLast + n->index )->temp;
+            heat_count++;
+        }
+        if( ne->type )
+        {
+            accum_heat += ( spParticlesPhysInfoLast + ne->index )->temp;
+            heat_count++;
+        }
+        if( e->type )
+        {
+            accum_heat += ( spParticlesPhysInfoLast + e->index )->temp;
+            heat_count++;
+        }
+        if( se->type )
+        {
+            accum_heat += ( spParticlesPhysInfoLast + se->index )->temp;
+            heat_count++;
+        }
+        if( s->type )
+        {
+            accum_heat += ( spParticlesPhysInfoLast + s->index )->temp;
+            heat_count++;
+        }
+        if( sw->type )
+        {
+            accum_heat += ( spParticlesPhysInfoLast + sw->index )->temp;
+            heat_count++;
+        }
+        if( w->type )
+        {
+            accum_heat += ( spParticlesPhysInfoLast + w->index )->temp;
+            heat_count++;
+        }
+        if( nw->type )
+        {
+            accum_heat += ( spParticlesPhysInfoLast + nw->index )->temp;
+            heat_count++;
+        }
+
+		if( heat_count > 0 )
+			partp->temp = partpl->temp + ( accum_heat / heat_count - partpl->temp ) * ptype->hconduct * sdt;
+	}
+#endif
+
+	// blocked particle has eight stagnant neighbours
+    wasblocked = parti->blocked;
+    parti->blocked = ( plane_neighbours( spOccupancyBits, x, y ) & plane_neighbours( spStagnantBits, x, y ) ) == 0xff;
+
+	//
+	// handle particle update, based on its type and neighbours
+	//
+
+#include "particles/update_cpu_st.inl"
+
+	partp->x = partpl->x;
+	partp->y = partpl->y;
+    if( parti->blocked )
+    {
+        if( !wasblocked )
+        {
+            partp->vx = 0.0f;
+            partp->vy = 0.0f;
+            parti->stagnant = 1;
+		    parti->freefall = 0;
+		    spParticleMap[ y * sConfiguration.xres + x ].stagnant = parti->stagnant;
+		    planes_cpu_st_set_stagnant( x, y, parti->stagnant );
+        }
+		STEP_STAT( ctx, blocked );
+		return STEP_DONE;
+    }
+
+	assert( ptype->move_type != MT_IMMOVABLE );
+
+	//
+	// handle velocity
+	//
+
+    gridx = x / sConfiguration.grid_size;
+	gridy = y / sConfiguration.grid_size;
+
+	a = AIR_INDEX( gridx, gridy );
+	assert( !spAirType[ gridy * sGridX + gridx ] );
+
+	spAirVx[ a ] *= coefs->airloss;
+	spAirVy[ a ] *= coefs->airloss;
+
+	spAirVx[ a ] += ptype->airdrag * partpl->vx * sdt;
+	spAirVy[ a ] += ptype->airdrag * partpl->vy * sdt;
+
+#if STATE_HOTAIR
+	if( gridy > 0 && gridy < sGridY - 1 &&
+		gridx > 0 && gridx < sGridX - 1 )
+	{
+		for( j = -1; j < 2; j++ )
+			for( k = -1; k < 2; k++ )
+				spAirP[ a + j * sAirStride + k ] += coefs->hotair[ k + 1 + ( j + 1 ) * 3 ];
+	}
+#endif
+
+	partp->vx = partpl->vx * coefs->vloss + ptype->advection * spAirVx[ a ] * sdt;
+	partp->vy = partpl->vy * coefs->vloss + ( ptype->advection * spAirVy[ a ] + ptype->gravity ) * sdt;
+
+#if STATE_DIFFUSION
+	step_random_begin( ctx, i, 0 );
+	partp->vx += ptype->diffusion * ( frand( ctx ) * 2.0f - 1.0f ) * sdt;
+	partp->vy += ptype->diffusion * ( frand( ctx ) * 2.0f - 1.0f ) * sdt;
+#endif
+
+	return STEP_CONTINUE;
+}
+
+
+
+#undef STATE_KERNEL
+#undef STATE_HCONDUCT
+#undef STATE_HOTAIR
+#undef STATE_DIFFUSION
\ No newline at end of file
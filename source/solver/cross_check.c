@@ -0,0 +1,396 @@
+#include "pch.h"
+#include "cross_check.h"
+#include "solver.h"
+#include "stats.h"
+#include "shared/utils.h"
+#include <string.h>
+#include <math.h>
+
+
+
+#define CROSS_CHECK_TYPES 64		//!< Number of values of PPParticleInfo::type.
+#define CROSS_CHECK_BLOCK 16		//!< Size of occupancy block in pixels.
+#define CROSS_CHECK_MIN_MOVE 0.1	//!< Distance in pixels every particle is assumed to move at least, keeps scale of positions of calm scenes.
+
+//! Totals compared in equivalence mode, see PPConfiguration::cross_check_tolerance.
+enum PPCrossCheckTotal
+{
+	TOTAL_TEMP,
+	TOTAL_AIR_VX,
+	TOTAL_AIR_VY,
+	TOTAL_AIR_P,
+	TOTAL_HEAT,
+	TOTALS_COUNT
+};
+
+//! Summary of state, which solvers processing particles in different order still agree on.
+//! Particle velocities aren't summarized: which particle of a falling mass collides first depends on move order,
+//! so their totals differ by tens of percent, while the mass itself stays in place.
+struct PPCrossCheckTotals
+{
+	int alive;
+	int types[ CROSS_CHECK_TYPES ];		//!< Number of alive particles of every type.
+	double x[ CROSS_CHECK_TYPES ];		//!< Sum of x coordinates of particles of every type.
+	double y[ CROSS_CHECK_TYPES ];		//!< Sum of y coordinates of particles of every type.
+	double moved[ CROSS_CHECK_TYPES ];	//!< Distance moved by particles of every type in the frame, scale of tolerance of x and y.
+	int * blocks;						//!< Number of alive particles in every occupancy block.
+	double sum[ TOTALS_COUNT ];
+	double magnitude[ TOTALS_COUNT ];	//!< Sum of absolute values, scale of tolerance.
+};
+
+
+
+extern struct PPConfiguration sConfiguration;
+
+const struct PPSolver * spCrossCheckReference = NULL;
+const struct PPSolver * spCrossCheckCandidate = NULL;
+void * spCrossCheckBackup[ MAX_STATE_SECTIONS ];	//!< State before the frame.
+void * spCrossCheckResult[ MAX_STATE_SECTIONS ];	//!< State after reference frame.
+int sCrossCheckSectionsCount = 0;
+void * spCrossCheckDerived[ MAX_STATE_SECTIONS ];	//!< Derived structures before the frame.
+int sCrossCheckDerivedCount = 0;
+struct PPCrossCheckReport sCrossCheckReport;
+struct PPCrossCheckTotals sCrossCheckExpected;		//!< Totals of state after reference frame.
+int * spCrossCheckBlocks = NULL;					//!< Occupancy blocks of candidate, then of reference frame.
+int sCrossCheckBlocksX;
+int sCrossCheckBlocksCount;
+
+static const char * sCrossCheckTotalNames[ TOTALS_COUNT ] =
+{
+	"particles_temp", "air_vx", "air_vy", "air_p", "heat",
+};
+
+
+
+
+
+int cross_check_init( const struct PPSolver * reference, const struct PPSolver * candidate )
+{
+	struct PPStateSection sections[ MAX_STATE_SECTIONS ];
+	int i;
+
+	if( sConfiguration.log_fn )
+		sConfiguration.log_fn( LOG_INFO, "Cross-check mode: reference=%s, candidate=%s, tolerance=%g.", reference->name, candidate->name,
+			sConfiguration.cross_check_tolerance );
+
+	spCrossCheckReference = reference;
+	spCrossCheckCandidate = candidate;
+
+	memset( &sCrossCheckReport, 0, sizeof( struct PPCrossCheckReport ) );
+	sCrossCheckReport.x = sCrossCheckReport.y = -1;
+
+	sCrossCheckSectionsCount = candidate->get_state_sections( sections, MAX_STATE_SECTIONS );
+	for( i = 0; i < sCrossCheckSectionsCount; i++ )
+	{
+		spCrossCheckBackup[ i ] = malloc_log( sections[ i ].size );
+		spCrossCheckResult[ i ] = malloc_log( sections[ i ].size );
+		if( !spCrossCheckBackup[ i ] || !spCrossCheckResult[ i ] )
+		{
+			sCrossCheckSectionsCount = i + 1;
+			cross_check_deinit( );
+			return 0;
+		}
+	}
+
+	if( candidate->get_derived_sections )
+	{
+		sCrossCheckDerivedCount = candidate->get_derived_sections( sections, MAX_STATE_SECTIONS );
+		for( i = 0; i < sCrossCheckDerivedCount; i++ )
+		{
+			spCrossCheckDerived[ i ] = malloc_log( sections[ i ].size );
+			if( !spCrossCheckDerived[ i ] )
+			{
+				sCrossCheckDerivedCount = i + 1;
+				cross_check_deinit( );
+				return 0;
+			}
+		}
+	}
+
+	if( sConfiguration.cross_check_tolerance > 0.0f )
+	{
+		sCrossCheckBlocksX = ( sConfiguration.xres + CROSS_CHECK_BLOCK - 1 ) / CROSS_CHECK_BLOCK;
+		sCrossCheckBlocksCount = sCrossCheckBlocksX * ( ( sConfiguration.yres + CROSS_CHECK_BLOCK - 1 ) / CROSS_CHECK_BLOCK );
+		spCrossCheckBlocks = malloc_log( sizeof( int ) * sCrossCheckBlocksCount * 2 );
+		if( !spCrossCheckBlocks )
+		{
+			cross_check_deinit( );
+			return 0;
+		}
+	}
+
+	// solvers sharing the same implementation share update resources as well
+	if( reference != candidate && reference->attach && !reference->attach( ) )
+	{
+		cross_check_deinit( );
+		return 0;
+	}
+
+	return 1;
+}
+
+void cross_check_deinit( )
+{
+	int i;
+
+	if( spCrossCheckReference && spCrossCheckReference != spCrossCheckCandidate && spCrossCheckReference->detach )
+		spCrossCheckReference->detach( );
+
+	for( i = 0; i < sCrossCheckSectionsCount; i++ )
+	{
+		free( spCrossCheckBackup[ i ] );
+		free( spCrossCheckResult[ i ] );
+	}
+	for( i = 0; i < sCrossCheckDerivedCount; i++ )
+		free( spCrossCheckDerived[ i ] );
+	free( spCrossCheckBlocks );
+	spCrossCheckBlocks = NULL;
+
+	sCrossCheckSectionsCount = 0;
+	sCrossCheckDerivedCount = 0;
+	spCrossCheckReference = NULL;
+	spCrossCheckCandidate = NULL;
+}
+
+static void compare_section( const struct PPStateSection * section, const void * expected )
+{
+	const char * a = ( const char * ) section->data;
+	const char * b = ( const char * ) expected;
+	int i, count;
+
+	if( !memcmp( a, b, section->size ) )
+		return;
+
+	count = section->size / section->stride;
+	for( i = 0; i < count; i++, a += section->stride, b += section->stride )
+		if( memcmp( a, b, section->stride ) )
+			break;
+
+	sCrossCheckReport.diverged = 1;
+	sCrossCheckReport.frame = sCrossCheckReport.frames;
+	sCrossCheckReport.section = section->name;
+	sCrossCheckReport.index = i;
+	sCrossCheckReport.x = section->width ? i % section->width - section->border : -1;
+	sCrossCheckReport.y = section->width ? i / section->width - section->border : -1;
+
+	if( sConfiguration.log_fn )
+		sConfiguration.log_fn( LOG_WARNING, "Cross-check: %s diverged from %s at frame %d: section=%s, index=%d, x=%d, y=%d.",
+			spCrossCheckCandidate->name, spCrossCheckReference->name, sCrossCheckReport.frame,
+			section->name, i, sCrossCheckReport.x, sCrossCheckReport.y );
+}
+
+static void report_divergence( const char * name, int index, int x, int y )
+{
+	sCrossCheckReport.diverged = 1;
+	sCrossCheckReport.frame = sCrossCheckReport.frames;
+	sCrossCheckReport.section = name;
+	sCrossCheckReport.index = index;
+	sCrossCheckReport.x = x;
+	sCrossCheckReport.y = y;
+
+	if( sConfiguration.log_fn )
+		sConfiguration.log_fn( LOG_WARNING, "Cross-check: %s is not equivalent to %s at frame %d: total=%s, index=%d.",
+			spCrossCheckCandidate->name, spCrossCheckReference->name, sCrossCheckReport.frame, name, index );
+}
+
+static void add_floats( struct PPCrossCheckTotals * totals, int total, const float * data, int count )
+{
+	int i;
+
+	for( i = 0; i < count; i++ )
+	{
+		totals->sum[ total ] += data[ i ];
+		totals->magnitude[ total ] += fabs( data[ i ] );
+	}
+}
+
+static void get_totals( const struct PPStateSection * sections, int count, struct PPCrossCheckTotals * totals, int * blocks )
+{
+	const struct PPParticleInfo * info = NULL;
+	const struct PPParticlePhysInfo * phys = NULL;
+	const struct PPParticlePhysInfo * last = NULL;
+	int particles = 0;
+	int i, x, y;
+
+	memset( totals, 0, sizeof( struct PPCrossCheckTotals ) );
+	memset( blocks, 0, sizeof( int ) * sCrossCheckBlocksCount );
+	totals->blocks = blocks;
+
+	for( i = 0; i < count; i++ )
+		switch( sections[ i ].id )
+		{
+		case SECTION_ALIVE_COUNT:
+			totals->alive = *( const int * ) sections[ i ].data;
+			break;
+		case SECTION_PARTICLES_INFO:
+			info = ( const struct PPParticleInfo * ) sections[ i ].data;
+			particles = sections[ i ].size / sections[ i ].stride;
+			break;
+		case SECTION_PARTICLES_PHYS:
+			phys = ( const struct PPParticlePhysInfo * ) sections[ i ].data;
+			break;
+		case SECTION_PARTICLES_PHYS_LAST:
+			last = ( const struct PPParticlePhysInfo * ) sections[ i ].data;
+			break;
+		case SECTION_AIR_VX:
+			add_floats( totals, TOTAL_AIR_VX, ( const float * ) sections[ i ].data, sections[ i ].size / sizeof( float ) );
+			break;
+		case SECTION_AIR_VY:
+			add_floats( totals, TOTAL_AIR_VY, ( const float * ) sections[ i ].data, sections[ i ].size / sizeof( float ) );
+			break;
+		case SECTION_AIR_P:
+			add_floats( totals, TOTAL_AIR_P, ( const float * ) sections[ i ].data, sections[ i ].size / sizeof( float ) );
+			break;
+		case SECTION_HEAT:
+			add_floats( totals, TOTAL_HEAT, ( const float * ) sections[ i ].data, sections[ i ].size / sizeof( float ) );
+			break;
+		}
+
+	if( !info || !phys || !last )
+		return;
+
+	// previous stream holds positions before the frame, which both solvers started from
+	for( i = 0; i < particles; i++ )
+		if( info[ i ].type )
+		{
+			totals->types[ info[ i ].type ]++;
+			totals->x[ info[ i ].type ] += phys[ i ].x;
+			totals->y[ info[ i ].type ] += phys[ i ].y;
+			totals->moved[ info[ i ].type ] += fabs( phys[ i ].x - last[ i ].x ) + fabs( phys[ i ].y - last[ i ].y );
+			add_floats( totals, TOTAL_TEMP, &phys[ i ].temp, 1 );
+
+			x = ( int ) phys[ i ].x / CROSS_CHECK_BLOCK;
+			y = ( int ) phys[ i ].y / CROSS_CHECK_BLOCK;
+			blocks[ y * sCrossCheckBlocksX + x ]++;
+		}
+}
+
+static int within_tolerance( double value, double expected, double scale )
+{
+	return fabs( value - expected ) <= sConfiguration.cross_check_tolerance * scale;
+}
+
+static void compare_totals( const struct PPCrossCheckTotals * totals, const struct PPCrossCheckTotals * expected )
+{
+	double scale;
+	int i, difference, misplaced, worst;
+
+	if( !within_tolerance( totals->alive, expected->alive, totals->alive > expected->alive ? totals->alive : expected->alive ) )
+	{
+		report_divergence( "alive_count", 0, -1, -1 );
+		return;
+	}
+
+	for( i = 0; i < CROSS_CHECK_TYPES; i++ )
+		if( !within_tolerance( totals->types[ i ], expected->types[ i ], totals->types[ i ] > expected->types[ i ] ? totals->types[ i ] : expected->types[ i ] ) )
+		{
+			report_divergence( "type_count", i, -1, -1 );
+			return;
+		}
+
+	// every misplaced particle is missing in one block and extra in another one
+	for( i = 0, misplaced = 0, worst = 0; i < sCrossCheckBlocksCount; i++ )
+	{
+		difference = abs( totals->blocks[ i ] - expected->blocks[ i ] );
+		misplaced += difference;
+		if( difference > abs( totals->blocks[ worst ] - expected->blocks[ worst ] ) )
+			worst = i;
+	}
+	if( !within_tolerance( misplaced / 2, 0.0, expected->alive ) )
+	{
+		report_divergence( "occupancy", worst, worst % sCrossCheckBlocksX * CROSS_CHECK_BLOCK, worst / sCrossCheckBlocksX * CROSS_CHECK_BLOCK );
+		return;
+	}
+
+	// sums of positions are compared with distance particles have moved, not with coordinates themselves
+	for( i = 0; i < CROSS_CHECK_TYPES; i++ )
+	{
+		scale = totals->moved[ i ] > expected->moved[ i ] ? totals->moved[ i ] : expected->moved[ i ];
+		scale += CROSS_CHECK_MIN_MOVE * expected->types[ i ];
+		if( !within_tolerance( totals->x[ i ], expected->x[ i ], scale ) || !within_tolerance( totals->y[ i ], expected->y[ i ], scale ) )
+		{
+			report_divergence( "position", i, -1, -1 );
+			return;
+		}
+	}
+
+	for( i = 0; i < TOTALS_COUNT; i++ )
+	{
+		scale = totals->magnitude[ i ] > expected->magnitude[ i ] ? totals->magnitude[ i ] : expected->magnitude[ i ];
+		if( !within_tolerance( totals->sum[ i ], expected->sum[ i ], scale ) )
+		{
+			report_divergence( sCrossCheckTotalNames[ i ], 0, -1, -1 );
+			return;
+		}
+	}
+}
+
+void cross_check_update( pp_time_t dt )
+{
+	struct PPStateSection sections[ MAX_STATE_SECTIONS ];
+	struct PPStateSection derived[ MAX_STATE_SECTIONS ];
+	struct PPCrossCheckTotals totals;
+	struct PPStats stats;
+	int i;
+
+	// sections may be swapped by update, so they are requested every time
+	spCrossCheckCandidate->get_state_sections( sections, MAX_STATE_SECTIONS );
+	for( i = 0; i < sCrossCheckSectionsCount; i++ )
+		memcpy( spCrossCheckBackup[ i ], sections[ i ].data, sections[ i ].size );
+
+	// structures derived from state are saved as well, rebuilding them by state_loaded every frame would be slow
+	// and would mark change lists of every frame as reloaded
+	if( sCrossCheckDerivedCount )
+	{
+		spCrossCheckCandidate->get_derived_sections( derived, MAX_STATE_SECTIONS );
+		for( i = 0; i < sCrossCheckDerivedCount; i++ )
+			memcpy( spCrossCheckDerived[ i ], derived[ i ].data, derived[ i ].size );
+	}
+
+	// random generator is keyed by frame counter, which is restored with the rest of state,
+	// statistics and change lists are collected for candidate only
+	stats = sStatsNext;
+	spCrossCheckReference->update( dt );
+	spCrossCheckReference->end_frame( );
+	sStatsNext = stats;
+
+	spCrossCheckCandidate->get_state_sections( sections, MAX_STATE_SECTIONS );
+	if( sConfiguration.cross_check_tolerance > 0.0f )
+		get_totals( sections, sCrossCheckSectionsCount, &sCrossCheckExpected, spCrossCheckBlocks + sCrossCheckBlocksCount );
+	for( i = 0; i < sCrossCheckSectionsCount; i++ )
+	{
+		memcpy( spCrossCheckResult[ i ], sections[ i ].data, sections[ i ].size );
+		memcpy( sections[ i ].data, spCrossCheckBackup[ i ], sections[ i ].size );
+	}
+
+	if( spCrossCheckCandidate->get_derived_sections )
+	{
+		spCrossCheckCandidate->get_derived_sections( derived, MAX_STATE_SECTIONS );
+		for( i = 0; i < sCrossCheckDerivedCount; i++ )
+			memcpy( derived[ i ].data, spCrossCheckDerived[ i ], derived[ i ].size );
+	}
+	else if( spCrossCheckCandidate->state_loaded )
+		spCrossCheckCandidate->state_loaded( );
+
+	spCrossCheckCandidate->update( dt );
+
+	if( !sCrossCheckReport.diverged )
+	{
+		spCrossCheckCandidate->get_state_sections( sections, MAX_STATE_SECTIONS );
+		if( sConfiguration.cross_check_tolerance > 0.0f )
+		{
+			get_totals( sections, sCrossCheckSectionsCount, &totals, spCrossCheckBlocks );
+			compare_totals( &totals, &sCrossCheckExpected );
+		}
+		else
+			for( i = 0; i < sCrossCheckSectionsCount && !sCrossCheckReport.diverged; i++ )
+				compare_section( sections + i, spCrossCheckResult[ i ] );
+	}
+
+	sCrossCheckReport.frames++;
+}
+
+const struct PPCrossCheckReport * cross_check_get_report( )
+{
+	return &sCrossCheckReport;
+}
\ No newline at end of file
@@ -0,0 +1,21 @@
+#ifndef __POWDER_CROSS_CHECK_H__
+#define __POWDER_CROSS_CHECK_H__
+
+
+#include "shared/types.h"
+
+
+
+struct PPSolver;
+
+
+
+//! Start cross-checking. Candidate solver must be initialized already, reference one is attached to its storage.
+int cross_check_init( const struct PPSolver * reference, const struct PPSolver * candidate );
+void cross_check_deinit( );
+//! Step reference and candidate solvers from the same state and seed, and compare results.
+void cross_check_update( pp_time_t dt );
+const struct PPCrossCheckReport * cross_check_get_report( );
+
+
+#endif // __POWDER_CROSS_CHECK_H__
\ No newline at end of file
@@ -0,0 +1,596 @@
+#include "pch.h"
+#include "history.h"
+#include "solver.h"
+#include "shared/utils.h"
+#include "shared/cpu.h"
+#include "shared/timer.h"
+#include <string.h>
+#include <assert.h>
+
+
+
+#define HISTORY_MAX_RECORDS 65536
+#define HISTORY_BLOCK_WORDS 16		//!< Words in block of record, block mask has a bit per word.
+#define HISTORY_SLICE_WORDS 65536	//!< Words encoded or copied into ring between deadline checks, multiple of HISTORY_BLOCK_WORDS.
+
+
+
+//! Record of history ring.
+struct PPHistoryRecord
+{
+	int offset;		//!< Offset in ring.
+	int size;
+	int frame;		//!< Frame, which state record produces.
+	int keyframe;	//!< Record is full state of frame rather than XOR with the previous frame.
+};
+
+//! Record being encoded into scratch, encoding may be split between calls of history_record.
+struct PPHistoryEncoder
+{
+	int active;
+	int keyframe;	//!< Record is keyframe of state copy, otherwise delta of solver state with it.
+	int section;	//!< Section being encoded.
+	int offset;		//!< Offset of section in state copy.
+	int position;	//!< Word of section, where encoding continues.
+	int skip;		//!< Unchanged blocks before position, which aren't written yet.
+	unsigned char * out;
+	int size;		//!< Size of encoded record, which is being copied into ring.
+	int write;		//!< Ring offset of record.
+	int copied;
+};
+
+
+
+extern struct PPConfiguration sConfiguration;
+extern const struct PPSolver * spSolver;
+
+unsigned char * spHistoryRing = NULL;				//!< Records, sHistoryRingSize bytes.
+struct PPHistoryRecord * spHistoryRecords = NULL;	//!< Ring of records from the oldest one, HISTORY_MAX_RECORDS entries.
+int sHistoryFirst;									//!< Index of the oldest record.
+int sHistoryCount;
+int sHistoryWrite;									//!< Ring offset after the newest record.
+int sHistoryFrame;									//!< Frame of state copy.
+unsigned char * spHistoryState = NULL;				//!< Copy of state at sHistoryFrame, sections one after another at 4-byte boundaries.
+unsigned char * spHistoryScratch = NULL;			//!< Record being encoded.
+int sHistoryStateSize;
+int sHistoryScratchSize;
+int sHistoryRingSize;								//!< Part of PPConfiguration::history_memory left after state copy and scratch.
+struct PPHistoryEncoder sHistoryEncoder;
+unsigned int ( * sHistoryDiffFn )( const unsigned int * cur, const unsigned int * old, unsigned int * x, int count );
+
+//! Number of set bits of 4-bit mask and their positions, for packing changed words of block.
+static const unsigned char sPackCount[ 16 ] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+static const unsigned char sPackOrder[ 16 ][ 4 ] =
+{
+	{ 0, 0, 0, 0 }, { 0, 0, 0, 0 }, { 1, 0, 0, 0 }, { 0, 1, 0, 0 },
+	{ 2, 0, 0, 0 }, { 0, 2, 0, 0 }, { 1, 2, 0, 0 }, { 0, 1, 2, 0 },
+	{ 3, 0, 0, 0 }, { 0, 3, 0, 0 }, { 1, 3, 0, 0 }, { 0, 1, 3, 0 },
+	{ 2, 3, 0, 0 }, { 0, 2, 3, 0 }, { 1, 2, 3, 0 }, { 0, 1, 2, 3 }
+};
+
+
+
+
+
+static unsigned char * put_varint( unsigned char * out, unsigned int value )
+{
+	while( value >= 0x80 )
+	{
+		*out++ = ( unsigned char )( value | 0x80 );
+		value >>= 7;
+	}
+	*out++ = ( unsigned char ) value;
+	return out;
+}
+
+static const unsigned char * get_varint( const unsigned char * in, unsigned int * value )
+{
+	int shift = 0;
+
+	*value = 0;
+	do
+	{
+		*value |= ( unsigned int )( *in & 0x7f ) << shift;
+		shift += 7;
+	}
+	while( *in++ & 0x80 );
+
+	return in;
+}
+
+// XOR 'count' words of block with old ones, returning mask of changed words.
+static unsigned int diff_block_scalar( const unsigned int * cur, const unsigned int * old, unsigned int * x, int count )
+{
+	unsigned int mask = 0;
+	int i;
+
+	for( i = 0; i < count; i++ )
+	{
+		x[ i ] = cur[ i ] ^ old[ i ];
+		mask |= ( unsigned int )( x[ i ] != 0 ) << i;
+	}
+
+	return mask;
+}
+
+
+
+#ifdef CPU_X86
+
+//
+// SSE2 kernels
+//
+
+static CPU_TARGET_SSE2 unsigned int diff_block_sse2( const unsigned int * cur, const unsigned int * old, unsigned int * x, int count )
+{
+	__m128i zero = _mm_setzero_si128( );
+	__m128i v;
+	unsigned int mask = 0;
+	int i;
+
+	if( count < HISTORY_BLOCK_WORDS )
+		return diff_block_scalar( cur, old, x, count );
+
+	for( i = 0; i < HISTORY_BLOCK_WORDS; i += 4 )
+	{
+		v = _mm_xor_si128( _mm_loadu_si128( ( const __m128i * ) ( cur + i ) ), _mm_loadu_si128( ( const __m128i * ) ( old + i ) ) );
+		_mm_storeu_si128( ( __m128i * ) ( x + i ), v );
+		mask |= ( unsigned int ) _mm_movemask_ps( _mm_castsi128_ps( _mm_cmpeq_epi32( v, zero ) ) ) << i;
+	}
+
+	return mask ^ 0xffff;
+}
+
+#endif // CPU_X86
+
+
+
+// Encode words [begin, end) of section as XOR with its copy, or with zeroes if there is no copy, and update the copy.
+// Words are grouped in blocks, every changed block is preceded by count of unchanged blocks before it and a mask of
+// its changed words, and holds XOR values of changed words only. Count of trailing unchanged blocks ends the section.
+// 'skip' carries unchanged blocks, which aren't written yet, between calls. Section is complete when 'end' is its end.
+static unsigned char * encode( unsigned char * out, const unsigned char * data, unsigned char * copy, int size, int begin, int end, int * skip )
+{
+	static const unsigned int zero[ HISTORY_BLOCK_WORDS ] = { 0 };
+	const unsigned int * cur = ( const unsigned int * ) data;
+	unsigned int * old = ( unsigned int * ) copy;
+	unsigned int x[ HISTORY_BLOCK_WORDS ];
+	const unsigned char * order;
+	int words = size / 4;
+	int i, j, n;
+	unsigned int mask, nibble;
+
+	for( i = begin; i < end; i += n )
+	{
+		n = end - i < HISTORY_BLOCK_WORDS ? end - i : HISTORY_BLOCK_WORDS;
+		mask = sHistoryDiffFn( cur + i, old ? old + i : zero, x, n );
+		if( !mask )
+		{
+			( *skip )++;
+			continue;
+		}
+
+		out = put_varint( out, *skip );
+		*skip = 0;
+		*out++ = ( unsigned char ) mask;
+		*out++ = ( unsigned char )( mask >> 8 );
+
+		// changed words of every 4 are packed by table rather than by a branch per word, unused bits of mask are zero
+		for( j = 0; j < n; j += 4 )
+		{
+			nibble = ( mask >> j ) & 15;
+			order = sPackOrder[ nibble ];
+			memcpy( out, x + j + order[ 0 ], 4 );
+			memcpy( out + 4, x + j + order[ 1 ], 4 );
+			memcpy( out + 8, x + j + order[ 2 ], 4 );
+			memcpy( out + 12, x + j + order[ 3 ], 4 );
+			out += sPackCount[ nibble ] * 4;
+		}
+
+		if( old )
+			memcpy( old + i, cur + i, n * 4 );
+	}
+
+	if( end < words )
+		return out;
+
+	if( *skip )
+		out = put_varint( out, *skip );
+	*skip = 0;
+
+	for( j = words * 4; j < size; j++ )
+	{
+		*out++ = data[ j ] ^ ( copy ? copy[ j ] : 0 );
+		if( copy )
+			copy[ j ] = data[ j ];
+	}
+
+	return out;
+}
+
+// XOR encoded section into data.
+static const unsigned char * decode( const unsigned char * in, unsigned char * data, int size )
+{
+	unsigned int * cur = ( unsigned int * ) data;
+	int words = size / 4;
+	int blocks = ( words + HISTORY_BLOCK_WORDS - 1 ) / HISTORY_BLOCK_WORDS;
+	int i = 0, j;
+	unsigned int skip, mask, x;
+
+	while( i < blocks )
+	{
+		in = get_varint( in, &skip );
+		i += skip;
+		if( i >= blocks )
+			break;
+
+		mask = in[ 0 ] | ( in[ 1 ] << 8 );
+		in += 2;
+		for( j = 0; mask; j++, mask >>= 1 )
+			if( mask & 1 )
+			{
+				memcpy( &x, in, 4 );
+				in += 4;
+				cur[ i * HISTORY_BLOCK_WORDS + j ] ^= x;
+			}
+		i++;
+	}
+
+	for( j = words * 4; j < size; j++ )
+		data[ j ] ^= *in++;
+
+	return in;
+}
+
+static int align4( int size )
+{
+	return ( size + 3 ) & ~3;
+}
+
+static struct PPHistoryRecord * get_record( int n )
+{
+	return spHistoryRecords + ( sHistoryFirst + n ) % HISTORY_MAX_RECORDS;
+}
+
+static void drop_oldest( )
+{
+	sHistoryFirst = ( sHistoryFirst + 1 ) % HISTORY_MAX_RECORDS;
+	sHistoryCount--;
+}
+
+// Drop the oldest records to free space for record of 'size' bytes in ring. Returns offset of the space.
+static int reserve( int size )
+{
+	int offset = sHistoryWrite;
+
+	// history_init makes sure ring fits the largest record
+	assert( size <= sHistoryRingSize );
+
+	// records from offset to the end of ring are the oldest ones
+	if( offset + size > sHistoryRingSize )
+	{
+		while( sHistoryCount && get_record( 0 )->offset >= offset )
+			drop_oldest( );
+		offset = 0;
+	}
+
+	while( sHistoryCount && get_record( 0 )->offset < offset + size && get_record( 0 )->offset + get_record( 0 )->size > offset )
+		drop_oldest( );
+	if( sHistoryCount == HISTORY_MAX_RECORDS )
+		drop_oldest( );
+
+	return offset;
+}
+
+// Add record, which is copied into reserved space of ring.
+static void add_record( int offset, int size, int keyframe )
+{
+	struct PPHistoryRecord * record = get_record( sHistoryCount++ );
+
+	record->offset = offset;
+	record->size = size;
+	record->frame = sHistoryFrame;
+	record->keyframe = keyframe;
+	sHistoryWrite = offset + size;
+}
+
+// XOR record into state copy.
+static void apply( const struct PPHistoryRecord * record, const struct PPStateSection * sections, int count )
+{
+	const unsigned char * in = spHistoryRing + record->offset;
+	int i, offset = 0;
+
+	for( i = 0; i < count; i++ )
+	{
+		in = decode( in, spHistoryState + offset, sections[ i ].size );
+		offset += align4( sections[ i ].size );
+	}
+}
+
+static void begin_record( int keyframe )
+{
+	sHistoryEncoder.active = 1;
+	sHistoryEncoder.keyframe = keyframe;
+	sHistoryEncoder.section = 0;
+	sHistoryEncoder.offset = 0;
+	sHistoryEncoder.position = 0;
+	sHistoryEncoder.skip = 0;
+	sHistoryEncoder.out = spHistoryScratch;
+}
+
+// Encode record until it's complete or deadline of timer_ms is reached. Keyframe is XOR of state copy with zeroes.
+static int encode_slice( const struct PPStateSection * sections, int count, double deadline )
+{
+	struct PPHistoryEncoder * e = &sHistoryEncoder;
+	unsigned char * copy;
+	int size, end;
+
+	while( e->section < count )
+	{
+		size = sections[ e->section ].size;
+		copy = spHistoryState + e->offset;
+		end = e->position + HISTORY_SLICE_WORDS < size / 4 ? e->position + HISTORY_SLICE_WORDS : size / 4;
+		if( e->keyframe )
+			e->out = encode( e->out, copy, NULL, size, e->position, end, &e->skip );
+		else
+			e->out = encode( e->out, sections[ e->section ].data, copy, size, e->position, end, &e->skip );
+
+		e->position = end;
+		if( end == size / 4 )
+		{
+			e->section++;
+			e->offset += align4( size );
+			e->position = 0;
+		}
+
+		if( e->section < count && deadline > 0.0 && timer_ms( ) >= deadline )
+			return 0;
+	}
+
+	return 1;
+}
+
+// Copy encoded record into ring until it's complete or deadline of timer_ms is reached.
+static int copy_slice( double deadline )
+{
+	struct PPHistoryEncoder * e = &sHistoryEncoder;
+	int size;
+
+	while( e->copied < e->size )
+	{
+		size = e->size - e->copied < HISTORY_SLICE_WORDS * 4 ? e->size - e->copied : HISTORY_SLICE_WORDS * 4;
+		memcpy( spHistoryRing + e->write + e->copied, spHistoryScratch + e->copied, size );
+		e->copied += size;
+
+		if( e->copied < e->size && deadline > 0.0 && timer_ms( ) >= deadline )
+			return 0;
+	}
+
+	return 1;
+}
+
+int history_init( )
+{
+	struct PPStateSection sections[ MAX_STATE_SECTIONS ];
+	int i, count;
+
+	if( sConfiguration.history_memory <= 0 )
+		return 1;
+
+	count = spSolver->get_state_sections( sections, MAX_STATE_SECTIONS );
+	sHistoryStateSize = 0;
+	for( i = 0; i < count; i++ )
+		sHistoryStateSize += align4( sections[ i ].size );
+
+	// state copy and scratch are part of budget, the rest must fit the largest record, which has every block changed
+	// and takes 3 bytes of header per block of 64 bytes
+	sHistoryScratchSize = sHistoryStateSize + sHistoryStateSize / 16 + 16 * count;
+	sHistoryRingSize = sConfiguration.history_memory - sHistoryStateSize - sHistoryScratchSize;
+	if( sHistoryRingSize < sHistoryScratchSize )
+	{
+		if( sConfiguration.log_fn )
+			sConfiguration.log_fn( LOG_ERROR, "Rewind history needs at least %d bytes of memory, %d given.",
+				sHistoryStateSize + 2 * sHistoryScratchSize, sConfiguration.history_memory );
+		return 0;
+	}
+
+	sHistoryDiffFn = diff_block_scalar;
+#ifdef CPU_X86
+	if( cpu_has_sse2( ) )
+		sHistoryDiffFn = diff_block_sse2;
+#endif
+
+	spHistoryState = malloc_log( sHistoryStateSize );
+	if( !spHistoryState )
+	{
+		history_deinit( );
+		return 0;
+	}
+
+	spHistoryScratch = malloc_log( sHistoryScratchSize );
+	if( !spHistoryScratch )
+	{
+		history_deinit( );
+		return 0;
+	}
+
+	spHistoryRing = malloc_log( sHistoryRingSize );
+	if( !spHistoryRing )
+	{
+		history_deinit( );
+		return 0;
+	}
+
+	spHistoryRecords = malloc_log( sizeof( struct PPHistoryRecord ) * HISTORY_MAX_RECORDS );
+	if( !spHistoryRecords )
+	{
+		history_deinit( );
+		return 0;
+	}
+
+	if( sConfiguration.log_fn )
+		sConfiguration.log_fn( LOG_INFO, "Rewind history: memory=%d, ring=%d, state=%d, keyframe=%d.",
+			sConfiguration.history_memory, sHistoryRingSize, sHistoryStateSize, sConfiguration.history_keyframe );
+
+	history_reset( );
+	return 1;
+}
+
+void history_deinit( )
+{
+	free( spHistoryRing );
+	free( spHistoryRecords );
+	free( spHistoryState );
+	free( spHistoryScratch );
+	spHistoryRing = NULL;
+	spHistoryRecords = NULL;
+	spHistoryState = NULL;
+	spHistoryScratch = NULL;
+}
+
+void history_reset( )
+{
+	struct PPStateSection sections[ MAX_STATE_SECTIONS ];
+	int i, count, offset = 0;
+
+	if( !spHistoryRing )
+		return;
+
+	count = spSolver->get_state_sections( sections, MAX_STATE_SECTIONS );
+	for( i = 0; i < count; i++ )
+	{
+		memcpy( spHistoryState + offset, sections[ i ].data, sections[ i ].size );
+		offset += align4( sections[ i ].size );
+	}
+
+	sHistoryFirst = 0;
+	sHistoryCount = 0;
+	sHistoryWrite = 0;
+	sHistoryFrame = 0;
+	sHistoryEncoder.active = 0;
+}
+
+int history_record( double deadline )
+{
+	struct PPStateSection sections[ MAX_STATE_SECTIONS ];
+	int count, keyframe;
+
+	if( !spHistoryRing )
+		return 1;
+
+	count = spSolver->get_state_sections( sections, MAX_STATE_SECTIONS );
+	if( !sHistoryEncoder.active )
+		begin_record( 0 );
+
+	for( ;; )
+	{
+		if( sHistoryEncoder.section < count )
+		{
+			if( !encode_slice( sections, count, deadline ) )
+				return 0;
+
+			sHistoryEncoder.size = ( int )( sHistoryEncoder.out - spHistoryScratch );
+			sHistoryEncoder.write = reserve( sHistoryEncoder.size );
+			sHistoryEncoder.copied = 0;
+			if( deadline > 0.0 && timer_ms( ) >= deadline )
+				return 0;
+		}
+
+		if( !copy_slice( deadline ) )
+			return 0;
+
+		keyframe = sHistoryEncoder.keyframe;
+		sHistoryEncoder.active = 0;
+		if( !keyframe )
+			sHistoryFrame++;
+		add_record( sHistoryEncoder.write, sHistoryEncoder.size, keyframe );
+
+		// keyframe follows delta of its frame, so it is dropped after the delta
+		if( keyframe || sConfiguration.history_keyframe <= 0 || sHistoryFrame % sConfiguration.history_keyframe )
+			return 1;
+		begin_record( 1 );
+	}
+}
+
+int history_rewind( int frames )
+{
+	struct PPStateSection sections[ MAX_STATE_SECTIONS ];
+	const struct PPHistoryRecord * record;
+	const struct PPHistoryRecord * keyframe = NULL;
+	int i, count, offset, target, from, to, cost;
+
+	if( frames > history_get_frames( ) )
+		frames = history_get_frames( );
+	if( frames <= 0 )
+		return 0;
+
+	count = spSolver->get_state_sections( sections, MAX_STATE_SECTIONS );
+	target = sHistoryFrame - frames;
+
+	// start from the current state or from the keyframe with the shortest chain of deltas to target
+	cost = frames;
+	for( i = 0; i < sHistoryCount; i++ )
+	{
+		record = get_record( i );
+		if( record->keyframe && abs( record->frame - target ) < cost )
+		{
+			keyframe = record;
+			cost = abs( record->frame - target );
+		}
+	}
+
+	from = sHistoryFrame;
+	if( keyframe )
+	{
+		offset = 0;
+		for( i = 0; i < count; i++ )
+		{
+			memset( spHistoryState + offset, 0, sections[ i ].size );
+			offset += align4( sections[ i ].size );
+		}
+		apply( keyframe, sections, count );
+		from = keyframe->frame;
+	}
+
+	// XOR is order independent, deltas of frames between start and target are applied in any order
+	to = from > target ? from : target;
+	from = from > target ? target : from;
+	for( i = 0; i < sHistoryCount; i++ )
+	{
+		record = get_record( i );
+		if( !record->keyframe && record->frame > from && record->frame <= to )
+			apply( record, sections, count );
+	}
+
+	offset = 0;
+	for( i = 0; i < count; i++ )
+	{
+		memcpy( sections[ i ].data, spHistoryState + offset, sections[ i ].size );
+		offset += align4( sections[ i ].size );
+	}
+	if( spSolver->state_loaded )
+		spSolver->state_loaded( );
+
+	// timeline continues from target
+	while( sHistoryCount && get_record( sHistoryCount - 1 )->frame > target )
+		sHistoryCount--;
+	sHistoryWrite = sHistoryCount ? get_record( sHistoryCount - 1 )->offset + get_record( sHistoryCount - 1 )->size : 0;
+	sHistoryFrame = target;
+
+	return frames;
+}
+
+int history_get_frames( )
+{
+	int i;
+
+	if( !spHistoryRing )
+		return 0;
+
+	// deltas are consecutive, the oldest one limits rewinding
+	for( i = 0; i < sHistoryCount; i++ )
+		if( !get_record( i )->keyframe )
+			return sHistoryFrame - get_record( i )->frame + 1;
+
+	return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef __POWDER_HISTORY_H__
+#define __POWDER_HISTORY_H__
+
+
+#include "shared/types.h"
+
+
+
+// Rewind history keeps a ring of frame records within PPConfiguration::history_memory bytes. Every
+// frame is recorded as XOR of solver state sections with the previous frame, compressed as runs of
+// unchanged blocks and changed words of changed blocks, so calm parts of the world cost next to nothing.
+// Budget includes a copy of state and scratch for encoding a record, which take a bit over twice the state. Every
+// PPConfiguration::history_keyframe frames a full keyframe is added, which bounds rewind cost.
+// State is restored backwards from the current frame or from the nearest keyframe.
+
+
+
+//! Initialize history, if it is enabled by configuration. Returns 0 on failure.
+int history_init( );
+void history_deinit( );
+//! Drop all records and start history from the current state.
+void history_reset( );
+//! Record state after frame update until deadline of timer_ms, 0 for no deadline. Returns 1 if the record is complete,
+//! otherwise the next call continues it, state must not change in between.
+int history_record( double deadline );
+//! Restore state of 'frames' frames ago, newer records are dropped. Returns number of frames rewound.
+int history_rewind( int frames );
+//! Number of frames history can rewind.
+int history_get_frames( );
+
+
+#endif // __POWDER_HISTORY_H__
@@ -0,0 +1,253 @@
+#include "pch.h"
+#include "publish.h"
+#include "solver.h"
+#include "shared/utils.h"
+#include "shared/timer.h"
+#include <string.h>
+
+
+
+#define PUBLISH_SLICE ( 256 << 10 )	//!< Bytes copied between deadline checks.
+#define PUBLISH_MAX_COPIES 8
+
+
+
+//! Storage of published frame.
+struct PPFrameBuffer
+{
+	struct PPFrame frame;
+	struct PPRenderSource source;		//!< Render inputs of the frame.
+	int capacity;						//!< Number of particles streams hold.
+	int * index;
+	struct PPParticleInfo * info;
+	struct PPParticlePhysInfo * phys;
+	struct PPParticlePhysInfo * phys_last;
+	struct PPParticleMap * map;
+	float * heat;
+	struct PPAirParticle * air;
+};
+
+//! Piece of solver state copied by publish_copy.
+struct PPPublishCopy
+{
+	void * dst;
+	const void * src;
+	int size;
+};
+
+
+
+extern const struct PPSolver * spSolver;
+
+struct PPFrameBuffer sPublishBuffers[ 2 ];
+int sPublishFront = -1;				//!< Buffer of published frame, -1 if there is none.
+int sPublishPending = 0;			//!< Back buffer holds a complete frame, which isn't published yet.
+int sPublishFrame = 0;
+struct PPPublishCopy sPublishCopies[ PUBLISH_MAX_COPIES ];
+int sPublishCopyCount = 0;			//!< Copies of publish_copy in progress, 0 if there is none.
+int sPublishCopyIndex;				//!< Copy in progress.
+int sPublishCopied;					//!< Bytes of copy in progress done.
+
+
+
+
+
+static void free_streams( struct PPFrameBuffer * buffer )
+{
+	free( buffer->index );
+	free( buffer->info );
+	free( buffer->phys );
+	free( buffer->phys_last );
+	buffer->index = NULL;
+	buffer->info = NULL;
+	buffer->phys = NULL;
+	buffer->phys_last = NULL;
+	buffer->capacity = 0;
+}
+
+static void free_buffer( struct PPFrameBuffer * buffer )
+{
+	free_streams( buffer );
+	free( buffer->map );
+	free( buffer->heat );
+	free( buffer->air );
+	memset( buffer, 0, sizeof( struct PPFrameBuffer ) );
+}
+
+// Grids have the same size until deinitialization, streams grow on demand.
+static int reserve_buffer( struct PPFrameBuffer * buffer, int count, int map_size, int heat_size, int air_count )
+{
+	int capacity = count + count / 2;
+
+	if( !buffer->map )
+		buffer->map = malloc_log( map_size );
+	if( !buffer->heat && heat_size )
+		buffer->heat = malloc_log( heat_size );
+	if( !buffer->air )
+		buffer->air = malloc_log( sizeof( struct PPAirParticle ) * air_count );
+	if( !buffer->map || ( !buffer->heat && heat_size ) || !buffer->air )
+		return 0;
+
+	if( count <= buffer->capacity )
+		return 1;
+
+	free_streams( buffer );
+	buffer->index = malloc_log( sizeof( int ) * capacity );
+	buffer->info = malloc_log( sizeof( struct PPParticleInfo ) * capacity );
+	buffer->phys = malloc_log( sizeof( struct PPParticlePhysInfo ) * capacity );
+	buffer->phys_last = malloc_log( sizeof( struct PPParticlePhysInfo ) * capacity );
+	if( !buffer->index || !buffer->info || !buffer->phys || !buffer->phys_last )
+	{
+		free_streams( buffer );
+		return 0;
+	}
+
+	buffer->capacity = capacity;
+	return 1;
+}
+
+void publish_reset( )
+{
+	sPublishFront = -1;
+	sPublishPending = 0;
+	sPublishFrame = 0;
+	sPublishCopyCount = 0;
+}
+
+void publish_deinit( )
+{
+	free_buffer( sPublishBuffers + 0 );
+	free_buffer( sPublishBuffers + 1 );
+	publish_reset( );
+}
+
+static void add_copy( void * dst, const void * src, int size )
+{
+	// empty world has no streams to copy, buffers of them may be NULL
+	if( !size )
+		return;
+
+	sPublishCopies[ sPublishCopyCount ].dst = dst;
+	sPublishCopies[ sPublishCopyCount ].src = src;
+	sPublishCopies[ sPublishCopyCount ].size = size;
+	sPublishCopyCount++;
+}
+
+// Streams are copied up to the highest alive index, sequential copy of them is cheaper than gathering alive particles.
+static int begin_copy( struct PPFrameBuffer * buffer )
+{
+	struct PPStateSection sections[ MAX_STATE_SECTIONS ];
+	struct PPRenderSource * source = &buffer->source;
+	const int * alive = spSolver->get_alive_particles( );
+	int count = spSolver->get_alive_particles_count( );
+	int sections_count = spSolver->get_state_sections( sections, MAX_STATE_SECTIONS );
+	const void * map = NULL, * heat = NULL;
+	int map_size = 0, heat_size = 0, air_count = 0;
+	int i, span = 0;
+
+	for( i = 0; i < count; i++ )
+		if( alive[ i ] >= span )
+			span = alive[ i ] + 1;
+
+	for( i = 0; i < sections_count; i++ )
+	{
+		if( sections[ i ].id == SECTION_PARTICLE_MAP )
+		{
+			map = sections[ i ].data;
+			map_size = sections[ i ].size;
+		}
+		else if( sections[ i ].id == SECTION_HEAT )
+		{
+			heat = sections[ i ].data;
+			heat_size = sections[ i ].size;
+		}
+		else if( sections[ i ].id == SECTION_AIR_TYPE )
+			air_count = sections[ i ].size / sections[ i ].stride;
+	}
+
+	if( !reserve_buffer( buffer, span, map_size, heat_size, air_count ) )
+		return 0;
+
+	spSolver->pack_air( buffer->air );
+
+	// phys getters copy temperatures of heat grid to particles
+	sPublishCopyCount = 0;
+	sPublishCopyIndex = 0;
+	sPublishCopied = 0;
+	add_copy( buffer->index, alive, sizeof( int ) * count );
+	add_copy( buffer->info, spSolver->get_particles_info_stream( ), sizeof( struct PPParticleInfo ) * span );
+	add_copy( buffer->phys, spSolver->get_particles_phys_info_stream( ), sizeof( struct PPParticlePhysInfo ) * span );
+	add_copy( buffer->phys_last, spSolver->get_particles_phys_info_stream_last( ), sizeof( struct PPParticlePhysInfo ) * span );
+	add_copy( buffer->map, map, map_size );
+	if( heat )
+		add_copy( buffer->heat, heat, heat_size );
+
+	buffer->frame.count = count;
+	buffer->frame.index = buffer->index;
+	buffer->frame.info = buffer->info;
+	buffer->frame.phys = buffer->phys;
+	buffer->frame.phys_last = buffer->phys_last;
+	buffer->frame.air = buffer->air;
+
+	source->map = buffer->map;
+	source->heat = heat ? buffer->heat : NULL;
+	source->air = buffer->air;
+	source->alive = buffer->index;
+	source->alive_count = count;
+	source->phys = buffer->phys;
+	source->phys_last = buffer->phys_last;
+	return 1;
+}
+
+int publish_copy( double deadline )
+{
+	struct PPFrameBuffer * buffer = sPublishBuffers + ( sPublishFront == 0 ? 1 : 0 );
+	struct PPPublishCopy * copy;
+	int size;
+
+	// frame, which doesn't fit, isn't published
+	if( !sPublishCopyCount && !begin_copy( buffer ) )
+		return 1;
+
+	while( sPublishCopyIndex < sPublishCopyCount )
+	{
+		copy = sPublishCopies + sPublishCopyIndex;
+		size = copy->size - sPublishCopied < PUBLISH_SLICE ? copy->size - sPublishCopied : PUBLISH_SLICE;
+		memcpy( ( char * ) copy->dst + sPublishCopied, ( const char * ) copy->src + sPublishCopied, size );
+
+		sPublishCopied += size;
+		if( sPublishCopied == copy->size )
+		{
+			sPublishCopyIndex++;
+			sPublishCopied = 0;
+		}
+
+		if( sPublishCopyIndex < sPublishCopyCount && deadline > 0.0 && timer_ms( ) >= deadline )
+			return 0;
+	}
+	sPublishCopyCount = 0;
+
+	buffer->frame.frame = ++sPublishFrame;
+	sPublishPending = 1;
+
+	return 1;
+}
+
+void publish_swap( )
+{
+	if( !sPublishPending )
+		return;
+
+	sPublishFront = sPublishFront == 0 ? 1 : 0;
+	sPublishPending = 0;
+}
+
+const struct PPFrame * publish_get_frame( )
+{
+	return sPublishFront < 0 ? NULL : &sPublishBuffers[ sPublishFront ].frame;
+}
+
+const struct PPRenderSource * publish_get_source( )
+{
+	return sPublishFront < 0 ? NULL : &sPublishBuffers[ sPublishFront ].source;
+}
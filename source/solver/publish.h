@@ -0,0 +1,30 @@
+#ifndef __POWDER_PUBLISH_H__
+#define __POWDER_PUBLISH_H__
+
+
+#include "solver/solver.h"
+
+
+
+// Completed frames are copied into back buffer, then buffers are swapped, so readers of the published frame never
+// see particles of a frame, which is still being updated. Copy may run on engine thread of asynchronous update while
+// the published frame is read or rendered, swap is done by the calling thread. Particle streams are copied up to the
+// highest alive index together with particles map, heat grid and packed air, which are inputs of render and positions
+// export. Streams grow on demand.
+
+
+
+void publish_reset( );
+void publish_deinit( );
+//! Copy solver streams and render inputs into back buffer until deadline of timer_ms, 0 for no deadline. Returns 1 if
+//! the copy is complete or failed, otherwise the next call continues it, solver state must not change in between.
+int publish_copy( double deadline );
+//! Publish frame of the last publish_copy, if it's not published yet.
+void publish_swap( );
+//! Published frame, NULL if nothing is published yet.
+const struct PPFrame * publish_get_frame( );
+//! Render inputs of published frame, NULL if nothing is published yet.
+const struct PPRenderSource * publish_get_source( );
+
+
+#endif // __POWDER_PUBLISH_H__
@@ -0,0 +1,319 @@
+#include "pch.h"
+#include "api.h"
+#include "snapshot.h"
+#include "solver.h"
+#include "shared/utils.h"
+#include <stdio.h>
+#include <string.h>
+
+
+
+#define SNAPSHOT_MAGIC 0x53575050	// "PPWS"
+#define SNAPSHOT_ENDIAN 0x01020304
+
+
+
+//! Snapshot header. Configuration fields are the ones, which define layout of solver state.
+struct PPSnapshotHeader
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned int endian;		//!< SNAPSHOT_ENDIAN as written by the saving machine.
+	int size;					//!< Size of the whole snapshot.
+	int xres;
+	int yres;
+	int grid_size;
+	int chunk_size;
+	int heat_grid;
+	unsigned int seed;
+	struct PPConstants constants;
+	int sections_count;
+};
+
+//! Entry of section table, follows the header.
+struct PPSnapshotSection
+{
+	int id;
+	int offset;		//!< Offset from the snapshot start, multiple of SNAPSHOT_ALIGNMENT.
+	int size;
+	int stride;
+};
+
+
+
+extern struct PPConfiguration sConfiguration;
+extern struct PPConstants sConstants;
+extern const struct PPSolver * spSolver;
+
+
+
+
+
+static int align( int offset )
+{
+	return ( offset + SNAPSHOT_ALIGNMENT - 1 ) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+}
+
+// Fill header and section table for the current world. Returns snapshot size.
+static int build_layout( struct PPSnapshotHeader * header, struct PPSnapshotSection * table,
+	struct PPStateSection * sections )
+{
+	int i, offset;
+
+	memset( header, 0, sizeof( struct PPSnapshotHeader ) );
+	header->magic = SNAPSHOT_MAGIC;
+	header->version = SNAPSHOT_VERSION;
+	header->endian = SNAPSHOT_ENDIAN;
+	header->xres = sConfiguration.xres;
+	header->yres = sConfiguration.yres;
+	header->grid_size = sConfiguration.grid_size;
+	header->chunk_size = sConfiguration.chunk_size;
+	header->heat_grid = sConfiguration.heat_grid;
+	header->seed = sConfiguration.seed;
+	header->constants = sConstants;
+	header->sections_count = spSolver->get_state_sections( sections, MAX_STATE_SECTIONS );
+
+	offset = align( sizeof( struct PPSnapshotHeader ) + sizeof( struct PPSnapshotSection ) * header->sections_count );
+	for( i = 0; i < header->sections_count; i++ )
+	{
+		table[ i ].id = sections[ i ].id;
+		table[ i ].offset = offset;
+		table[ i ].size = sections[ i ].size;
+		table[ i ].stride = sections[ i ].stride;
+		offset = align( offset + sections[ i ].size );
+	}
+
+	header->size = offset;
+	return offset;
+}
+
+static int fail( const char * message )
+{
+	if( sConfiguration.log_fn )
+		sConfiguration.log_fn( LOG_ERROR, "Snapshot: %s.", message );
+
+	return 0;
+}
+
+// Validate header and section table, reinitialize world if its layout differs, and get sections
+// to load into. Returns 0 on failure.
+static int prepare_load( const struct PPSnapshotHeader * header, const struct PPSnapshotSection * table,
+	int size, struct PPStateSection * sections )
+{
+	struct PPConfiguration configuration;
+	int i, count;
+
+	if( header->magic != SNAPSHOT_MAGIC )
+		return fail( "not a snapshot" );
+	if( header->endian != SNAPSHOT_ENDIAN )
+		return fail( "byte order differs" );
+	if( header->version != SNAPSHOT_VERSION )
+		return fail( "unsupported version" );
+	if( header->size > size || header->sections_count < 0 || header->sections_count > MAX_STATE_SECTIONS )
+		return fail( "truncated or corrupted snapshot" );
+
+	for( i = 0; i < header->sections_count; i++ )
+		if( table[ i ].offset < 0 || table[ i ].size < 0 || table[ i ].offset > header->size - table[ i ].size )
+			return fail( "corrupted section table" );
+
+	// the world is reinitialized only for a layout, which it can have
+	if( header->grid_size <= 0 || header->xres <= 0 || header->yres <= 0 ||
+		header->xres % header->grid_size != 0 || header->yres % header->grid_size != 0 ||
+		header->xres > MAX_WORLD_CELLS / header->yres || header->chunk_size < 0 )
+		return fail( "invalid world layout" );
+
+	if( header->xres != sConfiguration.xres || header->yres != sConfiguration.yres ||
+		header->grid_size != sConfiguration.grid_size || header->chunk_size != sConfiguration.chunk_size ||
+		header->heat_grid != sConfiguration.heat_grid )
+	{
+		configuration = sConfiguration;
+		configuration.xres = header->xres;
+		configuration.yres = header->yres;
+		configuration.grid_size = header->grid_size;
+		configuration.chunk_size = header->chunk_size;
+		configuration.heat_grid = header->heat_grid;
+
+		if( sConfiguration.log_fn )
+			sConfiguration.log_fn( LOG_INFO, "Snapshot: reinitializing world for %dx%d.", header->xres, header->yres );
+
+		pp_deinit( );
+		if( !pp_init( &configuration ) )
+			return fail( "reinitialization failed" );
+	}
+
+	count = spSolver->get_state_sections( sections, MAX_STATE_SECTIONS );
+	if( count != header->sections_count )
+		return fail( "sections differ" );
+
+	for( i = 0; i < count; i++ )
+		if( sections[ i ].id != table[ i ].id || sections[ i ].size != table[ i ].size ||
+			sections[ i ].stride != table[ i ].stride )
+			return fail( "sections differ" );
+
+	return 1;
+}
+
+// Start the world anew after sections were partially or wrongly loaded.
+static int reset_load( const char * message )
+{
+	struct PPConfiguration configuration = sConfiguration;
+
+	pp_deinit( );
+	pp_init( &configuration );
+	return fail( message );
+}
+
+// Apply loaded header and let solver rebuild everything derived from sections. Returns 0 if sections are corrupted.
+static int finish_load( const struct PPSnapshotHeader * header )
+{
+	if( spSolver->check_state && !spSolver->check_state( ) )
+		return reset_load( "corrupted solver state" );
+
+	sConfiguration.seed = header->seed;
+	sConstants = header->constants;
+
+	if( spSolver->state_loaded )
+		spSolver->state_loaded( );
+	return 1;
+}
+
+int snapshot_get_size( )
+{
+	struct PPSnapshotHeader header;
+	struct PPSnapshotSection table[ MAX_STATE_SECTIONS ];
+	struct PPStateSection sections[ MAX_STATE_SECTIONS ];
+
+	return build_layout( &header, table, sections );
+}
+
+int snapshot_save_memory( void * buffer, int size )
+{
+	struct PPSnapshotHeader header;
+	struct PPSnapshotSection table[ MAX_STATE_SECTIONS ];
+	struct PPStateSection sections[ MAX_STATE_SECTIONS ];
+	char * data = ( char * ) buffer;
+	int i, end;
+
+	if( build_layout( &header, table, sections ) > size )
+		return fail( "buffer is too small" );
+
+	memcpy( data, &header, sizeof( header ) );
+	memcpy( data + sizeof( header ), table, sizeof( struct PPSnapshotSection ) * header.sections_count );
+
+	// padding is zeroed and so are dead particle slots, so equal worlds give equal snapshots
+	end = sizeof( header ) + sizeof( struct PPSnapshotSection ) * header.sections_count;
+	for( i = 0; i < header.sections_count; i++ )
+	{
+		memset( data + end, 0, table[ i ].offset - end );
+		memcpy( data + table[ i ].offset, sections[ i ].data, table[ i ].size );
+		end = table[ i ].offset + table[ i ].size;
+	}
+	memset( data + end, 0, header.size - end );
+
+	return 1;
+}
+
+int snapshot_save_file( const char * path )
+{
+	struct PPSnapshotHeader header;
+	struct PPSnapshotSection table[ MAX_STATE_SECTIONS ];
+	struct PPStateSection sections[ MAX_STATE_SECTIONS ];
+	char padding[ SNAPSHOT_ALIGNMENT ];
+	FILE * file;
+	int i, end, ok;
+
+	build_layout( &header, table, sections );
+
+	file = fopen( path, "wb" );
+	if( !file )
+		return fail( "can't open file for writing" );
+
+	memset( padding, 0, sizeof( padding ) );
+	ok = fwrite( &header, sizeof( header ), 1, file ) == 1;
+	ok = ok && fwrite( table, sizeof( struct PPSnapshotSection ), header.sections_count, file ) == ( size_t ) header.sections_count;
+	end = sizeof( header ) + sizeof( struct PPSnapshotSection ) * header.sections_count;
+	for( i = 0; i < header.sections_count && ok; i++ )
+	{
+		ok = fwrite( padding, 1, table[ i ].offset - end, file ) == ( size_t )( table[ i ].offset - end );
+		ok = ok && fwrite( sections[ i ].data, 1, table[ i ].size, file ) == ( size_t ) table[ i ].size;
+		end = table[ i ].offset + table[ i ].size;
+	}
+	ok = ok && fwrite( padding, 1, header.size - end, file ) == ( size_t )( header.size - end );
+
+	if( fclose( file ) || !ok )
+		return fail( "write failed" );
+
+	return 1;
+}
+
+int snapshot_load_memory( const void * buffer, int size )
+{
+	struct PPSnapshotHeader header;
+	struct PPSnapshotSection table[ MAX_STATE_SECTIONS ];
+	struct PPStateSection sections[ MAX_STATE_SECTIONS ];
+	const char * data = ( const char * ) buffer;
+	int i;
+
+	if( size < ( int ) sizeof( header ) )
+		return fail( "truncated or corrupted snapshot" );
+
+	memcpy( &header, data, sizeof( header ) );
+	if( header.sections_count < 0 || header.sections_count > MAX_STATE_SECTIONS ||
+		size < ( int )( sizeof( header ) + sizeof( struct PPSnapshotSection ) * header.sections_count ) )
+		return fail( "truncated or corrupted snapshot" );
+
+	memcpy( table, data + sizeof( header ), sizeof( struct PPSnapshotSection ) * header.sections_count );
+	if( !prepare_load( &header, table, size, sections ) )
+		return 0;
+
+	for( i = 0; i < header.sections_count; i++ )
+		memcpy( sections[ i ].data, data + table[ i ].offset, table[ i ].size );
+
+	return finish_load( &header );
+}
+
+int snapshot_load_file( const char * path )
+{
+	struct PPSnapshotHeader header;
+	struct PPSnapshotSection table[ MAX_STATE_SECTIONS ];
+	struct PPStateSection sections[ MAX_STATE_SECTIONS ];
+	FILE * file;
+	long size;
+	int i, ok;
+
+	file = fopen( path, "rb" );
+	if( !file )
+		return fail( "can't open file for reading" );
+
+	ok = !fseek( file, 0, SEEK_END );
+	size = ftell( file );
+	ok = ok && size >= ( long ) sizeof( header ) && !fseek( file, 0, SEEK_SET );
+	ok = ok && fread( &header, sizeof( header ), 1, file ) == 1;
+	ok = ok && header.sections_count >= 0 && header.sections_count <= MAX_STATE_SECTIONS;
+	ok = ok && fread( table, sizeof( struct PPSnapshotSection ), header.sections_count, file ) == ( size_t ) header.sections_count;
+	if( !ok )
+	{
+		fclose( file );
+		return fail( "truncated or corrupted snapshot" );
+	}
+
+	if( !prepare_load( &header, table, ( int ) size, sections ) )
+	{
+		fclose( file );
+		return 0;
+	}
+
+	// sections are read straight into solver storage
+	for( i = 0; i < header.sections_count && ok; i++ )
+	{
+		ok = !fseek( file, table[ i ].offset, SEEK_SET );
+		ok = ok && fread( sections[ i ].data, 1, table[ i ].size, file ) == ( size_t ) table[ i ].size;
+	}
+	fclose( file );
+
+	// streams and maps may disagree after partial read, so the world is started anew
+	if( !ok )
+		return reset_load( "read failed" );
+
+	return finish_load( &header );
+}
@@ -0,0 +1,31 @@
+#ifndef __POWDER_SNAPSHOT_H__
+#define __POWDER_SNAPSHOT_H__
+
+
+#include "shared/types.h"
+
+
+
+// World snapshot is a header, a table of state sections and sections data, every section aligned to
+// SNAPSHOT_ALIGNMENT bytes. Sections are stored exactly as solver keeps them, so loading is one bulk
+// copy per section. Snapshots are little-endian: a snapshot from machine with different byte order
+// is rejected.
+
+#define SNAPSHOT_VERSION 3
+#define SNAPSHOT_ALIGNMENT 64
+
+
+
+//! Size of snapshot of the current world in bytes.
+int snapshot_get_size( );
+//! Save world to buffer of at least snapshot_get_size bytes. Returns 0 on failure.
+int snapshot_save_memory( void * buffer, int size );
+//! Save world to file. Returns 0 on failure.
+int snapshot_save_file( const char * path );
+//! Load world from snapshot in memory. World is reinitialized if its size differs. Returns 0 on failure.
+int snapshot_load_memory( const void * buffer, int size );
+//! Load world from file. Returns 0 on failure.
+int snapshot_load_file( const char * path );
+
+
+#endif // __POWDER_SNAPSHOT_H__
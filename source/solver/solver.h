@@ -0,0 +1,157 @@
+#ifndef __POWDER_SOLVER_H__
+#define __POWDER_SOLVER_H__
+
+
+#include "shared/types.h"
+
+
+
+#define MAX_STATE_SECTIONS 24
+#define MAX_WORLD_CELLS ( 1 << 22 )		//!< Cells of the world addressable by particle index of particles map.
+
+
+
+//! Identifier of solver state section.
+enum PPStateSectionId
+{
+	SECTION_FIRST_FREE,				//!< Index of the first dead particle.
+	SECTION_ALIVE_COUNT,			//!< Number of alive particles.
+	SECTION_PARTICLES_INFO,			//!< PPParticleInfo stream.
+	SECTION_PARTICLES_PHYS,			//!< Current PPParticlePhysInfo stream.
+	SECTION_PARTICLES_PHYS_LAST,	//!< Previous PPParticlePhysInfo stream.
+	SECTION_PARTICLE_MAP,			//!< Particles map, xres * yres entries.
+	SECTION_AIR_TYPE,				//!< Collision type of air cells.
+	SECTION_AIR_VX,					//!< Current air x velocity.
+	SECTION_AIR_VY,					//!< Current air y velocity.
+	SECTION_AIR_P,					//!< Current air pressure.
+	SECTION_AIR_VX_LAST,			//!< Previous air x velocity.
+	SECTION_AIR_VY_LAST,			//!< Previous air y velocity.
+	SECTION_AIR_P_LAST,				//!< Previous air pressure.
+	SECTION_COMPACT_BASELINE,		//!< Fragmentation of particle streams after the last compaction.
+	SECTION_FRAME,					//!< Frame counter.
+	SECTION_CHUNKS,					//!< States of sleeping chunks.
+	SECTION_HEAT,					//!< Current temperatures of heat grid.
+	SECTION_HEAT_LAST,				//!< Previous temperatures of heat grid.
+	SECTION_ALIVE_LIST,				//!< Indices of alive particles, the first alive count entries are valid.
+	SECTION_MAX_SPEED,				//!< Largest particle velocity of the last update, sizes substeps.
+};
+
+//! Identifier of structure derived from state sections, see PPSolver::get_derived_sections.
+enum PPDerivedSectionId
+{
+	DERIVED_ALIVE_POSITIONS,		//!< Positions of particles in alive list.
+	DERIVED_PLANES,					//!< Occupancy bit planes.
+	DERIVED_HEAT_MASK,				//!< Occupied cells of heat grid.
+	DERIVED_HEAT_CONDUCT,			//!< Heat conduct of heat grid cells.
+	DERIVED_HEAT_SYNCED,			//!< Particle temperatures are copied from heat grid.
+	DERIVED_CHANGES,				//!< Flags of change lists.
+	DERIVED_CHANGES_COUNT,			//!< Number of particle changes.
+	DERIVED_CHANGED_CELLS_COUNT,	//!< Number of changed cells.
+	DERIVED_CHANGES_COLLECTED,		//!< Particle changes, whose cells are collected.
+	DERIVED_CHANGES_FINISHED,		//!< Frame of change lists is over.
+};
+
+//! Piece of solver state. All sections together describe the world completely.
+struct PPStateSection
+{
+	int id;					//!< Section identifier, one of PPStateSectionId or PPDerivedSectionId.
+	const char * name;		//!< Section name, used for reporting.
+	void * data;			//!< Section data, owned by solver.
+	int size;				//!< Section size in bytes.
+	int stride;				//!< Size of one element in bytes.
+	int width;				//!< Width of grid for grid sections, 0 otherwise.
+	int border;				//!< Number of padding cells around grid.
+};
+
+//! Inputs of render and positions export, a copy of them is published with the frame.
+struct PPRenderSource
+{
+	const struct PPParticleMap * map;				//!< Particles map, xres * yres entries.
+	const float * heat;								//!< Temperatures of heat grid like map, NULL if it's disabled.
+	const struct PPAirParticle * air;				//!< Air grid packed like get_air_particle_stream.
+	const int * alive;								//!< Indices of alive particles.
+	int alive_count;
+	const struct PPParticlePhysInfo * phys;			//!< Current stream, indexed by particle.
+	const struct PPParticlePhysInfo * phys_last;	//!< Previous stream, indexed by particle.
+};
+
+
+
+//! Solver backend interface.
+struct PPSolver
+{
+	const char * name;
+
+	//! Initialize storage and update resources. Returns 0 on failure.
+	int ( * init )( );
+	//! Deinitialize everything allocated by init.
+	int ( * deinit )( );
+	//! Initialize update resources only, on top of storage initialized by another solver. Used by cross-check mode.
+	int ( * attach )( );
+	//! Deinitialize resources allocated by attach.
+	int ( * detach )( );
+
+	//! Run one step of simulation. pp_update may run several steps, see PPConfiguration::cfl and fixed_step.
+	void ( * update )( pp_time_t dt );
+	//! Run step until 'deadline' of timer_ms, 0 for no deadline. Returns 1 if the step is complete, otherwise the next call
+	//! continues it with the same 'dt'. Edits between calls are allowed, except ones noted by pp_update_budgeted.
+	int ( * update_slice )( pp_time_t dt, double deadline );
+	//! Finish frame of pp_update after all its steps.
+	void ( * end_frame )( );
+	//! Largest velocity component of particles moved by the last step or of air, in pixels per second.
+	float ( * get_max_speed )( );
+
+	int ( * get_alive_particles_count )( );
+	//! Get indices of alive particles, get_alive_particles_count entries in no particular order.
+	const int * ( * get_alive_particles )( );
+	const struct PPParticleInfo * ( * get_particles_info_stream )( );
+	const struct PPParticlePhysInfo * ( * get_particles_phys_info_stream )( );
+	const struct PPParticlePhysInfo * ( * get_particles_phys_info_stream_last )( );
+	struct PPAirParticle * ( * get_air_particle_stream )( );
+	const struct PPAirParticle * ( * get_air_particle_stream_last )( );
+	//! Pack current air grid into 'air' like get_air_particle_stream, but without handing out the view.
+	void ( * pack_air )( struct PPAirParticle * air );
+
+	void ( * spawn_at )( int x, int y, unsigned int type );
+	//! Spawn particles into empty cells of rectangle, which is inside of the world border. Type of cell (x + i, y + j) is
+	//! types[ j * stride + i ] if types is not NULL, 0 or invalid type skips the cell. Returns number of spawned particles.
+	int ( * spawn_rect )( int x, int y, int width, int height, unsigned int type, const unsigned char * types, int stride );
+	//! Spawn particles from records, invalid records are skipped. Returns number of spawned particles.
+	int ( * spawn_records )( const struct PPSpawnRecord * records, int count );
+	void ( * collision_set )( int x, int y, unsigned int collision_type );
+	//! Set collisions of rectangle inside of the world from types[ j * stride + i ], 0 removes collision. Cells occupied
+	//! by particles and cells with invalid types are left alone. Returns number of changed cells.
+	int ( * collision_import )( int x, int y, int width, int height, const unsigned char * types, int stride );
+	//! Pack alive particles and order them by position. Returns 0 on failure.
+	int ( * compact )( );
+	//! Get rectangle changed by the last update. Returns 0 if it is empty.
+	int ( * get_dirty_rect )( int * x0, int * y0, int * x1, int * y1 );
+	//! Get changes of the world since the previous update, NULL if they are not recorded.
+	const struct PPChanges * ( * get_changes )( );
+	//! Render viewport, which is inside of the world, in one of PPRenderFormat from 'source', NULL renders solver state.
+	//! Source is rendered by the calling thread alone, as worker threads may run an update. Returns 0 on failure.
+	int ( * render )( const struct PPRenderSource * source, int format, void * buffer, int stride, int x, int y, int width, int height );
+	//! Write interpolated records of alive particles of 'source' in one of PPPositionFormat, the same as render.
+	//! Returns number of records.
+	int ( * export_positions )( const struct PPRenderSource * source, float alpha, int format, void * buffer, int stride );
+
+	//! Fill state sections, returns number of sections. Sections are valid until the next update.
+	int ( * get_state_sections )( struct PPStateSection * sections, int max_count );
+	//! Check sections overwritten by untrusted data, e.g. snapshot file, before state_loaded. Returns 0 if they are
+	//! inconsistent. May be NULL.
+	int ( * check_state )( );
+	//! Notify solver that its sections were overwritten. May be NULL.
+	void ( * state_loaded )( );
+	//! Fill sections of structures, which are derived from state sections and changed by update, e.g. occupancy planes or
+	//! counters of change lists. Cross-check restores them together with state sections after reference step instead of
+	//! rebuilding them by state_loaded. Returns number of sections, which are valid until the next update. May be NULL.
+	int ( * get_derived_sections )( struct PPStateSection * sections, int max_count );
+};
+
+
+
+extern const struct PPSolver sSolverCpuSt;
+extern const struct PPSolver sSolverCpuMt;
+
+
+#endif // __POWDER_SOLVER_H__
\ No newline at end of file
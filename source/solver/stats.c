@@ -0,0 +1,87 @@
+#include "pch.h"
+#include "stats.h"
+#include "shared/timer.h"
+#include <string.h>
+
+
+
+struct PPStats sStats;			//!< Record of the last frame.
+struct PPStats sStatsNext;		//!< Record of the frame being updated, counts edits since the last frame too.
+int sStatsEnabled = 1;
+
+
+
+
+
+void stats_reset( )
+{
+	memset( &sStats, 0, sizeof( sStats ) );
+	memset( &sStatsNext, 0, sizeof( sStatsNext ) );
+}
+
+void stats_enable( int enable )
+{
+	if( enable && !sStatsEnabled )
+		stats_reset( );
+	sStatsEnabled = enable;
+}
+
+double stats_begin( )
+{
+#ifndef POWDER_NO_STATS
+	if( sStatsEnabled )
+		return timer_ms( );
+#endif
+	return 0.0;
+}
+
+double stats_lap( float * phase, double start )
+{
+#ifndef POWDER_NO_STATS
+	double now;
+
+	if( sStatsEnabled )
+	{
+		now = timer_ms( );
+		*phase += ( float )( now - start );
+		return now;
+	}
+#endif
+	return 0.0;
+}
+
+void stats_add_step( const struct PPStepStats * step )
+{
+#ifndef POWDER_NO_STATS
+	sStatsNext.particles += step->particles;
+	sStatsNext.blocked += step->blocked;
+	sStatsNext.stagnant += step->stagnant;
+	sStatsNext.trace_steps += step->trace_steps;
+	sStatsNext.liquid_search += step->liquid_search;
+	sStatsNext.moves += step->moves;
+	sStatsNext.moves_failed += step->moves_failed;
+#endif
+}
+
+void stats_end_frame( )
+{
+#ifndef POWDER_NO_STATS
+	int frame = sStats.frame;
+
+	if( !sStatsEnabled )
+		return;
+
+	sStats = sStatsNext;
+	sStats.frame = frame + 1;
+	memset( &sStatsNext, 0, sizeof( sStatsNext ) );
+#endif
+}
+
+const struct PPStats * stats_get( )
+{
+#ifndef POWDER_NO_STATS
+	if( sStatsEnabled )
+		return &sStats;
+#endif
+	return NULL;
+}
@@ -0,0 +1,65 @@
+#ifndef __POWDER_STATS_H__
+#define __POWDER_STATS_H__
+
+
+#include "shared/types.h"
+
+
+
+// Statistics of a frame are collected into the next frame record and published when pp_update
+// returns. Counters of particle update are kept by update contexts and added after the particle
+// pass, so parallel bands don't share them. Phase times are measured only while statistics are
+// enabled. Defining POWDER_NO_STATS compiles all of it out.
+
+
+
+//! Counters of particle update, kept by update context.
+struct PPStepStats
+{
+	int particles;			//!< Particles updated.
+	int blocked;			//!< Particles blocked by neighbours.
+	int stagnant;			//!< Particles stagnant after position update.
+	int trace_steps;		//!< Steps of collision trace.
+	int liquid_search;		//!< Iterations of liquid spreading search.
+	int moves;				//!< Attempts to move aside.
+	int moves_failed;		//!< Failed attempts to move aside.
+};
+
+
+
+extern struct PPStats sStatsNext;
+
+
+
+#ifndef POWDER_NO_STATS
+
+#define STEP_STAT( ctx, counter ) ( ( ctx )->stats.counter++ )
+#define STEP_STAT_ADD( ctx, counter, value ) ( ( ctx )->stats.counter += ( value ) )
+//! Count event outside of particle update, e.g. spawned particle.
+#define STATS_COUNT( counter ) ( sStatsNext.counter++ )
+
+#else
+
+#define STEP_STAT( ctx, counter ) ( ( void ) 0 )
+#define STEP_STAT_ADD( ctx, counter, value ) ( ( void ) 0 )
+#define STATS_COUNT( counter ) ( ( void ) 0 )
+
+#endif
+
+
+
+void stats_reset( );
+void stats_enable( int enable );
+//! Start timing of a phase. Returns start time, 0 if statistics are disabled.
+double stats_begin( );
+//! Add time since 'start' to phase of the next frame record. Returns the current time as start of the next phase.
+double stats_lap( float * phase, double start );
+//! Add counters of update context to the next frame record.
+void stats_add_step( const struct PPStepStats * step );
+//! Publish the next frame record.
+void stats_end_frame( );
+//! Get published record, NULL if statistics are disabled.
+const struct PPStats * stats_get( );
+
+
+#endif // __POWDER_STATS_H__
@@ -0,0 +1,118 @@
+#include "pch.h"
+#include "stepping.h"
+#include "solver.h"
+#include <math.h>
+
+
+
+#define DEFAULT_MAX_SUBSTEPS 8
+
+
+
+extern struct PPConfiguration sConfiguration;
+extern const struct PPSolver * spSolver;
+
+pp_time_t sStepAccumulator = 0;		//!< Time accumulated for fixed steps.
+pp_time_t sStepLeft = 0;			//!< Time of the current step, which isn't covered by substeps yet.
+int sStepOpen = 0;					//!< Is there a step with substeps left? Step of zero time still runs one substep.
+int sStepsDone = 0;					//!< Number of substeps of the current update.
+int sStepLimit = DEFAULT_MAX_SUBSTEPS;	//!< Maximal number of substeps of the current update.
+
+
+
+
+
+void stepping_reset( )
+{
+	sStepAccumulator = 0;
+	sStepLeft = 0;
+	sStepOpen = 0;
+	sStepsDone = 0;
+}
+
+void stepping_begin( pp_time_t dt )
+{
+	sStepLimit = sConfiguration.max_substeps > 0 ? sConfiguration.max_substeps : DEFAULT_MAX_SUBSTEPS;
+	sStepsDone = 0;
+
+	if( sConfiguration.fixed_step <= 0 )
+	{
+		sStepLeft = dt;
+		sStepOpen = 1;
+	}
+	else
+	{
+		sStepAccumulator += dt;
+		sStepLeft = 0;
+		sStepOpen = 0;
+	}
+}
+
+void stepping_accumulate( pp_time_t dt )
+{
+	if( sConfiguration.fixed_step > 0 )
+		sStepAccumulator += dt;
+}
+
+int stepping_next( pp_time_t * dt )
+{
+	pp_time_t part;
+	float moves;
+	int n;
+
+	if( !sStepOpen )
+	{
+		if( sConfiguration.fixed_step <= 0 )
+			return 0;
+
+		// steps, which don't fit, are dropped
+		if( sStepAccumulator < sConfiguration.fixed_step || sStepsDone >= sStepLimit )
+		{
+			if( sStepAccumulator >= sConfiguration.fixed_step )
+				sStepAccumulator %= sConfiguration.fixed_step;
+			return 0;
+		}
+
+		sStepAccumulator -= sConfiguration.fixed_step;
+		sStepLeft = sConfiguration.fixed_step;
+		sStepOpen = 1;
+	}
+
+	// substeps left are sized by the current velocity, which may grow, so the last one isn't a tiny remainder
+	n = 1;
+	if( sConfiguration.cfl > 0.0f )
+	{
+		moves = spSolver->get_max_speed( ) * sStepLeft * FLT_SECOND / sConfiguration.cfl;
+		n = moves < ( float )( sStepLimit - sStepsDone ) ? ( int ) ceil( moves ) : sStepLimit - sStepsDone;
+		if( n < 1 )
+			n = 1;
+	}
+
+	part = ( sStepLeft + n - 1 ) / n;
+	sStepLeft -= part;
+	sStepsDone++;
+	if( sStepLeft <= 0 )
+		sStepOpen = 0;
+
+	*dt = part;
+	return 1;
+}
+
+int stepping_update( pp_time_t dt, PPStepFn step )
+{
+	pp_time_t part;
+
+	stepping_begin( dt );
+	while( stepping_next( &part ) )
+		step( part );
+
+	return sStepsDone;
+}
+
+float stepping_get_alpha( )
+{
+	if( sConfiguration.fixed_step <= 0 )
+		return 1.0f;
+
+	return ( float ) sStepAccumulator / ( float ) sConfiguration.fixed_step;
+}
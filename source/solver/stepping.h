@@ -0,0 +1,33 @@
+#ifndef __POWDER_STEPPING_H__
+#define __POWDER_STEPPING_H__
+
+
+#include "shared/types.h"
+
+
+
+// Time of pp_update is split into solver steps. With PPConfiguration::fixed_step it's accumulated and simulated in steps
+// of fixed length. With PPConfiguration::cfl every step is split into substeps sized by the largest velocity of the
+// previous substep, evenly, so the last substep isn't a tiny remainder. Number of steps of one update is limited and
+// time, which doesn't fit, is dropped.
+
+
+
+typedef void (* PPStepFn) ( pp_time_t dt );
+
+
+
+void stepping_reset( );
+//! Start update of 'dt' of time, which stepping_next splits into steps.
+void stepping_begin( pp_time_t dt );
+//! Add time of fixed steps to update in progress. Time isn't accumulated without fixed step.
+void stepping_accumulate( pp_time_t dt );
+//! Get time of the next step of update. Returns 0 if update is complete.
+int stepping_next( pp_time_t * dt );
+//! Run steps for 'dt' of time. Returns number of steps.
+int stepping_update( pp_time_t dt, PPStepFn step );
+//! Fraction of fixed step accumulated, but not simulated yet. 1 without fixed step.
+float stepping_get_alpha( );
+
+
+#endif // __POWDER_STEPPING_H__
@@ -0,0 +1,153 @@
+#include "pch.h"
+#include "trace.h"
+#include "shared/utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+//! Complete event of timeline.
+struct PPTraceEvent
+{
+	const char * name;		//!< Static string.
+	double start;			//!< Start time of timer_ms.
+	float duration;			//!< Duration in milliseconds.
+	int index;				//!< Job or frame index, -1 if none.
+};
+
+//! Ring of events of one worker thread.
+struct PPTraceLane
+{
+	struct PPTraceEvent * events;
+	unsigned int written;		//!< Number of events written since start, the next one goes to written % sTraceCapacity.
+	char padding[ 64 - sizeof( void * ) - sizeof( unsigned int ) ];	//!< Keeps lanes of workers on separate cache lines.
+};
+
+
+
+extern struct PPConfiguration sConfiguration;
+
+int sTraceEnabled = 0;
+struct PPTraceLane * spTraceLanes = NULL;
+struct PPTraceEvent * spTraceEvents = NULL;		//!< Single allocation for events of all lanes.
+int sTraceLanesCount = 0;
+int sTraceCapacity = 0;			//!< Events per lane.
+
+
+
+
+
+static int fail( const char * message )
+{
+	if( sConfiguration.log_fn )
+		sConfiguration.log_fn( LOG_ERROR, "Trace: %s.", message );
+
+	return 0;
+}
+
+void trace_deinit( )
+{
+	sTraceEnabled = 0;
+	free( spTraceLanes );
+	free( spTraceEvents );
+	spTraceLanes = NULL;
+	spTraceEvents = NULL;
+	sTraceLanesCount = 0;
+	sTraceCapacity = 0;
+}
+
+int trace_start( int memory, int workers )
+{
+	int i;
+
+	trace_deinit( );
+
+	if( workers < 1 || memory / workers < ( int ) sizeof( struct PPTraceEvent ) )
+		return fail( "memory budget is too small" );
+
+	sTraceCapacity = memory / workers / sizeof( struct PPTraceEvent );
+	spTraceLanes = ( struct PPTraceLane * ) malloc_log( sizeof( struct PPTraceLane ) * workers );
+	spTraceEvents = ( struct PPTraceEvent * ) malloc_log( sizeof( struct PPTraceEvent ) * sTraceCapacity * workers );
+	if( !spTraceLanes || !spTraceEvents )
+	{
+		trace_deinit( );
+		return 0;
+	}
+
+	memset( spTraceLanes, 0, sizeof( struct PPTraceLane ) * workers );
+	for( i = 0; i < workers; i++ )
+		spTraceLanes[ i ].events = spTraceEvents + i * sTraceCapacity;
+	sTraceLanesCount = workers;
+	sTraceEnabled = 1;
+
+	return 1;
+}
+
+void trace_stop( )
+{
+	sTraceEnabled = 0;
+}
+
+void trace_event( const char * name, int worker, int index, double start )
+{
+	struct PPTraceLane * lane = spTraceLanes + worker;
+	struct PPTraceEvent * event;
+
+	// scope began before tracing was started
+	if( start == 0.0 )
+		return;
+
+	event = lane->events + lane->written % sTraceCapacity;
+	event->name = name;
+	event->start = start;
+	event->duration = ( float )( timer_ms( ) - start );
+	event->index = index;
+	lane->written++;
+}
+
+int trace_save_file( const char * path )
+{
+	const struct PPTraceLane * lane;
+	const struct PPTraceEvent * event;
+	double origin = 0.0;
+	unsigned int j;
+	FILE * file;
+	int i, ok;
+
+	// timestamps are written relative to the earliest recorded start, events are recorded in order of their ends
+	for( i = 0, lane = spTraceLanes; i < sTraceLanesCount; i++, lane++ )
+		for( j = 0; j < lane->written && j < ( unsigned int ) sTraceCapacity; j++ )
+			if( origin == 0.0 || lane->events[ j ].start < origin )
+				origin = lane->events[ j ].start;
+
+	file = fopen( path, "w" );
+	if( !file )
+		return fail( "can't open file for writing" );
+
+	ok = fprintf( file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+		"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"Powder Physics\"}}" ) > 0;
+	for( i = 0, lane = spTraceLanes; i < sTraceLanesCount && ok; i++, lane++ )
+	{
+		ok = fprintf( file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"worker %d\"}}", i, i ) > 0;
+
+		// events of full ring start at the oldest one
+		j = lane->written > ( unsigned int ) sTraceCapacity ? lane->written - sTraceCapacity : 0;
+		for( ; j < lane->written && ok; j++ )
+		{
+			event = lane->events + j % sTraceCapacity;
+			if( event->index >= 0 )
+				ok = fprintf( file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"index\":%d}}",
+					event->name, i, ( event->start - origin ) * 1000.0, event->duration * 1000.0, event->index ) > 0;
+			else
+				ok = fprintf( file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+					event->name, i, ( event->start - origin ) * 1000.0, event->duration * 1000.0 ) > 0;
+		}
+	}
+	ok = ok && fprintf( file, "\n]}\n" ) > 0;
+
+	if( fclose( file ) || !ok )
+		return fail( "write failed" );
+
+	return 1;
+}
@@ -0,0 +1,47 @@
+#ifndef __POWDER_TRACE_H__
+#define __POWDER_TRACE_H__
+
+
+#include "shared/timer.h"
+
+
+
+// Timeline of updates is recorded as complete events, i.e. start and duration of a scope, into ring buffers of
+// fixed size, one per worker thread, so workers never share a write position. The oldest events are overwritten
+// when a ring is full. A scope costs a branch while tracing is stopped and two timer reads while it runs. Defining
+// POWDER_NO_TRACE compiles scopes out.
+
+
+
+extern int sTraceEnabled;
+
+
+
+#ifndef POWDER_NO_TRACE
+
+//! Start of traced scope, 0 if tracing is stopped.
+#define TRACE_BEGIN( ) ( sTraceEnabled ? timer_ms( ) : 0.0 )
+//! Record scope started by TRACE_BEGIN on 'worker' thread. 'name' must be a static string, 'index' is job or frame index, -1 if none.
+#define TRACE_END( name, worker, index, start ) ( sTraceEnabled ? trace_event( name, worker, index, start ) : ( void ) 0 )
+
+#else
+
+#define TRACE_BEGIN( ) 0.0
+#define TRACE_END( name, worker, index, start ) ( ( void )( start ) )
+
+#endif
+
+
+
+//! Allocate rings of 'memory' bytes in total for 'workers' threads and start recording. Returns 0 on failure.
+int trace_start( int memory, int workers );
+//! Stop recording, recorded events are kept.
+void trace_stop( );
+//! Free rings.
+void trace_deinit( );
+//! Write recorded events as Chrome trace JSON. Returns 0 on failure.
+int trace_save_file( const char * path );
+void trace_event( const char * name, int worker, int index, double start );
+
+
+#endif // __POWDER_TRACE_H__